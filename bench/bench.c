@@ -0,0 +1,343 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "gasconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "common.h"
+#include "cfgtree.h"
+#include "parser.h"
+#include "confgen.h"
+
+/* Benchmark of read_config_file() and free_conf_tree() on synthetic
+   configurations. Each case prints one JSON object on a line, so that
+   the results of two commits can be compared with a script. */
+
+/* The linker routes the allocation calls of the whole program through
+   these wrappers (see bench/local.mk), to count them. */
+static atomic_ulong allocations;
+static atomic_ulong deallocations;
+
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t nmemb, size_t n);
+void *__real_realloc(void *p, size_t n);
+void __real_free(void *p);
+
+void *__wrap_malloc(size_t n)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __real_malloc(n);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t n)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __real_calloc(nmemb, n);
+}
+
+void *__wrap_realloc(void *p, size_t n)
+{
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __real_realloc(p, n);
+}
+
+void __wrap_free(void *p)
+{
+    if (p != NULL)
+        atomic_fetch_add_explicit(&deallocations, 1, memory_order_relaxed);
+    __real_free(p);
+}
+
+struct bench_case_t {
+    const char *name;
+    struct confgen_t spec;
+};
+
+/* directives, depth, args, quoting, files, seed */
+static const struct bench_case_t bench_cases[] = {
+    { "small",     { 1000,   2,  2,  0.1, 1,   1 } },
+    { "large",     { 500000, 2,  3,  0.1, 1,   2 } },
+    { "deep",      { 100000, 16, 2,  0.1, 1,   3 } },
+    { "args",      { 100000, 2,  12, 0.1, 1,   4 } },
+    { "quoted",    { 200000, 2,  3,  0.9, 1,   5 } },
+    { "fragments", { 200000, 2,  3,  0.1, 256, 6 } },
+};
+
+#define BENCH_NCASES (sizeof(bench_cases) / sizeof(bench_cases[0]))
+
+/* The results of a case: the best of all runs for times, the first run
+   for the rest. Later runs find the strings already interned, so the
+   first is the one that matches a daemon start. */
+struct bench_result_t {
+    double parse;
+    double free;
+    long peak_rss;
+    unsigned long parse_allocs;
+    unsigned long free_deallocs;
+};
+
+static const char *program_name = NULL;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Reset the peak resident set size of the process. Return -1 if the
+   kernel cannot, and ru_maxrss is then the peak of the whole run. */
+static int bench_reset_peak_rss(void)
+{
+    FILE *stream = fopen("/proc/self/clear_refs", "w");
+    int result;
+
+    if (stream == NULL)
+        return -1;
+
+    result = fputs("5", stream) < 0 ? -1 : 0;
+    if (fclose(stream) != 0)
+        result = -1;
+
+    return result;
+}
+
+/* The peak resident set size in KiB. */
+static long bench_peak_rss(void)
+{
+    FILE *stream = fopen("/proc/self/status", "r");
+    struct rusage usage;
+    char line[256];
+    long kib = -1;
+
+    if (stream != NULL) {
+        while (fgets(line, sizeof(line), stream) != NULL) {
+            if (sscanf(line, "VmHWM: %ld kB", &kib) == 1)
+                break;
+        }
+        fclose(stream);
+    }
+
+    if (kib < 0 && getrusage(RUSAGE_SELF, &usage) == 0)
+        kib = usage.ru_maxrss;
+
+    return kib;
+}
+
+static int bench_run(const char *filename, int repeat,
+                     struct bench_result_t *result)
+{
+    conftree_t conftree;
+    double start, parsed, freed;
+    int i;
+
+    result->parse = result->free = 1e300;
+
+    for (i = 0; i < repeat; i++) {
+        bench_reset_peak_rss();
+        atomic_store(&allocations, 0);
+
+        start = bench_now();
+        if (read_config_file(filename, &conftree) < 0)
+            return -GAS_FAILURE;
+        parsed = bench_now();
+
+        if (i == 0) {
+            result->peak_rss = bench_peak_rss();
+            result->parse_allocs = atomic_load(&allocations);
+        }
+        atomic_store(&deallocations, 0);
+
+        free_conf_tree(&conftree);
+        freed = bench_now();
+
+        if (i == 0)
+            result->free_deallocs = atomic_load(&deallocations);
+
+        if (parsed - start < result->parse)
+            result->parse = parsed - start;
+        if (freed - parsed < result->free)
+            result->free = freed - parsed;
+    }
+
+    return GAS_SUCCESS;
+}
+
+static void bench_remove(const char *dir, const struct confgen_t *spec)
+{
+    char path[PATH_MAX];
+    int i;
+
+    for (i = 1; i < spec->files; i++) {
+        snprintf(path, sizeof(path), "%s/conf.d/frag%05d.conf", dir, i);
+        unlink(path);
+    }
+
+    snprintf(path, sizeof(path), "%s/conf.d", dir);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/main.conf", dir);
+    unlink(path);
+    rmdir(dir);
+}
+
+static int bench_case(const struct bench_case_t *bench, int repeat)
+{
+    struct confgen_stats_t stats;
+    struct bench_result_t result;
+    const char *tmpdir = getenv("TMPDIR");
+    char dir[PATH_MAX], *filename;
+    int status;
+
+    snprintf(dir, sizeof(dir), "%s/gastool-bench.XXXXXX",
+             tmpdir != NULL ? tmpdir : "/tmp");
+    if (mkdtemp(dir) == NULL) {
+        perror(program_name);
+        return -GAS_FAILURE;
+    }
+
+    filename = confgen_write(&bench->spec, dir, &stats);
+    if (filename == NULL) {
+        fprintf(stderr, "%s: cannot write configuration in '%s'\n",
+                program_name, dir);
+        bench_remove(dir, &bench->spec);
+        return -GAS_FAILURE;
+    }
+
+    status = bench_run(filename, repeat, &result);
+
+    bench_remove(dir, &bench->spec);
+    free(filename);
+
+    if (status < 0)
+        return -GAS_FAILURE;
+
+    printf("{\"case\":\"%s\",\"version\":\"%s\",\"directives\":%lu,"
+           "\"depth\":%d,\"args\":%d,\"quoting\":%.2f,\"files\":%d,"
+           "\"lines\":%lu,\"bytes\":%zu,\"repeat\":%d,"
+           "\"parse_seconds\":%.6f,\"free_seconds\":%.6f,"
+           "\"lines_per_second\":%.0f,\"directives_per_second\":%.0f,"
+           "\"peak_rss_kib\":%ld,\"parse_allocations\":%lu,"
+           "\"free_deallocations\":%lu}\n",
+           bench->name, PACKAGE_VERSION, stats.directives,
+           bench->spec.depth, bench->spec.args, bench->spec.quoting,
+           bench->spec.files, stats.lines, stats.bytes, repeat,
+           result.parse, result.free, stats.lines / result.parse,
+           stats.directives / result.parse, result.peak_rss,
+           result.parse_allocs, result.free_deallocs);
+    fflush(stdout);
+
+    return GAS_SUCCESS;
+}
+
+static void usage(int status)
+{
+    size_t i;
+
+    if (status != EXIT_SUCCESS) {
+        fprintf(stderr, "Try '%s --help' for more information.\n",
+                program_name);
+    } else {
+        printf("Usage: %s [OPTION]... [CASE]...\n", program_name);
+
+        fputs("\n\
+Benchmark the configuration parser on generated configurations and\n\
+print one JSON object per case. Without CASE, run them all.\n\
+\n\
+  -r, --repeat=N  time N runs of each case and keep the best (default 5)\n\
+      --help      display this help and exit\n", stdout);
+
+        fputs("\nCases:", stdout);
+        for (i = 0; i < BENCH_NCASES; i++)
+            printf(" %s", bench_cases[i].name);
+        fputc('\n', stdout);
+    }
+
+    exit(status);
+}
+
+enum {
+    HELP_OPTION = CHAR_MAX + 1
+};
+
+static struct option const long_options[] = {
+    {"repeat", required_argument, NULL, 'r'},
+    {"help", no_argument, NULL, HELP_OPTION},
+    {NULL, 0, NULL, 0}
+};
+
+int main(int argc, char **argv)
+{
+    int optc, repeat = 5, status = EXIT_SUCCESS, i;
+    size_t j;
+
+    program_name = argv[0];
+
+    while ((optc = getopt_long(argc, argv, "r:", long_options, NULL))
+           != -1) {
+        switch (optc) {
+        case 'r':
+            repeat = atoi(optarg);
+            if (repeat < 1)
+                usage(EXIT_FAILURE);
+            break;
+
+        case HELP_OPTION:
+            usage(EXIT_SUCCESS);
+            break;
+
+        default:
+            usage(EXIT_FAILURE);
+            break;
+        }
+    }
+
+    if (optind == argc) {
+        for (j = 0; j < BENCH_NCASES; j++) {
+            if (bench_case(&bench_cases[j], repeat) < 0)
+                status = EXIT_FAILURE;
+        }
+
+        return status;
+    }
+
+    for (i = optind; i < argc; i++) {
+        for (j = 0; j < BENCH_NCASES; j++) {
+            if (strcmp(argv[i], bench_cases[j].name) == 0)
+                break;
+        }
+
+        if (j == BENCH_NCASES) {
+            fprintf(stderr, "%s: unknown case '%s'\n", program_name,
+                    argv[i]);
+            usage(EXIT_FAILURE);
+        }
+
+        if (bench_case(&bench_cases[j], repeat) < 0)
+            status = EXIT_FAILURE;
+    }
+
+    return status;
+}
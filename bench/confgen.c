@@ -0,0 +1,175 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "gasconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "confgen.h"
+
+/* Plain directives in each block. */
+#define CONFGEN_BLOCK_DIRECTIVES 4
+
+struct confgen_state_t {
+    const struct confgen_t *spec;
+    struct confgen_stats_t *stats;
+    uint32_t random;
+};
+
+/* xorshift32: the same seed gives the same configuration. */
+static double confgen_random(struct confgen_state_t *state)
+{
+    uint32_t x = state->random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    state->random = x;
+
+    return x / 4294967296.0;
+}
+
+static void confgen_directive(FILE *out, struct confgen_state_t *state,
+                              int level)
+{
+    unsigned long n = state->stats->directives;
+    double r;
+    int i;
+
+    fprintf(out, "%*sOption%lu", level * 2, "", n % 16);
+
+    for (i = 0; i < state->spec->args; i++) {
+        r = confgen_random(state);
+
+        if (r < state->spec->quoting / 2)
+            fprintf(out, " \"quoted value %lu\"", n);
+        else if (r < state->spec->quoting)
+            fprintf(out, " 'escaped \\'value\\' \\\\ %lu'", n);
+        else
+            fprintf(out, " value%lu", (n + i) % 1000);
+    }
+
+    fputc('\n', out);
+
+    state->stats->lines++;
+    state->stats->directives++;
+}
+
+/* Write a block nested spec->depth - level levels deep, or plain
+   directives at the innermost level. */
+static void confgen_block(FILE *out, struct confgen_state_t *state, int level)
+{
+    unsigned long n = state->stats->directives;
+    int i;
+
+    if (level < state->spec->depth) {
+        fprintf(out, "%*s<Block%d name%lu>\n", level * 2, "", level, n);
+        state->stats->lines++;
+        state->stats->directives++;
+    }
+
+    for (i = 0; i < CONFGEN_BLOCK_DIRECTIVES; i++)
+        confgen_directive(out, state, level);
+
+    if (level < state->spec->depth) {
+        confgen_block(out, state, level + 1);
+
+        fprintf(out, "%*s</Block%d>\n", level * 2, "", level);
+        state->stats->lines++;
+    }
+}
+
+char *confgen_write(const struct confgen_t *spec, const char *dir,
+                    struct confgen_stats_t *stats)
+{
+    struct confgen_state_t state;
+    FILE **files;
+    char *mainfile, *path;
+    int nfiles = spec->files > 1 ? spec->files : 1, i, result = 0;
+    unsigned long block = 0;
+    struct stat statbuf;
+
+    memset(stats, 0, sizeof(*stats));
+    state.spec = spec;
+    state.stats = stats;
+    state.random = spec->seed ? spec->seed : 1;
+
+    mainfile = malloc(strlen(dir) + 32);
+    path = malloc(strlen(dir) + 32);
+    files = calloc(nfiles, sizeof(*files));
+    if (mainfile == NULL || path == NULL || files == NULL) {
+        free(mainfile);
+        free(path);
+        free(files);
+        return NULL;
+    }
+
+    sprintf(mainfile, "%s/main.conf", dir);
+    files[0] = fopen(mainfile, "w");
+    if (files[0] == NULL)
+        goto write_failed;
+
+    /* The main file includes the others, which come after it. */
+    if (nfiles > 1) {
+        sprintf(path, "%s/conf.d", dir);
+        if (mkdir(path, 0777) < 0 && errno != EEXIST)
+            goto write_failed;
+
+        for (i = 1; i < nfiles; i++) {
+            sprintf(path, "%s/conf.d/frag%05d.conf", dir, i);
+            files[i] = fopen(path, "w");
+            if (files[i] == NULL)
+                goto write_failed;
+        }
+
+        fputs("Include conf.d/*.conf\n", files[0]);
+        stats->lines++;
+    }
+
+    while (stats->directives < spec->directives)
+        confgen_block(files[block++ % nfiles], &state, 0);
+
+write_failed:
+    for (i = 0; i < nfiles; i++) {
+        if (files[i] == NULL || fclose(files[i]) != 0)
+            result = -1;
+    }
+
+    for (i = 0; result == 0 && i < nfiles; i++) {
+        if (i == 0)
+            strcpy(path, mainfile);
+        else
+            sprintf(path, "%s/conf.d/frag%05d.conf", dir, i);
+
+        if (stat(path, &statbuf) == 0)
+            stats->bytes += statbuf.st_size;
+    }
+
+    free(files);
+    free(path);
+
+    if (result < 0) {
+        free(mainfile);
+        return NULL;
+    }
+
+    return mainfile;
+}
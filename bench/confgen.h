@@ -0,0 +1,55 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef _GASTOOL_CONFGEN_H
+#define _GASTOOL_CONFGEN_H
+
+#include <stddef.h>
+
+/* The shape of a synthetic configuration. */
+struct confgen_t {
+    /* Directives to generate, block directives included. */
+    unsigned long directives;
+
+    /* Nesting depth of the blocks, 0 for none. */
+    int depth;
+
+    /* Arguments per directive. */
+    int args;
+
+    /* Fraction of arguments that are quoted, half of them with escaped
+       characters. */
+    double quoting;
+
+    /* Number of files: the main file includes the others. */
+    int files;
+
+    unsigned int seed;
+};
+
+/* What was generated. */
+struct confgen_stats_t {
+    unsigned long lines;
+    unsigned long directives;
+    size_t bytes;
+};
+
+/* Write the configuration in directory dir, which must exist, and
+   return the main file name, allocated with malloc(), or NULL. */
+char *confgen_write(const struct confgen_t *spec, const char *dir,
+                    struct confgen_stats_t *stats);
+
+#endif  /* !_GASTOOL_CONFGEN_H */
@@ -0,0 +1,50 @@
+# Make Gastool benchmarks.
+# Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+# The benchmark is only built by 'make bench'.
+EXTRA_PROGRAMS = bench/gastool-bench
+
+bench_gastool_bench_CPPFLAGS = -I$(top_srcdir)/include
+
+# Count allocations: see the wrappers in bench/bench.c.
+bench_gastool_bench_LDFLAGS =	\
+  -Wl,--wrap=malloc		\
+  -Wl,--wrap=calloc		\
+  -Wl,--wrap=realloc		\
+  -Wl,--wrap=free
+
+bench_gastool_bench_SOURCES =	\
+  bench/bench.c			\
+  bench/confgen.c		\
+  bench/confgen.h		\
+  src/common.c			\
+  src/allocstats.c		\
+  src/metrics.c			\
+  src/trace.c			\
+  src/profile.c			\
+  src/log.c			\
+  src/logfmt.c			\
+  src/parser.c			\
+  src/scan.c
+
+CLEANFILES += $(EXTRA_PROGRAMS)
+
+# Options and cases can be given in BENCH_FLAGS, for example:
+#   make bench BENCH_FLAGS='--repeat=10 large fragments'
+bench: bench/gastool-bench$(EXEEXT)
+	bench/gastool-bench$(EXEEXT) $(BENCH_FLAGS)
+
+.PHONY: bench
@@ -0,0 +1,72 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+
+#ifndef _GASTOOL_ALLOCSTATS_H
+#define _GASTOOL_ALLOCSTATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/* Allocation statistics, kept when Gastool is configured with
+   --enable-alloc-stats: the allocations of gas_malloc() and the other
+   wrappers of common.h, by tag. Each thread counts in its own record;
+   the records are only summed when the statistics are read. A
+   reallocation counts as a free and an allocation. */
+
+/* Size class i holds the allocations of i significant bits: 0 bytes,
+   1, 2 to 3, 4 to 7 and so on, the last one everything larger. */
+#define ALLOC_STATS_CLASSES 32
+
+struct alloc_stats_t {
+    struct {
+        uint64_t allocs;
+        uint64_t frees;
+
+        /* Bytes allocated in all, still allocated, and the most
+           allocated at once. The peak lags behind by up to
+           ALLOC_STATS_FLUSH bytes per thread. */
+        uint64_t bytes;
+        int64_t live;
+        int64_t peak;
+
+        uint64_t classes[ALLOC_STATS_CLASSES];
+    } tags[GAS_ALLOC_TAG_MAX];
+};
+
+#define ALLOC_STATS_FLUSH (64 * 1024)
+
+/* Whether the statistics are compiled in. */
+bool alloc_stats_enabled(void);
+
+/* Sum the counts of all threads into stats. Without statistics, stats
+   is all zeroes. */
+void alloc_stats_get(struct alloc_stats_t *stats);
+
+/* Log the statistics, at LOG_INFO. */
+void alloc_stats_report(void);
+
+/* The name of a tag, "?" for unknown ones. */
+const char *alloc_tag_name(int tag);
+
+/* Count an allocation or a free of size bytes; for common.c. */
+void alloc_stats_add(enum gas_alloc_tag_t tag, size_t size);
+
+void alloc_stats_sub(enum gas_alloc_tag_t tag, size_t size);
+
+#endif  /* !_GASTOOL_ALLOCSTATS_H */
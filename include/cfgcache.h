@@ -0,0 +1,32 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef _GASTOOL_CFGCACHE_H
+#define _GASTOOL_CFGCACHE_H
+
+#include "cfgtree.h"
+
+/* The cache image of a configuration file is stored next to it, with
+   this suffix appended to its name. */
+#define CFGCACHE_SUFFIX ".cache"
+
+int cfgcache_load(const char *filename, conftree_t *conftree);
+
+/* Nothing is written, and only a debug message logged, if the directory
+   of the configuration file is not writable. */
+int cfgcache_save(const char *filename, const conftree_t *conftree);
+
+#endif  /* !_GASTOOL_CFGCACHE_H */
@@ -17,6 +17,42 @@
 #ifndef _GASTOOL_CFGFILE_H
 #define _GASTOOL_CFGFILE_H
 
+#include <stdbool.h>
+
+#include "cfgquery.h"
+#include "cfgschema.h"
+
+void read_config_set_cache(bool enable);
+
 void read_config(const char *configfile);
 
+/* Parse again the configuration files that changed, and load their
+   settings. On errors the current configuration is kept. It may run on
+   any thread, while the thread that read the configuration does not
+   touch it; reload_config_publish() must follow, on that thread. */
+void reload_config_parse(void);
+
+/* Make the configuration reload_config_parse() loaded the current
+   one. */
+void reload_config_publish(void);
+
+/* The index of the current tree (see cfgquery.h), for the thread that
+   reads the configuration. A reload invalidates it. */
+const cfgindex_t *config_index(void);
+
+/* The current settings, for the thread that reads and reloads the
+   configuration. Other threads take them from a snapshot (see
+   cfgsnap.h). */
+const struct gas_config_t *config_get(void);
+
+/* The descriptor to poll for configuration file changes, or -1 if the
+   files are not watched. */
+int config_watch_fd(void);
+
+/* Read the pending file change events and return true if the
+   configuration files changed. */
+bool config_watch_changed(void);
+
+void free_config(void);
+
 #endif
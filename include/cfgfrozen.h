@@ -0,0 +1,135 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef _GASTOOL_CFGFROZEN_H
+#define _GASTOOL_CFGFROZEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "cfgtree.h"
+
+/* A frozen configuration: an immutable copy of a tree for handlers to
+   traverse. All nodes sit in one array, in preorder, so a node's subtree
+   is the range of nodes that follows it, up to its end. Nodes refer to
+   each other by index and to their strings by offset into one string
+   table, so a traversal reads the node array front to back. */
+
+/* No node. */
+#define CFGNODE_NONE UINT32_MAX
+
+struct cfgnode_t {
+    /* Offsets of the directive name and of the file name in the string
+       table. */
+    uint32_t directive;
+    uint32_t filename;
+    uint32_t linenum;
+
+    /* The arguments: argc string offsets, from index args of the argument
+       array. */
+    uint32_t argc;
+    uint32_t args;
+
+    /* The enclosing block, or CFGNODE_NONE at the top level, and the
+       nesting depth, 0 at the top level. */
+    uint32_t parent;
+    uint32_t depth;
+
+    /* The index after the last node of the subtree. */
+    uint32_t end;
+};
+
+typedef struct cfgnode_t cfgnode_t;
+
+struct cfgfrozen_t {
+    cfgnode_t *nodes;
+    uint32_t count;
+
+    uint32_t *args;
+
+    /* NUL terminated strings, each stored once. */
+    char *strings;
+    size_t stringsize;
+
+    /* Values derived from the strings, such as the paths of settings
+       resolved against the directory of their file. */
+    arena_t values;
+};
+
+typedef struct cfgfrozen_t cfgfrozen_t;
+
+/* Return NULL if the tree is too large to freeze. */
+cfgfrozen_t *cfg_freeze(const directive_t *root);
+
+void cfg_frozen_free(cfgfrozen_t *frozen);
+
+static inline const char *cfg_node_name(const cfgfrozen_t *frozen,
+                                        uint32_t id)
+{
+    return frozen->strings + frozen->nodes[id].directive;
+}
+
+static inline const char *cfg_node_filename(const cfgfrozen_t *frozen,
+                                            uint32_t id)
+{
+    return frozen->strings + frozen->nodes[id].filename;
+}
+
+static inline const char *cfg_node_arg(const cfgfrozen_t *frozen,
+                                       uint32_t id, uint32_t i)
+{
+    return frozen->strings + frozen->args[frozen->nodes[id].args + i];
+}
+
+/* Iterate over the children of a node, or over the top level nodes if id
+   is CFGNODE_NONE:
+
+       for (id = cfg_first_child(frozen, parent); id != CFGNODE_NONE;
+            id = cfg_next_sibling(frozen, id))  */
+
+static inline uint32_t cfg_first_child(const cfgfrozen_t *frozen,
+                                       uint32_t id)
+{
+    if (id == CFGNODE_NONE)
+        return frozen->count > 0 ? 0 : CFGNODE_NONE;
+
+    return frozen->nodes[id].end > id + 1 ? id + 1 : CFGNODE_NONE;
+}
+
+static inline uint32_t cfg_next_sibling(const cfgfrozen_t *frozen,
+                                        uint32_t id)
+{
+    uint32_t parent = frozen->nodes[id].parent, end;
+
+    end = parent == CFGNODE_NONE ? frozen->count : frozen->nodes[parent].end;
+
+    return frozen->nodes[id].end < end ? frozen->nodes[id].end : CFGNODE_NONE;
+}
+
+/* Return value of a visitor to skip the children of the node. */
+#define CFG_VISIT_SKIP 1
+
+typedef int (*cfg_visit_t)(const cfgfrozen_t *frozen, uint32_t id,
+                           void *arg);
+
+/* Call visit on the nodes of the subtree of id, or of the whole
+   configuration if id is CFGNODE_NONE, in preorder. The walk stops when
+   visit returns a negative value, which is returned. */
+int cfg_visit(const cfgfrozen_t *frozen, uint32_t id, cfg_visit_t visit,
+              void *arg);
+
+#endif  /* !_GASTOOL_CFGFROZEN_H */
@@ -0,0 +1,53 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef _GASTOOL_CFGQUERY_H
+#define _GASTOOL_CFGQUERY_H
+
+#include <stddef.h>
+
+#include "cfgtree.h"
+
+/* Directive index over a configuration tree. Directives are found by
+   path: the names of the enclosing blocks, without the '<', and the
+   directive name, separated by '/'. For example "Server/Listen" names
+   every Listen directive directly inside a Server block, and "Server"
+   every top level Server block. Lookups cost one hash probe; the nodes
+   found are returned in file order.
+
+   The index refers to the tree nodes, so it must be freed before the
+   tree. */
+
+typedef struct cfgindex_t cfgindex_t;
+
+cfgindex_t *cfg_index_build(const directive_t *root);
+
+void cfg_index_free(cfgindex_t *index);
+
+/* Return the first directive at path, or NULL. */
+directive_t *cfg_find(const cfgindex_t *index, const char *path);
+
+/* Store in *nodes all directives at path and return how many there
+   are. */
+size_t cfg_find_all(const cfgindex_t *index, const char *path,
+                    directive_t *const **nodes);
+
+/* Store in *nodes all directives named name directly inside block, or at
+   the top level if block is NULL, and return how many there are. */
+size_t cfg_find_children(const cfgindex_t *index, const directive_t *block,
+                         const char *name, directive_t *const **nodes);
+
+#endif  /* !_GASTOOL_CFGQUERY_H */
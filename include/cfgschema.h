@@ -0,0 +1,145 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+
+#ifndef _GASTOOL_CFGSCHEMA_H
+#define _GASTOOL_CFGSCHEMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cfgfrozen.h"
+#include "log.h"
+
+/* The daemon settings. The directives of the configuration are checked
+   against the schema in cfgschema.tab and their arguments converted,
+   once per load, into these fields; code that needs a setting reads the
+   field instead of looking the directive up and parsing its arguments.
+   Settings whose directive is not given have the defaults in
+   cfgschema.c. */
+struct gas_config_t {
+    /* <Reload> */
+    struct {
+        /* Milliseconds without further changes to wait for before
+           reloading changed configuration files. */
+        long delay;
+
+        /* Whether the configuration files are watched for changes. */
+        bool watch;
+    } reload;
+
+    /* <Workers>, read at startup only. */
+    struct {
+        /* The number of worker threads, 0 for one per processor. */
+        int threads;
+
+        /* The work each worker queues before running more at once. */
+        int queue_size;
+    } workers;
+
+    /* <Control>, read at startup only. */
+    struct {
+        /* The path of the control socket, NULL for none. */
+        const char *socket;
+    } control;
+
+    /* <Log>, read at startup only. */
+    struct {
+        /* Whether messages are written by a background thread. */
+        bool async;
+
+        /* The size of its buffer, and whether threads wait for room in
+           it instead of dropping messages when it is full. */
+        size_t buffer_size;
+        bool block_when_full;
+
+        /* The file messages are written to in binary, or NULL to write
+           them as text to the sinks below. */
+        const char *binary_file;
+
+        /* The sinks, each with the most verbose level it takes: stderr,
+           a file, NULL for none, reopened on SIGHUP, and syslog. */
+        bool to_stderr;
+        int stderr_level;
+        const char *file;
+        int file_level;
+        bool to_syslog;
+        int syslog_level;
+
+        /* The level of every subsystem, and of each one, -1 if not
+           given. Unlike the others, these change on reloads. */
+        int level;
+        int levels[LOG_SUBSYSTEM_MAX];
+
+        /* The limits of every level, and of each one, -1 if not given
+           (see log_set_rate_limit() and log_set_repeat_window()). They
+           change on reloads too. */
+        int rate;
+        int burst;
+        int rates[LOG_DEBUG + 1];
+        int bursts[LOG_DEBUG + 1];
+        long repeat_window;
+        long repeat_windows[LOG_DEBUG + 1];
+    } log;
+};
+
+/* Argument types. The field of an argument must have the C type given
+   by the CFGTYPE_C_ macro of its type; cfgschema-table.c checks it. */
+enum cfgtype_t {
+    CFGTYPE_INT,
+    CFGTYPE_SIZE,
+    CFGTYPE_DURATION,
+    CFGTYPE_BOOL,
+    CFGTYPE_PATH,
+    CFGTYPE_LEVEL
+};
+
+#define CFGTYPE_C_INT           int
+#define CFGTYPE_C_SIZE          size_t
+#define CFGTYPE_C_DURATION      long            /* Milliseconds. */
+#define CFGTYPE_C_BOOL          bool
+#define CFGTYPE_C_PATH          const char *    /* In the frozen copy. */
+#define CFGTYPE_C_LEVEL         int
+
+struct cfgschema_arg_t {
+    enum cfgtype_t type;
+
+    /* Where the value is stored in struct gas_config_t. */
+    size_t offset;
+};
+
+struct cfgschema_t {
+    /* The directive name as in the tree: blocks start with '<'. */
+    const char *name;
+
+    /* The block the directive may appear in, NULL for the top level. */
+    const char *parent;
+
+    int argc;
+    const struct cfgschema_arg_t *args;
+};
+
+/* Return the schema of a directive, or NULL if there is no such
+   directive. Defined in the generated cfgschema-table.c. */
+const struct cfgschema_t *cfg_schema_find(const char *name);
+
+/* Check every directive of a frozen configuration against the schema
+   and fill config with the values of their arguments and the defaults.
+   All errors are logged; config is only changed on success. Its paths
+   are owned by frozen, and valid as long as it is. */
+int cfg_schema_load(cfgfrozen_t *frozen, struct gas_config_t *config);
+
+#endif  /* !_GASTOOL_CFGSCHEMA_H */
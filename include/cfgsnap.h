@@ -0,0 +1,81 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+
+#ifndef _GASTOOL_CFGSNAP_H
+#define _GASTOOL_CFGSNAP_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cfgfrozen.h"
+#include "cfgschema.h"
+
+/* Configuration snapshots. A snapshot is an immutable copy of the
+   configuration, the frozen directives and the settings loaded from
+   them, that threads read while reloads replace it. The current one is
+   published through an atomic pointer; readers take it inside a read
+   section:
+
+       const struct cfgsnap_t *snap = cfgsnap_read_lock();
+       ... use snap->config, snap->frozen ...
+       cfgsnap_read_unlock();
+
+   Entering and leaving a read section takes no lock and writes only to
+   a cache line of the calling thread. A replaced snapshot is freed once
+   every thread that was in a read section when it was replaced has left
+   it, and nobody holds a reference to it. Publishing never waits for
+   readers: snapshots still in use are freed by a later
+   cfgsnap_reclaim(). */
+
+struct cfgsnap_t {
+    struct gas_config_t config;
+    cfgfrozen_t *frozen;
+
+    /* References taken with cfgsnap_ref(). */
+    atomic_uint refs;
+
+    /* The epoch it was replaced in, and the next replaced snapshot. */
+    uint64_t retired;
+    struct cfgsnap_t *next;
+};
+
+/* Create a snapshot owning frozen. */
+struct cfgsnap_t *cfgsnap_create(cfgfrozen_t *frozen,
+                                 const struct gas_config_t *config);
+
+/* Make snap the current snapshot and retire the previous one. Only one
+   thread may publish. */
+void cfgsnap_publish(struct cfgsnap_t *snap);
+
+/* Free the retired snapshots nobody can use any more. Return true if
+   some are still in use. */
+bool cfgsnap_reclaim(void);
+
+/* Read sections nest. The snapshot returned is valid until the
+   outermost section is left; NULL before the first publication. */
+const struct cfgsnap_t *cfgsnap_read_lock(void);
+
+void cfgsnap_read_unlock(void);
+
+/* Keep a snapshot beyond the read section it was taken in, e.g. across
+   a blocking call. cfgsnap_ref() must be called inside the section. */
+void cfgsnap_ref(const struct cfgsnap_t *snap);
+
+void cfgsnap_unref(const struct cfgsnap_t *snap);
+
+#endif  /* !_GASTOOL_CFGSNAP_H */
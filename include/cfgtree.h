@@ -17,16 +17,25 @@
 #ifndef _GASTOOL_CFGTREE_H
 #define _GASTOOL_CFGTREE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "common.h"
+
 struct directive_t {
-    /* The current directive name. */
-    char *directive;
+    /* The current directive name (interned). */
+    const char *directive;
 
-    /* The arguments of this directive. */
+    /* The arguments of this directive. They point into the mapped file,
+       or into the cache image, and are not interned: values change from
+       one reload to the next, and the intern pool is never freed. */
     int argc;
-    char **argv;
+    const char **argv;
 
-    /* The filename this directive was found. */
-    char *filename;
+    /* The filename this directive was found (interned). */
+    const char *filename;
     /* The line number this directive was found. */
     int linenum;
 
@@ -42,4 +51,58 @@ struct directive_t {
 
 typedef struct directive_t directive_t;
 
+/* A configuration file the tree was built from. When it was parsed, the
+   file is mapped private and writable: lines are tokenized in place, so
+   the directive strings point into the mapping and it must live as long
+   as the tree. */
+struct conf_file_t {
+    /* The file name (interned). */
+    const char *filename;
+
+    /* Whether this is a directory an Include pattern was expanded in.
+       Only its modification time is tracked: it changes when files are
+       added to or removed from the directory. */
+    bool directory;
+
+    /* The file identity when it was read: modification time, size and
+       a hash of the original contents. */
+    struct timespec mtime;
+    size_t size;
+    uint64_t hash;
+
+    /* The mapped file contents, always followed by a '\0' byte, and the
+       length of the whole mapping. NULL if the tree was not parsed from
+       this file, e.g. when it was loaded from the configuration cache. */
+    char *data;
+    size_t length;
+
+    /* The next file of the same tree. */
+    struct conf_file_t *next;
+};
+
+/* A parsed configuration tree and the storage backing it. */
+struct conftree_t {
+    /* The first top level directive. */
+    directive_t *root;
+
+    /* The files the tree was built from, in read order: the main
+       configuration file first. */
+    struct conf_file_t *files;
+
+    /* The parsed files and their directives, kept so that a reload only
+       parses the files that changed (see parser.c). NULL if the tree was
+       loaded from the configuration cache. */
+    struct conf_unit_t *units;
+
+    /* The mapped configuration cache image the tree strings point into,
+       if it was loaded from the cache. */
+    void *image;
+    size_t imagesize;
+
+    /* The arena all nodes and argument vectors are allocated from. */
+    arena_t arena;
+};
+
+typedef struct conftree_t conftree_t;
+
 #endif
@@ -0,0 +1,46 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef _GASTOOL_CFGWATCH_H
+#define _GASTOOL_CFGWATCH_H
+
+#include <stdbool.h>
+
+#include "cfgtree.h"
+
+/* Watch the files of a configuration tree for changes with inotify. The
+   directories the files are in are watched, rather than the files, so
+   that files replaced by a rename, as editors do, are noticed too. */
+
+typedef struct cfgwatch_t cfgwatch_t;
+
+/* Return NULL if inotify is not available. */
+cfgwatch_t *cfgwatch_create(void);
+
+void cfgwatch_free(cfgwatch_t *watch);
+
+/* The descriptor to poll for changes. */
+int cfgwatch_fd(const cfgwatch_t *watch);
+
+/* Watch the files of conftree, and only them. */
+int cfgwatch_update(cfgwatch_t *watch, const conftree_t *conftree);
+
+/* Read the pending events; return true if a watched file changed, or a
+   file was added to or removed from a directory an Include pattern is
+   expanded in. */
+bool cfgwatch_changed(cfgwatch_t *watch);
+
+#endif  /* !_GASTOOL_CFGWATCH_H */
@@ -17,17 +17,204 @@
 #ifndef _GASTOOL_COMMON_H
 #define _GASTOOL_COMMON_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
 /* Function return values that can be used to indicate success or failure.
    Note that GAS_FAILURE is not negative. */
 
 #define GAS_SUCCESS 0           /* Successful return status. */
 #define GAS_FAILURE 1           /* Failing return status. */
 
-void *gas_malloc(size_t n);
+/* Allocation tags: the subsystem memory is counted for when allocation
+   statistics are compiled in (see allocstats.h). A source file tags its
+   allocations with GAS_ALLOC_TAG, defined before this header is
+   included; GAS_ALLOC_CORE if it is not. */
+enum gas_alloc_tag_t {
+    GAS_ALLOC_CORE,
+    GAS_ALLOC_CONFIG,
+    GAS_ALLOC_PARSER,
+    GAS_ALLOC_LOG,
+
+    GAS_ALLOC_TAG_MAX
+};
+
+#ifndef GAS_ALLOC_TAG
+#define GAS_ALLOC_TAG GAS_ALLOC_CORE
+#endif
+
+#define gas_malloc(n) gas_malloc_tag((n), GAS_ALLOC_TAG)
+#define gas_realloc(p, n) gas_realloc_tag((p), (n), GAS_ALLOC_TAG)
+#define gas_aligned_alloc(alignment, n)                         \
+    gas_aligned_alloc_tag((alignment), (n), GAS_ALLOC_TAG)
+#define gas_strdup(string) gas_strdup_tag((string), GAS_ALLOC_TAG)
+
+void *gas_malloc_tag(size_t n, enum gas_alloc_tag_t tag);
+
+/* A block keeps the tag it was allocated with. */
+void *gas_realloc_tag(void *p, size_t n, enum gas_alloc_tag_t tag);
+
+/* alignment must be a power of two. The block cannot be reallocated. */
+void *gas_aligned_alloc_tag(size_t alignment, size_t n,
+                            enum gas_alloc_tag_t tag);
+
+char *gas_strdup_tag(const char *string, enum gas_alloc_tag_t tag);
+
+/* Free a block of the functions above, which must not be given to
+   free(): with allocation statistics, blocks start with a header. */
+void gas_free(void *p);
+
+/* The blocks the calling thread allocated or reallocated with the
+   functions above, whether statistics are compiled in or not. */
+extern _Thread_local uint64_t gas_alloc_count;
+
+/* Arena (bump) allocator. Memory is carved out of a few large blocks and
+   is only released all at once, by arena_free(). */
+
+struct arena_block_t;
+
+struct arena_t {
+    /* The most recent block; older blocks are chained behind it. */
+    struct arena_block_t *blocks;
+
+    /* Free space left in the most recent block. */
+    char *ptr;
+    char *end;
+
+    /* The size of the next block to allocate. */
+    size_t blocksize;
+
+    enum gas_alloc_tag_t tag;
+};
+
+typedef struct arena_t arena_t;
+
+/* The blocks are tagged with the GAS_ALLOC_TAG of the caller. */
+#define arena_init(arena) arena_init_tag((arena), GAS_ALLOC_TAG)
+
+void arena_init_tag(arena_t *arena, enum gas_alloc_tag_t tag);
+
+void *arena_alloc(arena_t *arena, size_t n);
+
+char *arena_strdup(arena_t *arena, const char *string);
+
+char *arena_strndup(arena_t *arena, const char *string, size_t len);
+
+void arena_free(arena_t *arena);
+
+/* Object pools. A pool hands out objects of one size, carved out of
+   slabs that are only released with the pool, so objects that come and
+   go, across reloads too, reuse the same memory. Each thread keeps a
+   few free objects of every pool it uses: most allocations and frees
+   take no lock, and the others move objects in batches. These functions
+   are thread-safe. */
+
+typedef struct gas_pool_t gas_pool_t;
+
+/* At most GAS_POOL_MAX pools exist at once. */
+#define GAS_POOL_MAX 64
+
+/* A pool of objects of a type. The slabs are tagged with the
+   GAS_ALLOC_TAG of the caller. */
+#define gas_pool_create(type)                                           \
+    gas_pool_create_tag(sizeof(type), _Alignof(type), GAS_ALLOC_TAG)
+
+gas_pool_t *gas_pool_create_tag(size_t size, size_t alignment,
+                                enum gas_alloc_tag_t tag);
+
+/* Release the pool and all of its objects. No other thread may use it
+   any more. */
+void gas_pool_destroy(gas_pool_t *pool);
+
+void *gas_pool_alloc(gas_pool_t *pool);
+
+void gas_pool_free(gas_pool_t *pool, void *p);
+
+/* Free n objects, taking the lock of the pool once at most. */
+void gas_pool_free_bulk(gas_pool_t *pool, void **objects, size_t n);
+
+/* Data that different threads write is kept on separate cache lines. */
+#define CACHE_LINE_SIZE 64
+
+/* Per-thread records. Each thread that uses a registry gets a record of
+   its own, on cache lines of its own, until it exits; a later thread
+   then takes the record over, with what it holds. Records are never
+   freed: holding the lock, the owner of the registry reads them all. A
+   record starts with struct gas_thread_record_t. */
+struct gas_thread_registry_t;
+
+struct gas_thread_record_t {
+    struct gas_thread_registry_t *registry;
+
+    /* Whether a running thread owns the record. */
+    bool owned;
+
+    struct gas_thread_record_t *next;
+};
+
+struct gas_thread_registry_t {
+    /* The size of the records. */
+    size_t size;
+
+    /* Called with the lock held: on a new record, zeroed before, and on
+       the record of a thread that exits, from the thread. Either may be
+       NULL. The release function clears the pointer the thread keeps to
+       the record, in case a later destructor of the thread comes back
+       for one. */
+    void (*init)(struct gas_thread_record_t *record);
+    void (*release)(struct gas_thread_record_t *record);
+
+    struct gas_thread_record_t *records;
+    pthread_mutex_t lock;
+
+    /* Releases the record of a thread when it exits. */
+    pthread_key_t key;
+    bool key_created;
+};
+
+#define GAS_THREAD_REGISTRY_INIT(type, init, release)                   \
+    { sizeof(type), (init), (release), NULL, PTHREAD_MUTEX_INITIALIZER, \
+      0, false }
+
+/* Take a record for the calling thread, which keeps it in a
+   _Thread_local pointer. NULL if memory is exhausted: the records are
+   not allocated with gas_malloc(), so that the allocation statistics
+   can keep theirs in a registry. */
+void *gas_thread_record_take(struct gas_thread_registry_t *registry);
+
+/* Add n to a counter of a record: only the thread of the record writes
+   it, so a relaxed load and store do, without a locked instruction.
+   Other threads read it with a relaxed load. */
+#define GAS_THREAD_ADD(counter, n)                                      \
+    atomic_store_explicit(&(counter),                                   \
+                          atomic_load_explicit(&(counter),              \
+                                               memory_order_relaxed)    \
+                          + (n), memory_order_relaxed)
+
+/* pthread_create() for the threads of the daemon's own machinery. The
+   thread starts with every signal blocked: process signals must go to
+   the threads that handle them. Returns 0 or an error number. */
+int gas_thread_create(pthread_t *thread, void *(*start)(void *), void *arg);
+
+/* Fast 64-bit hash of a memory block, used to identify file contents. It
+   is not a cryptographic hash. */
+uint64_t gas_hash64(const void *data, size_t len);
+
+/* String interning. Equal strings are stored once and get the same
+   pointer, so interned strings can be compared with ==. The pool lives for
+   the whole process and its strings must never be modified: only strings
+   of a bounded set, such as directive and file names, may be interned.
+   These functions are thread-safe. */
+
+const char *gas_intern(const char *string);
 
-void *gas_realloc(void *p, size_t n);
+const char *gas_intern_n(const char *string, size_t len);
 
-char *gas_strdup(const char *string);
+/* Return the interned copy of a string, or NULL if it was never
+   interned. The pool is left unchanged. */
+const char *gas_intern_find(const char *string, size_t len);
 
 #define ERRBUF_LEN_MAX 256
 
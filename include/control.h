@@ -0,0 +1,38 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef _GASTOOL_CONTROL_H
+#define _GASTOOL_CONTROL_H
+
+#include "evloop.h"
+
+/* The control socket: a UNIX stream socket on which clients send one
+   request line and get the answer until the connection is closed.
+   Requests:
+
+       stats         the metrics (see metrics.h) and the allocation
+                     statistics, one "name value" line each
+       stats json    the same as one JSON object
+
+   The socket is served by an event loop, without blocking it. */
+
+/* Listen at path, replacing a socket left there. */
+int control_start(evloop_t *loop, const char *path);
+
+/* Close the socket and the connections, and remove the socket file. */
+void control_stop(void);
+
+#endif  /* !_GASTOOL_CONTROL_H */
@@ -0,0 +1,104 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef _GASTOOL_EVLOOP_H
+#define _GASTOOL_EVLOOP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+/* An event loop on epoll. A loop belongs to the thread that runs it:
+   watches are added, changed and removed from its callbacks, or before
+   it runs; only evloop_stop() may be called from other threads. The
+   watches are owned by the caller, so nothing is allocated once they
+   are added, and every descriptor is non-blocking. */
+
+typedef struct evloop_t evloop_t;
+
+struct evloop_io_t;
+struct evloop_timer_t;
+
+/* events are those of epoll, EPOLLIN, EPOLLOUT, EPOLLERR... */
+typedef void evloop_io_fn(evloop_t *loop, struct evloop_io_t *io,
+                          uint32_t events);
+
+typedef void evloop_timer_fn(evloop_t *loop, struct evloop_timer_t *timer);
+
+typedef void evloop_signal_fn(evloop_t *loop,
+                              const struct signalfd_siginfo *siginfo,
+                              void *data);
+
+/* A descriptor watched by a loop. */
+struct evloop_io_t {
+    int fd;
+    evloop_io_fn *callback;
+    void *data;
+};
+
+/* A timer, on a timerfd of its own. */
+struct evloop_timer_t {
+    struct evloop_io_t io;
+    evloop_timer_fn *callback;
+    void *data;
+};
+
+/* Return NULL on failure. */
+evloop_t *evloop_create(void);
+
+/* Free a loop that is not running. Its watches must have been removed;
+   the signals it took are unblocked. */
+void evloop_free(evloop_t *loop);
+
+/* Call the callbacks of the watches as their events happen until
+   evloop_stop(). */
+int evloop_run(evloop_t *loop);
+
+/* Make evloop_run() return once the callback running, if any, is
+   done. */
+void evloop_stop(evloop_t *loop);
+
+/* Watch io->fd for events, then change them, or stop watching it. An
+   event of io that is pending is not delivered after io is removed, so
+   io may be reused at once, even from the callback of another watch. */
+int evloop_io_add(evloop_t *loop, struct evloop_io_t *io, int fd,
+                  uint32_t events, evloop_io_fn *callback, void *data);
+
+int evloop_io_modify(evloop_t *loop, struct evloop_io_t *io,
+                     uint32_t events);
+
+int evloop_io_remove(evloop_t *loop, struct evloop_io_t *io);
+
+/* Create a disarmed timer, and free it. */
+int evloop_timer_add(evloop_t *loop, struct evloop_timer_t *timer,
+                     evloop_timer_fn *callback, void *data);
+
+void evloop_timer_remove(evloop_t *loop, struct evloop_timer_t *timer);
+
+/* Expire in delay milliseconds, then every interval milliseconds if it
+   is not 0. A delay of 0 disarms the timer. Missed expirations call
+   the callback once. */
+int evloop_timer_set(struct evloop_timer_t *timer, long delay,
+                     long interval);
+
+/* Handle signo with callback instead of its disposition. The signal is
+   blocked in the calling thread, which should be the main thread,
+   before other threads are started so that they inherit the mask. */
+int evloop_signal(evloop_t *loop, int signo, evloop_signal_fn *callback,
+                  void *data);
+
+#endif  /* !_GASTOOL_EVLOOP_H */
@@ -21,7 +21,22 @@ pkginclude_HEADERS =	\
   include/gasconfig.h	\
   include/configmake.h	\
   include/common.h	\
+  include/allocstats.h	\
   include/log.h		\
+  include/metrics.h	\
+  include/trace.h	\
+  include/profile.h	\
+  include/logfmt.h	\
+  include/evloop.h	\
+  include/workpool.h	\
+  include/control.h	\
   include/cfgtree.h	\
   include/parser.h	\
+  include/scan.h		\
+  include/cfgcache.h	\
+  include/cfgquery.h	\
+  include/cfgfrozen.h	\
+  include/cfgwatch.h	\
+  include/cfgschema.h	\
+  include/cfgsnap.h	\
   include/cfgfile.h
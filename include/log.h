@@ -17,11 +17,178 @@
 #ifndef _GASTOOL_LOG_H
 #define _GASTOOL_LOG_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <syslog.h>
 
-void log_print(int level, int errnum, const char *format, ...)
-    __attribute__((format(printf, 3, 4)));
+#include "logfmt.h"
 
+/* Subsystems, each with its own log level. A source file logs as the
+   subsystem LOG_SUBSYSTEM names, defined before this header is
+   included; LOG_CORE if it is not. */
+enum log_subsystem_t {
+    LOG_CORE,
+    LOG_CONFIG,
+    LOG_PARSER,
+
+    LOG_SUBSYSTEM_MAX
+};
+
+#ifndef LOG_SUBSYSTEM
+#define LOG_SUBSYSTEM LOG_CORE
+#endif
+
+/* Messages above this level are compiled out. */
+#ifndef LOG_LEVEL_COMPILED
+#define LOG_LEVEL_COMPILED LOG_DEBUG
+#endif
+
+/* The level of each subsystem. Messages above it are discarded before
+   their arguments are even evaluated, so a disabled call costs one load
+   and one branch. */
+extern atomic_int log_levels[LOG_SUBSYSTEM_MAX];
+
+static inline bool log_enabled(enum log_subsystem_t subsystem, int level)
+{
+    return level <= LOG_LEVEL_COMPILED
+           && level <= atomic_load_explicit(&log_levels[subsystem],
+                                            memory_order_relaxed);
+}
+
+/* A log_print() call. In binary mode its format string is given an id
+   the first time it is logged, and messages only refer to the id. */
+struct log_site_t {
+    const char *format;
+    atomic_uint id;
+
+    /* The kinds of the arguments (see logfmt.h), once it has an id; -1
+       arguments if the format string must be logged as text. */
+    int nargs;
+    unsigned char kinds[LOGFMT_ARGS_MAX];
+
+    /* Rate limiting: when the next message is due, in nanoseconds of
+       CLOCK_MONOTONIC_COARSE, and the messages dropped since the last
+       one written. */
+    atomic_uint_least64_t due;
+    atomic_uint suppressed;
+
+    /* Repeats: the hash of the last message written and when it was
+       written, and the same messages dropped since. */
+    atomic_uint_least64_t last_hash;
+    atomic_uint_least64_t last_time;
+    atomic_uint repeats;
+
+    /* Once a message is dropped, the site is listed for
+       log_report_suppressed() with the subsystem and level it logs
+       at. */
+    atomic_bool listed;
+    unsigned char subsystem;
+    unsigned char level;
+    struct log_site_t *next;
+};
+
+#define LOG_FORMAT_(format, ...) format
+
+#define log_print(level, errnum, ...)                                   \
+    do {                                                                \
+        static struct log_site_t log_site_ = {                          \
+            .format = LOG_FORMAT_(__VA_ARGS__, "")                      \
+        };                                                              \
+                                                                        \
+        if (log_enabled(LOG_SUBSYSTEM, (level)))                        \
+            log_message(&log_site_, LOG_SUBSYSTEM, (level), (errnum),   \
+                        __VA_ARGS__);                                   \
+    } while (0)
+
+/* Write a message unconditionally; use log_print(). */
+void log_message(struct log_site_t *site, enum log_subsystem_t subsystem,
+                 int level, int errnum, const char *format, ...)
+    __attribute__((format(printf, 5, 6)));
+
+/* Set the level of every subsystem. */
 int log_set_default_level(int level);
 
+int log_set_level(enum log_subsystem_t subsystem, int level);
+
+/* Return the level or the subsystem with this name, or -1. Levels are
+   named as in syslog.h without the LOG_ prefix, in any case, or given
+   as numbers. */
+int log_level_find(const char *name);
+
+int log_subsystem_find(const char *name);
+
+/* The names of a level and of a subsystem, "?" for unknown ones. */
+const char *log_level_name(int level);
+
+const char *log_subsystem_name(int subsystem);
+
+/* Set levels from a comma separated list of LEVEL, for every subsystem,
+   and SUBSYSTEM=LEVEL items, applied in order. Nothing is set if the
+   list is not valid. */
+int log_set_levels(const char *spec);
+
+/* Limit the messages of each log_print() call at level to burst at
+   once, then to rate per second; a rate of 0 removes the limit. The
+   number of messages dropped is logged with the next one written. */
+int log_set_rate_limit(int level, int rate, int burst);
+
+/* Drop the messages of each log_print() call at level that are the
+   same as the last one it wrote less than window milliseconds before;
+   0 writes them all. The number of repeats is logged with the next
+   message written. */
+int log_set_repeat_window(int level, long window);
+
+/* Log the number of messages dropped by the two limits above and not
+   reported yet, for calls that have not logged since. */
+void log_report_suppressed(void);
+
+/* Sinks, the outputs of text messages. Until one is added, messages go
+   to stderr; once one is, they go to the sinks added. A sink only takes
+   the messages at or below its level; the levels of the subsystems
+   still decide which messages are written at all. Sinks are added at
+   startup, before other threads log and before log_start_async(). */
+#define LOG_SINKS_MAX 8
+
+int log_add_stderr(int level);
+
+/* Append to the file path, created if needed. */
+int log_add_file(const char *path, int level);
+
+/* Send to syslog, with the facility LOG_DAEMON. ident must stay valid
+   until exit. */
+int log_add_syslog(const char *ident, int level);
+
+/* Reopen the files of the file sinks, after they have been rotated.
+   Messages logged before the call go to the previous files. In
+   asynchronous mode the writer thread reopens them, so the caller does
+   not wait for the disk. */
+void log_reopen(void);
+
+/* What a thread logging in asynchronous mode does when the buffer is
+   full: drop the message, the number of dropped messages is logged
+   later, or wait for the writer thread to make room. */
+enum log_overflow_t {
+    LOG_OVERFLOW_DROP,
+    LOG_OVERFLOW_BLOCK
+};
+
+/* Switch to asynchronous mode: messages are formatted into a buffer of
+   about bufsize bytes and written by a background thread, which
+   collects them for each sink and writes many with one write().
+   Pending messages are written at exit, by log_stop_async(), and when
+   the process gets a fatal signal. */
+int log_start_async(size_t bufsize, enum log_overflow_t overflow);
+
+/* Switch to binary mode: from now on, messages are written to the file
+   path in the format of logfmt.h, to be read with gastool-logdecode,
+   instead of the sinks. It must be called before any sink is added.
+   The file is not reopened by log_reopen(). */
+int log_start_binary(const char *path);
+
+/* Write the pending messages and go back to writing each message from
+   the thread that logs it. */
+void log_stop_async(void);
+
 #endif
@@ -0,0 +1,111 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+
+#ifndef _GASTOOL_LOGFMT_H
+#define _GASTOOL_LOGFMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The binary log format. A stream is a sequence of records, in the byte
+   order of the machine that wrote it, each starting with its size. A
+   message record holds the id of its format string, a timestamp and the
+   raw values of its arguments; nothing is formatted when it is logged.
+   The format string of an id is given once, by a format record written
+   before any message using it. Every process writing to a stream first
+   writes LOGFMT_MAGIC, which starts a new set of ids: a file can be
+   appended to across restarts. */
+
+#define LOGFMT_MAGIC "GASLOG1\n"
+#define LOGFMT_MAGIC_LEN 8
+
+/* The id of format records. Format string ids start at 1. */
+#define LOGFMT_FORMAT_ID 0
+
+/* Most arguments a format string can have in a message record. Other
+   format strings are logged as text (see log.c). */
+#define LOGFMT_ARGS_MAX 16
+
+struct logfmt_record_t {
+    /* The size of the whole record, this header included. */
+    uint32_t size;
+    uint32_t id;
+};
+
+/* Followed by the NUL terminated format string. */
+struct logfmt_format_t {
+    struct logfmt_record_t header;
+    uint32_t format_id;
+};
+
+/* Followed by the arguments. */
+struct logfmt_message_t {
+    struct logfmt_record_t header;
+
+    /* CLOCK_REALTIME, in nanoseconds. */
+    uint64_t time;
+
+    uint8_t level;
+    uint8_t subsystem;
+    uint16_t reserved;
+
+    /* The errno value appended to the message, or 0. */
+    int32_t errnum;
+};
+
+/* How an argument is passed and stored: an int in 4 bytes, the 8 byte
+   integer types and double in 8 bytes, a string as a 4 byte length and
+   its bytes, without NUL. */
+enum logfmt_arg_t {
+    LOGFMT_ARG_INT,
+    LOGFMT_ARG_LONG,
+    LOGFMT_ARG_LLONG,
+    LOGFMT_ARG_SIZE,
+    LOGFMT_ARG_INTMAX,
+    LOGFMT_ARG_PTRDIFF,
+    LOGFMT_ARG_DOUBLE,
+    LOGFMT_ARG_POINTER,
+    LOGFMT_ARG_STRING
+};
+
+/* A conversion of a format string. */
+struct logfmt_conv_t {
+    /* The conversion specification, from its '%', and its length. */
+    const char *spec;
+    size_t len;
+
+    /* The arguments it takes: one for each '*' of its width and
+       precision, then its value. */
+    int nargs;
+    enum logfmt_arg_t args[3];
+};
+
+/* Call conv for each conversion of format, in order, and text for the
+   text between them, with '%%' as "%". Return the number of arguments
+   of the format, or -1 if it uses a conversion that cannot be stored
+   (%n, %ls, long double, ...) or stops with conv or text returning a
+   negative value. */
+int logfmt_parse(const char *format,
+                 int (*conv)(const struct logfmt_conv_t *conv, void *arg),
+                 int (*text)(const char *s, size_t len, void *arg),
+                 void *arg);
+
+/* Store the argument kinds of format in kinds, LOGFMT_ARGS_MAX at most.
+   Return their number, or -1 if format cannot be logged in binary. */
+int logfmt_arg_kinds(const char *format, unsigned char *kinds);
+
+#endif  /* !_GASTOOL_LOGFMT_H */
@@ -0,0 +1,103 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef _GASTOOL_METRICS_H
+#define _GASTOOL_METRICS_H
+
+#include <stdint.h>
+#include <syslog.h>
+
+/* Runtime metrics: counters, gauges and latency histograms. Each thread
+   counts in its own record, on cache lines of its own; the records are
+   only merged when the metrics are read. */
+
+enum metric_counter_t {
+    METRIC_CONFIG_LOADS,
+    METRIC_CONFIG_ERRORS,
+
+    /* One per level: messages written, and dropped by the limits of
+       log_set_rate_limit() and log_set_repeat_window() or because the
+       buffer was full. */
+    METRIC_LOG_WRITTEN,
+    METRIC_LOG_DROPPED = METRIC_LOG_WRITTEN + LOG_DEBUG + 1,
+
+    METRIC_COUNTER_MAX = METRIC_LOG_DROPPED + LOG_DEBUG + 1
+};
+
+/* Gauges are set rather than counted, from any thread. */
+enum metric_gauge_t {
+    /* The directives of the configuration in use. */
+    METRIC_CONFIG_DIRECTIVES,
+
+    METRIC_GAUGE_MAX
+};
+
+/* Histograms of durations, in nanoseconds. */
+enum metric_histogram_t {
+    /* Reading the configuration files into a tree, from the cache or
+       by parsing them. */
+    METRIC_CONFIG_PARSE_TIME,
+
+    /* The whole load or reload, up to publishing the new settings. */
+    METRIC_CONFIG_LOAD_TIME,
+
+    METRIC_HISTOGRAM_MAX
+};
+
+/* Values are kept with METRICS_PRECISION_BITS significant bits, within
+   about 3%, up to 2^METRICS_VALUE_BITS - 1; larger ones are counted as
+   that. */
+#define METRICS_PRECISION_BITS 6
+#define METRICS_VALUE_BITS 40
+
+/* The percentiles reported, in thousandths. */
+#define METRICS_PERCENTILES 4
+
+extern const int metrics_percentiles[METRICS_PERCENTILES];
+
+struct metrics_t {
+    uint64_t counters[METRIC_COUNTER_MAX];
+    int64_t gauges[METRIC_GAUGE_MAX];
+
+    struct {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+        uint64_t percentiles[METRICS_PERCENTILES];
+    } histograms[METRIC_HISTOGRAM_MAX];
+};
+
+void metrics_add(enum metric_counter_t counter, uint64_t n);
+
+void metrics_set(enum metric_gauge_t gauge, int64_t value);
+
+void metrics_record(enum metric_histogram_t histogram, uint64_t value);
+
+/* Nanoseconds of CLOCK_MONOTONIC, to time what metrics_record()
+   takes. */
+uint64_t metrics_now(void);
+
+/* Merge the records of all threads into metrics. */
+void metrics_get(struct metrics_t *metrics);
+
+/* The names of the metrics, "?" for unknown ones. */
+const char *metric_counter_name(int counter);
+
+const char *metric_gauge_name(int gauge);
+
+const char *metric_histogram_name(int histogram);
+
+#endif  /* !_GASTOOL_METRICS_H */
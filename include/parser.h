@@ -17,10 +17,49 @@
 #ifndef _GASTOOL_PARSER_H
 #define _GASTOOL_PARSER_H
 
+#include <stdbool.h>
+
 #include "cfgtree.h"
 
-int read_config_file(const char *filename, directive_t **conftree);
+int read_config_file(const char *filename, conftree_t *conftree);
+
+/* Bring a tree up to date with its files. Only the files that changed are
+   parsed again; the directives of the others are reused and linked into
+   the tree again. *changed is set if the tree changed. On failure the
+   tree is left as it was. */
+int reload_config_file(conftree_t *conftree, bool *changed);
+
+void free_conf_tree(conftree_t *conftree);
+
+/* Streaming parser. The file is read in small pieces and each directive
+   is handed to a callback as soon as it is parsed, so memory use only
+   depends on the nesting depth and the longest line, not on the size of
+   the file. Include directives are followed: the directives of the
+   files they name come in their place.
+
+   Block names are passed with their '<', as in the tree. Names and file
+   names are interned; the arguments are only valid until the callback
+   returns. Blocks still open at the end of a file are closed at its
+   last line. A callback may be NULL; a callback that returns a negative
+   value stops the parse, which then fails. */
+
+struct conf_handler_t {
+    int (*on_block_open)(void *arg, const char *name, int argc,
+                         const char *const *argv, const char *filename,
+                         int linenum);
+
+    int (*on_directive)(void *arg, const char *name, int argc,
+                        const char *const *argv, const char *filename,
+                        int linenum);
+
+    int (*on_block_close)(void *arg, const char *name, const char *filename,
+                          int linenum);
+
+    /* Passed to the callbacks. */
+    void *arg;
+};
 
-void free_conf_tree(directive_t *current);
+int parse_config_stream(const char *filename,
+                        const struct conf_handler_t *handler);
 
 #endif  /* !_GASTOOL_PARSER_H */
@@ -0,0 +1,135 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef _GASTOOL_PROFILE_H
+#define _GASTOOL_PROFILE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* The startup profile: where gastoold spends its time before it is
+   ready, and on the way out. Each thread is in at most one phase at a
+   time, and what it uses until it switches to another phase is charged
+   to that phase.
+
+   Switching reads the clocks and the resource usage of the thread, a
+   few hundred nanoseconds and a system call. The phases entered for
+   each line use profile_lap() instead, which only reads the monotonic
+   clock and the allocation count. Until profile_start(), either costs
+   one load and one branch. */
+
+enum profile_phase_t {
+    /* The thread is not profiled. */
+    PROFILE_NONE = -1,
+
+    PROFILE_OPTIONS,
+    PROFILE_OPEN,
+    PROFILE_READ,
+    PROFILE_TOKENIZE,
+    PROFILE_BUILD,
+    PROFILE_CACHE,
+    PROFILE_VALIDATE,
+    PROFILE_TEARDOWN,
+
+    /* Everything else. */
+    PROFILE_OTHER,
+
+    PROFILE_PHASE_MAX
+};
+
+/* What a thread has used up to some point. The counts of allocations
+   are those of the wrappers of common.h. */
+struct profile_sample_t {
+    /* Nanoseconds of CLOCK_MONOTONIC and of the thread CPU time. */
+    uint64_t wall;
+    uint64_t cpu;
+
+    uint64_t minor_faults;
+    uint64_t major_faults;
+    uint64_t allocs;
+};
+
+struct profile_stats_t {
+    /* How many times the phase was entered, and the sum of what each
+       thread used in it. */
+    uint64_t entries;
+    struct profile_sample_t used;
+};
+
+enum profile_format_t {
+    PROFILE_FORMAT_TABLE,
+    PROFILE_FORMAT_JSON
+};
+
+extern atomic_bool profile_on;
+
+void profile_sample(struct profile_sample_t *sample);
+
+/* Switch the calling thread to phase; for profile_switch(). */
+int profile_switch_slow(int phase);
+
+/* Switch the calling thread to phase and return the phase it was in,
+   to switch back to it later. */
+static inline int profile_switch(int phase)
+{
+    if (__builtin_expect(atomic_load_explicit(&profile_on,
+                                              memory_order_relaxed), 0))
+        return profile_switch_slow(phase);
+
+    return PROFILE_NONE;
+}
+
+/* Switch the calling thread to phase; for profile_lap(). */
+int profile_lap_slow(int phase);
+
+/* Switch to phase like profile_switch(), charging it only the wall time
+   and the allocations. The CPU time and the page faults are charged to
+   the phase of the last profile_switch() of the thread, at the next
+   one: lap inside a phase entered with profile_switch(), such as the
+   reading of a file or of a chunk. */
+static inline int profile_lap(int phase)
+{
+    if (__builtin_expect(atomic_load_explicit(&profile_on,
+                                              memory_order_relaxed), 0))
+        return profile_lap_slow(phase);
+
+    return PROFILE_NONE;
+}
+
+/* Start profiling, with the calling thread in phase since the sample
+   since, or from now if it is NULL. The first start is the origin of
+   the time to ready. */
+void profile_start(int phase, const struct profile_sample_t *since);
+
+/* Stop profiling, charging the phase of the calling thread. No other
+   thread may be in a phase. The first stop marks when the program was
+   ready. */
+void profile_stop(void);
+
+/* The totals of the phases, and the nanoseconds from the first start to
+   the first stop. */
+void profile_get(struct profile_stats_t stats[PROFILE_PHASE_MAX],
+                 uint64_t *ready);
+
+/* The name of a phase, "?" for unknown ones. */
+const char *profile_phase_name(int phase);
+
+/* Write the totals to stream, as a table or as a JSON object. */
+void profile_report(FILE *stream, enum profile_format_t format);
+
+#endif  /* !_GASTOOL_PROFILE_H */
@@ -0,0 +1,35 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef _GASTOOL_SCAN_H
+#define _GASTOOL_SCAN_H
+
+#include <stdbool.h>
+
+/* Token scanners for the configuration parser. Each looks at 16 or 32
+   bytes at a time where the processor allows it, picked at startup, and
+   one byte at a time otherwise. The string must be terminated by a '\0'
+   byte; the vector versions may read the rest of the aligned block it
+   is in, which never crosses a page boundary. */
+
+/* Return the first blank or '\0' at or after s. Set *escaped if a
+   backslash comes before it. */
+char *scan_word(const char *s, bool *escaped);
+
+/* Return the first quote, backslash or '\0' at or after s. */
+char *scan_quoted(const char *s, char quote);
+
+#endif  /* !_GASTOOL_SCAN_H */
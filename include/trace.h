@@ -0,0 +1,103 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef _GASTOOL_TRACE_H
+#define _GASTOOL_TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Trace spans, compiled in when Gastool is configured with
+   --enable-tracing. A span covers the rest of the block it is started
+   in:
+
+       TRACE_SCOPE("parse_config_file");
+
+   Each thread records the spans it ends in a ring of its own; the
+   rings are written as Chrome trace_event JSON, which Perfetto and
+   chrome://tracing load. Until trace_start(), a span costs one load and
+   one branch where it starts, and one branch where it ends. */
+
+#ifdef GAS_TRACE
+
+struct trace_span_t {
+    /* NULL if tracing was off when the span started. */
+    const char *name;
+    uint64_t start;
+};
+
+extern atomic_bool trace_on;
+
+static inline uint64_t trace_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* Record a span that started at start; for trace_span_end(). */
+void trace_record(const char *name, uint64_t start);
+
+static inline struct trace_span_t trace_span_begin(const char *name)
+{
+    struct trace_span_t span = { NULL, 0 };
+
+    if (__builtin_expect(atomic_load_explicit(&trace_on,
+                                              memory_order_relaxed), 0)) {
+        span.name = name;
+        span.start = trace_clock();
+    }
+
+    return span;
+}
+
+static inline void trace_span_end(struct trace_span_t *span)
+{
+    if (__builtin_expect(span->name != NULL, 0))
+        trace_record(span->name, span->start);
+}
+
+#define TRACE_SPAN_VAR__(line) trace_span_##line
+#define TRACE_SPAN_VAR_(line) TRACE_SPAN_VAR__(line)
+
+/* name must be a string literal, or live until trace_write(). */
+#define TRACE_SCOPE(name)                                               \
+    struct trace_span_t TRACE_SPAN_VAR_(__LINE__)                       \
+        __attribute__((cleanup(trace_span_end))) = trace_span_begin(name)
+
+#else  /* !GAS_TRACE */
+
+#define TRACE_SCOPE(name) ((void)0)
+
+#endif  /* !GAS_TRACE */
+
+/* The spans each thread keeps, the latest ones, if 0 is given. */
+#define TRACE_EVENTS_DEFAULT (64 * 1024)
+
+/* Start recording spans, keeping the last events of each thread, from
+   the main thread. Fails if tracing is not compiled in. */
+int trace_start(size_t events);
+
+/* Write the spans recorded to path. No other thread may be recording
+   spans. */
+int trace_write(const char *path);
+
+#endif  /* !_GASTOOL_TRACE_H */
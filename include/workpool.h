@@ -0,0 +1,66 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef _GASTOOL_WORKPOOL_H
+#define _GASTOOL_WORKPOOL_H
+
+#include <stddef.h>
+
+#include "evloop.h"
+
+/* A pool of worker threads for CPU-bound work. Each worker runs the
+   work it submits itself from a deque of its own, most recent first;
+   idle workers steal the oldest work of random others. Work submitted
+   from other threads is spread over the workers. */
+
+typedef struct workpool_t workpool_t;
+
+struct work_t;
+
+typedef void work_fn(struct work_t *work);
+
+/* Work to run, usually embedded in a larger structure. It belongs to
+   the pool from workpool_submit() until done is called, or run returns
+   if done is NULL. */
+struct work_t {
+    work_fn *run;
+
+    /* Called once run has returned: by the thread of the loop the pool
+       was created with, or by the worker if it has none. It is read
+       before run is called. */
+    work_fn *done;
+
+    struct work_t *next;
+};
+
+/* Start nthreads workers, one per online processor if 0, each with a
+   deque of queue_size entries rounded up to a power of two. If loop is
+   not NULL, done callbacks run on it. Return NULL on failure. */
+workpool_t *workpool_create(int nthreads, int queue_size, evloop_t *loop);
+
+/* Run the work still queued, stop the workers and free the pool. If it
+   has a loop, it must be called from the thread of the loop, which
+   runs the done callbacks left. */
+void workpool_free(workpool_t *pool);
+
+/* Queue work, from any thread. A worker whose deque is full runs the
+   work at once. */
+void workpool_submit(workpool_t *pool, struct work_t *work);
+
+/* The number of workers. */
+int workpool_size(const workpool_t *pool);
+
+#endif  /* !_GASTOOL_WORKPOOL_H */
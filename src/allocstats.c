@@ -0,0 +1,288 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+
+#include "gasconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "log.h"
+#include "allocstats.h"
+
+static const char *const alloc_tag_names[GAS_ALLOC_TAG_MAX] = {
+    [GAS_ALLOC_CORE] = "core",
+    [GAS_ALLOC_CONFIG] = "config",
+    [GAS_ALLOC_PARSER] = "parser",
+    [GAS_ALLOC_LOG] = "log"
+};
+
+const char *alloc_tag_name(int tag)
+{
+    if (tag < 0 || tag >= GAS_ALLOC_TAG_MAX)
+        return "?";
+
+    return alloc_tag_names[tag];
+}
+
+#ifdef GAS_ALLOC_STATS
+
+/* The counts of a thread, which only the thread writes; other threads
+   only read them, to sum them up. */
+struct alloc_thread_t {
+    struct gas_thread_record_t record;
+
+    struct {
+        _Alignas(CACHE_LINE_SIZE) atomic_uint_least64_t allocs;
+        atomic_uint_least64_t frees;
+        atomic_uint_least64_t bytes;
+        atomic_uint_least64_t freed;
+        atomic_uint_least64_t classes[ALLOC_STATS_CLASSES];
+
+        /* Bytes allocated, less those freed, not yet added to
+           alloc_live. */
+        int64_t pending;
+    } tags[GAS_ALLOC_TAG_MAX];
+};
+
+static void alloc_thread_release(struct gas_thread_record_t *record);
+
+/* The records of the threads that allocated. Reused records keep their
+   counts. */
+static struct gas_thread_registry_t alloc_threads =
+    GAS_THREAD_REGISTRY_INIT(struct alloc_thread_t, NULL,
+                             alloc_thread_release);
+
+static _Thread_local struct alloc_thread_t *alloc_thread = NULL;
+
+/* The live bytes of each tag, as far as the threads added them, and
+   the most seen. */
+static atomic_int_least64_t alloc_live[GAS_ALLOC_TAG_MAX];
+static atomic_int_least64_t alloc_peak[GAS_ALLOC_TAG_MAX];
+
+static void alloc_flush(struct alloc_thread_t *thread, int tag)
+{
+    int64_t live, peak;
+
+    live = atomic_fetch_add_explicit(&alloc_live[tag],
+                                     thread->tags[tag].pending,
+                                     memory_order_relaxed)
+           + thread->tags[tag].pending;
+    thread->tags[tag].pending = 0;
+
+    peak = atomic_load_explicit(&alloc_peak[tag], memory_order_relaxed);
+    while (live > peak
+           && !atomic_compare_exchange_weak_explicit(&alloc_peak[tag], &peak,
+                                                     live,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed))
+        ;
+}
+
+static void alloc_thread_release(struct gas_thread_record_t *record)
+{
+    struct alloc_thread_t *thread = (struct alloc_thread_t *)record;
+    int tag;
+
+    for (tag = 0; tag < GAS_ALLOC_TAG_MAX; tag++)
+        alloc_flush(thread, tag);
+
+    /* Should a later destructor of the thread allocate, it takes a record
+       again. */
+    alloc_thread = NULL;
+}
+
+/* Returns NULL rather than logging when memory is exhausted: logging
+   could allocate, and come back here. */
+static struct alloc_thread_t *alloc_thread_register(void)
+{
+    alloc_thread = gas_thread_record_take(&alloc_threads);
+
+    return alloc_thread;
+}
+
+static unsigned int alloc_class(size_t size)
+{
+    unsigned int class;
+
+    if (size == 0)
+        return 0;
+
+    class = 64 - __builtin_clzll(size);
+    return class < ALLOC_STATS_CLASSES ? class : ALLOC_STATS_CLASSES - 1;
+}
+
+void alloc_stats_add(enum gas_alloc_tag_t tag, size_t size)
+{
+    struct alloc_thread_t *thread = alloc_thread;
+
+    if (thread == NULL && (thread = alloc_thread_register()) == NULL)
+        return;
+
+    GAS_THREAD_ADD(thread->tags[tag].allocs, 1);
+    GAS_THREAD_ADD(thread->tags[tag].bytes, size);
+    GAS_THREAD_ADD(thread->tags[tag].classes[alloc_class(size)], 1);
+
+    thread->tags[tag].pending += size;
+    if (thread->tags[tag].pending >= ALLOC_STATS_FLUSH)
+        alloc_flush(thread, tag);
+}
+
+void alloc_stats_sub(enum gas_alloc_tag_t tag, size_t size)
+{
+    struct alloc_thread_t *thread = alloc_thread;
+
+    if (thread == NULL && (thread = alloc_thread_register()) == NULL)
+        return;
+
+    GAS_THREAD_ADD(thread->tags[tag].frees, 1);
+    GAS_THREAD_ADD(thread->tags[tag].freed, size);
+
+    thread->tags[tag].pending -= (int64_t)size;
+    if (thread->tags[tag].pending <= -ALLOC_STATS_FLUSH)
+        alloc_flush(thread, tag);
+}
+
+bool alloc_stats_enabled(void)
+{
+    return true;
+}
+
+void alloc_stats_get(struct alloc_stats_t *stats)
+{
+    struct gas_thread_record_t *record;
+    struct alloc_thread_t *thread;
+    uint64_t freed[GAS_ALLOC_TAG_MAX] = { 0 };
+    int tag, i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&alloc_threads.lock);
+
+    for (record = alloc_threads.records; record != NULL;
+         record = record->next) {
+        thread = (struct alloc_thread_t *)record;
+
+        for (tag = 0; tag < GAS_ALLOC_TAG_MAX; tag++) {
+            stats->tags[tag].allocs +=
+                atomic_load_explicit(&thread->tags[tag].allocs,
+                                     memory_order_relaxed);
+            stats->tags[tag].frees +=
+                atomic_load_explicit(&thread->tags[tag].frees,
+                                     memory_order_relaxed);
+            stats->tags[tag].bytes +=
+                atomic_load_explicit(&thread->tags[tag].bytes,
+                                     memory_order_relaxed);
+            freed[tag] += atomic_load_explicit(&thread->tags[tag].freed,
+                                               memory_order_relaxed);
+
+            for (i = 0; i < ALLOC_STATS_CLASSES; i++)
+                stats->tags[tag].classes[i] +=
+                    atomic_load_explicit(&thread->tags[tag].classes[i],
+                                         memory_order_relaxed);
+        }
+    }
+
+    pthread_mutex_unlock(&alloc_threads.lock);
+
+    for (tag = 0; tag < GAS_ALLOC_TAG_MAX; tag++) {
+        stats->tags[tag].live = stats->tags[tag].bytes - freed[tag];
+        stats->tags[tag].peak = atomic_load_explicit(&alloc_peak[tag],
+                                                     memory_order_relaxed);
+
+        /* The pending bytes of the threads may not have made it to the
+           peak yet. */
+        if (stats->tags[tag].peak < stats->tags[tag].live)
+            stats->tags[tag].peak = stats->tags[tag].live;
+    }
+}
+
+#else  /* !GAS_ALLOC_STATS */
+
+void alloc_stats_add(enum gas_alloc_tag_t tag, size_t size)
+{
+    (void)tag;
+    (void)size;
+}
+
+void alloc_stats_sub(enum gas_alloc_tag_t tag, size_t size)
+{
+    (void)tag;
+    (void)size;
+}
+
+bool alloc_stats_enabled(void)
+{
+    return false;
+}
+
+void alloc_stats_get(struct alloc_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+#endif  /* !GAS_ALLOC_STATS */
+
+void alloc_stats_report(void)
+{
+    struct alloc_stats_t stats;
+    char classes[512];
+    size_t len;
+    int tag, i, n;
+
+    if (!alloc_stats_enabled()) {
+        log_print(LOG_INFO, 0, "allocation statistics are not compiled in");
+        return;
+    }
+
+    alloc_stats_get(&stats);
+
+    for (tag = 0; tag < GAS_ALLOC_TAG_MAX; tag++) {
+        log_print(LOG_INFO, 0, "%s memory: %" PRIu64 " allocations, %"
+                  PRIu64 " frees, %" PRIu64 " bytes allocated, %" PRId64
+                  " live, %" PRId64 " at peak", alloc_tag_name(tag),
+                  stats.tags[tag].allocs, stats.tags[tag].frees,
+                  stats.tags[tag].bytes, stats.tags[tag].live,
+                  stats.tags[tag].peak);
+
+        len = 0;
+        classes[0] = '\0';
+        for (i = 0; i < ALLOC_STATS_CLASSES; i++) {
+            if (stats.tags[tag].classes[i] == 0)
+                continue;
+
+            n = snprintf(classes + len, sizeof(classes) - len, " %s%llu:%"
+                         PRIu64, i == ALLOC_STATS_CLASSES - 1 ? ">=" : "<=",
+                         i == ALLOC_STATS_CLASSES - 1
+                         ? 1ull << (i - 1) : (1ull << i) - 1,
+                         stats.tags[tag].classes[i]);
+            if (n < 0 || (size_t)n >= sizeof(classes) - len)
+                break;
+            len += n;
+        }
+
+        if (len > 0)
+            log_print(LOG_INFO, 0, "%s allocation sizes:%s",
+                      alloc_tag_name(tag), classes);
+    }
+}
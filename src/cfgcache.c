@@ -0,0 +1,798 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "gasconfig.h"
+
+#define LOG_SUBSYSTEM LOG_CONFIG
+#define GAS_ALLOC_TAG GAS_ALLOC_CONFIG
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "common.h"
+#include "log.h"
+#include "cfgtree.h"
+#include "cfgcache.h"
+
+/* The cache image is position independent: nodes, arguments and strings
+   refer to each other by index or offset, so the image is mapped and used
+   as is. It is laid out as:
+
+     header
+     files[nfiles]      the files the tree was built from
+     nodes[nnodes]      the directives, in preorder
+     args[nargs]        argument string indices, for all nodes
+     strings[nstrings]  offset and length of each distinct string
+     strtab[strtabsize] the strings, each followed by '\0'
+
+   The image is stored in host byte order; an image written on a host
+   with another byte order is simply stale. */
+
+#define CFGCACHE_MAGIC "GASCFG\n"
+#define CFGCACHE_VERSION 1
+#define CFGCACHE_BYTEORDER 0x01020304u
+
+/* File flags. */
+#define CFGCACHE_DIRECTORY 0x1
+
+/* No node. */
+#define CFGCACHE_NONE UINT32_MAX
+
+/* Strings interned when the image is loaded have this flag set in their
+   length. */
+#define CFGCACHE_INTERNED 0x80000000u
+
+struct cfgcache_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+
+    /* The image size and the checksum of the sections. */
+    uint64_t size;
+    uint64_t checksum;
+
+    uint32_t nfiles;
+    uint32_t nnodes;
+    uint32_t nargs;
+    uint32_t nstrings;
+    uint64_t strtabsize;
+};
+
+struct cfgcache_file_t {
+    uint32_t filename;
+    uint32_t flags;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+    uint64_t hash;
+};
+
+struct cfgcache_node_t {
+    uint32_t directive;
+    uint32_t filename;
+    uint32_t linenum;
+    uint32_t argc;
+    /* The index of the first argument in args. */
+    uint32_t argv;
+    /* Node indices, or CFGCACHE_NONE. */
+    uint32_t child;
+    uint32_t next;
+};
+
+struct cfgcache_string_t {
+    uint32_t offset;
+    uint32_t length;
+};
+
+/* The sections of a mapped image. */
+struct cfgcache_image_t {
+    const struct cfgcache_header_t *header;
+    const struct cfgcache_file_t *files;
+    const struct cfgcache_node_t *nodes;
+    const uint32_t *args;
+    const struct cfgcache_string_t *strings;
+    const char *strtab;
+};
+
+static char *cfgcache_path(const char *filename)
+{
+    size_t len = strlen(filename);
+    char *path = gas_malloc(len + sizeof(CFGCACHE_SUFFIX));
+
+    memcpy(path, filename, len);
+    memcpy(path + len, CFGCACHE_SUFFIX, sizeof(CFGCACHE_SUFFIX));
+
+    return path;
+}
+
+/* Whether the cache image can be written next to the configuration file.
+   A read-only configuration directory is common and not worth a warning
+   on every start and reload. */
+static bool cfgcache_writable(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    char *dir;
+    bool writable;
+
+    if (slash == NULL)
+        return faccessat(AT_FDCWD, ".", W_OK, AT_EACCESS) == 0;
+
+    dir = gas_malloc(slash - path + 2);
+    memcpy(dir, path, slash - path + 1);
+    dir[slash - path + 1] = '\0';
+
+    writable = faccessat(AT_FDCWD, dir, W_OK, AT_EACCESS) == 0;
+    gas_free(dir);
+
+    return writable;
+}
+
+/* Locate the sections of an image. The section sizes must add up to the
+   image size. */
+static int cfgcache_layout(const struct cfgcache_header_t *header,
+                           struct cfgcache_image_t *image)
+{
+    const char *base = (const char *)header;
+    uint64_t offset = sizeof(*header);
+
+    image->header = header;
+
+    image->files = (const void *)(base + offset);
+    offset += (uint64_t)header->nfiles * sizeof(*image->files);
+    image->nodes = (const void *)(base + offset);
+    offset += (uint64_t)header->nnodes * sizeof(*image->nodes);
+    image->args = (const void *)(base + offset);
+    offset += (uint64_t)header->nargs * sizeof(*image->args);
+    image->strings = (const void *)(base + offset);
+    offset += (uint64_t)header->nstrings * sizeof(*image->strings);
+    image->strtab = base + offset;
+
+    if (offset > header->size || header->size - offset != header->strtabsize)
+        return -GAS_FAILURE;
+
+    return GAS_SUCCESS;
+}
+
+/* The checksum is the hash of the hashes of the sections, so the writer
+   does not need them in one piece. */
+static uint64_t cfgcache_checksum(const void *const *sections,
+                                  const size_t *sizes)
+{
+    uint64_t hashes[5];
+    int i;
+
+    for (i = 0; i < 5; i++)
+        hashes[i] = gas_hash64(sections[i], sizes[i]);
+
+    return gas_hash64(hashes, sizeof(hashes));
+}
+
+static uint64_t cfgcache_image_checksum(const struct cfgcache_image_t *image)
+{
+    const struct cfgcache_header_t *header = image->header;
+    const void *sections[5] = {
+        image->files, image->nodes, image->args, image->strings,
+        image->strtab
+    };
+    const size_t sizes[5] = {
+        header->nfiles * sizeof(*image->files),
+        header->nnodes * sizeof(*image->nodes),
+        header->nargs * sizeof(*image->args),
+        header->nstrings * sizeof(*image->strings),
+        header->strtabsize
+    };
+
+    return cfgcache_checksum(sections, sizes);
+}
+
+/* Return string number index of an image, or NULL if it is out of
+   bounds. */
+static const char *cfgcache_image_string(const struct cfgcache_image_t *image,
+                                         uint32_t index, uint32_t *len)
+{
+    const struct cfgcache_header_t *header = image->header;
+    const struct cfgcache_string_t *string;
+
+    if (index >= header->nstrings)
+        return NULL;
+
+    string = &image->strings[index];
+    *len = string->length & ~CFGCACHE_INTERNED;
+
+    if ((uint64_t)string->offset + *len >= header->strtabsize
+        || image->strtab[string->offset + *len] != '\0')
+        return NULL;
+
+    return image->strtab + string->offset;
+}
+
+/* Check that a file is still the one the image was built from: same
+   modification time and size, then same contents. Directories only need
+   the same modification time. */
+static bool cfgcache_file_fresh(const char *filename,
+                                const struct cfgcache_file_t *file)
+{
+    struct stat statbuf;
+    bool result = false;
+    void *data;
+    int fd;
+
+    if (file->flags & CFGCACHE_DIRECTORY) {
+        return stat(filename, &statbuf) == 0 && S_ISDIR(statbuf.st_mode)
+               && statbuf.st_mtim.tv_sec == file->mtime_sec
+               && statbuf.st_mtim.tv_nsec == file->mtime_nsec;
+    }
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    if (fstat(fd, &statbuf) < 0 || !S_ISREG(statbuf.st_mode)
+        || statbuf.st_mtim.tv_sec != file->mtime_sec
+        || statbuf.st_mtim.tv_nsec != file->mtime_nsec
+        || (uint64_t)statbuf.st_size != file->size)
+        goto file_fresh_close;
+
+    if (statbuf.st_size == 0) {
+        result = gas_hash64(NULL, 0) == file->hash;
+        goto file_fresh_close;
+    }
+
+    data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        goto file_fresh_close;
+
+    result = gas_hash64(data, statbuf.st_size) == file->hash;
+
+    munmap(data, statbuf.st_size);
+
+file_fresh_close:
+    close(fd);
+
+    return result;
+}
+
+/* Rebuild the directive tree from a mapped image. Returns -GAS_FAILURE if
+   the image is inconsistent. */
+static int cfgcache_build(const struct cfgcache_image_t *image,
+                          conftree_t *conftree)
+{
+    const struct cfgcache_header_t *header = image->header;
+    const char **strptrs, **argvs;
+    struct conf_file_t **files_tail;
+    directive_t *dirs;
+    uint32_t i, j, len;
+
+    /* Resolve every string once: interned ones through the intern pool,
+       the others point into the image. */
+    strptrs = arena_alloc(&conftree->arena,
+                          header->nstrings * sizeof(*strptrs));
+
+    for (i = 0; i < header->nstrings; i++) {
+        strptrs[i] = cfgcache_image_string(image, i, &len);
+        if (strptrs[i] == NULL)
+            return -GAS_FAILURE;
+
+        if (image->strings[i].length & CFGCACHE_INTERNED)
+            strptrs[i] = gas_intern_n(strptrs[i], len);
+    }
+
+    files_tail = &conftree->files;
+
+    for (i = 0; i < header->nfiles; i++) {
+        const struct cfgcache_file_t *entry = &image->files[i];
+        struct conf_file_t *file;
+
+        file = arena_alloc(&conftree->arena, sizeof(*file));
+        memset(file, 0, sizeof(*file));
+
+        file->filename = strptrs[entry->filename];
+        file->directory = (entry->flags & CFGCACHE_DIRECTORY) != 0;
+        file->mtime.tv_sec = entry->mtime_sec;
+        file->mtime.tv_nsec = entry->mtime_nsec;
+        file->size = entry->size;
+        file->hash = entry->hash;
+
+        *files_tail = file;
+        files_tail = &file->next;
+    }
+
+    if (header->nnodes == 0)
+        return GAS_SUCCESS;
+
+    /* All nodes and all argument vectors are allocated in one piece each.
+       Every vector gets its own terminating NULL. */
+    dirs = arena_alloc(&conftree->arena, header->nnodes * sizeof(*dirs));
+    memset(dirs, 0, header->nnodes * sizeof(*dirs));
+
+    argvs = arena_alloc(&conftree->arena,
+                        ((size_t)header->nargs + header->nnodes)
+                        * sizeof(*argvs));
+
+    for (i = 0; i < header->nnodes; i++) {
+        const struct cfgcache_node_t *node = &image->nodes[i];
+
+        if (node->directive >= header->nstrings
+            || node->filename >= header->nstrings
+            || (uint64_t)node->argv + node->argc > header->nargs)
+            return -GAS_FAILURE;
+
+        /* Preorder: children and siblings always come later, so the
+           parent of every node is known by the time it is reached. */
+        if ((node->child != CFGCACHE_NONE
+             && (node->child <= i || node->child >= header->nnodes))
+            || (node->next != CFGCACHE_NONE
+                && (node->next <= i || node->next >= header->nnodes)))
+            return -GAS_FAILURE;
+
+        dirs[i].directive = strptrs[node->directive];
+        dirs[i].filename = strptrs[node->filename];
+        dirs[i].linenum = node->linenum;
+        dirs[i].argc = node->argc;
+        dirs[i].argv = argvs;
+
+        for (j = 0; j < node->argc; j++) {
+            if (image->args[node->argv + j] >= header->nstrings)
+                return -GAS_FAILURE;
+            *argvs++ = strptrs[image->args[node->argv + j]];
+        }
+        *argvs++ = NULL;
+
+        if (node->child != CFGCACHE_NONE) {
+            dirs[i].child = &dirs[node->child];
+            dirs[node->child].parent = &dirs[i];
+        }
+
+        if (node->next != CFGCACHE_NONE) {
+            dirs[i].next = &dirs[node->next];
+            dirs[node->next].parent = dirs[i].parent;
+        }
+    }
+
+    conftree->root = &dirs[0];
+
+    return GAS_SUCCESS;
+}
+
+/* Load the tree of a configuration file from its cache image. Fails,
+   leaving an empty tree, if there is no usable image: it is missing,
+   stale or corrupt. */
+int cfgcache_load(const char *filename, conftree_t *conftree)
+{
+    struct cfgcache_image_t image;
+    const struct cfgcache_header_t *header;
+    struct stat statbuf;
+    const char *name;
+    char *path;
+    void *data;
+    uint32_t i, len;
+    int fd;
+
+    conftree->root = NULL;
+    conftree->files = NULL;
+    conftree->units = NULL;
+    conftree->image = NULL;
+    conftree->imagesize = 0;
+    arena_init(&conftree->arena);
+
+    path = cfgcache_path(filename);
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            log_print(LOG_DEBUG, errno, "cannot open configuration cache "
+                      "'%s'", path);
+        gas_free(path);
+        return -GAS_FAILURE;
+    }
+
+    if (fstat(fd, &statbuf) < 0 || !S_ISREG(statbuf.st_mode)
+        || (size_t)statbuf.st_size < sizeof(*header)) {
+        close(fd);
+        goto cache_corrupt;
+    }
+
+    data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        goto cache_corrupt;
+
+    conftree->image = data;
+    conftree->imagesize = statbuf.st_size;
+
+    header = data;
+
+    if (memcmp(header->magic, CFGCACHE_MAGIC, sizeof(header->magic)) != 0
+        || header->size != (uint64_t)statbuf.st_size)
+        goto cache_corrupt;
+
+    if (header->version != CFGCACHE_VERSION
+        || header->byteorder != CFGCACHE_BYTEORDER)
+        goto cache_stale;
+
+    if (cfgcache_layout(header, &image) < 0
+        || cfgcache_image_checksum(&image) != header->checksum)
+        goto cache_corrupt;
+
+    /* The first file must be the configuration file itself, and all of
+       the files must be unchanged. */
+    if (header->nfiles == 0)
+        goto cache_corrupt;
+
+    for (i = 0; i < header->nfiles; i++) {
+        name = cfgcache_image_string(&image, image.files[i].filename, &len);
+        if (name == NULL)
+            goto cache_corrupt;
+
+        if ((i == 0 && strcmp(name, filename) != 0)
+            || !cfgcache_file_fresh(name, &image.files[i]))
+            goto cache_stale;
+    }
+
+    if (cfgcache_build(&image, conftree) < 0)
+        goto cache_corrupt;
+
+    log_print(LOG_DEBUG, 0, "loaded configuration from cache '%s'", path);
+
+    gas_free(path);
+
+    return GAS_SUCCESS;
+
+cache_corrupt:
+    log_print(LOG_WARNING, 0, "configuration cache '%s' is corrupt, "
+              "ignoring it", path);
+    goto cache_failed;
+
+cache_stale:
+    log_print(LOG_DEBUG, 0, "configuration cache '%s' is stale", path);
+
+cache_failed:
+    gas_free(path);
+
+    if (conftree->image != NULL)
+        munmap(conftree->image, conftree->imagesize);
+
+    arena_free(&conftree->arena);
+
+    conftree->root = NULL;
+    conftree->files = NULL;
+    conftree->image = NULL;
+    conftree->imagesize = 0;
+
+    return -GAS_FAILURE;
+}
+
+/* Image under construction. */
+struct cfgcache_writer_t {
+    struct cfgcache_file_t *files;
+    uint32_t nfiles;
+
+    struct cfgcache_node_t *nodes;
+    uint32_t nnodes, nodesize;
+
+    uint32_t *args;
+    uint32_t nargs, argsize;
+
+    struct cfgcache_string_t *strings;
+    uint32_t nstrings, stringsize;
+
+    char *strtab;
+    uint64_t strtabsize, strtaballoc;
+
+    /* Distinct strings, by content: an open addressing table of string
+       indices plus one. */
+    uint32_t *lookup;
+    uint32_t lookupmask;
+};
+
+static void *cfgcache_grow(void *p, uint32_t *alloc, uint32_t count,
+                           size_t size)
+{
+    if (count < *alloc)
+        return p;
+
+    *alloc = *alloc ? *alloc * 2 : 256;
+    return gas_realloc(p, *alloc * size);
+}
+
+static void cfgcache_rehash(struct cfgcache_writer_t *writer)
+{
+    uint32_t size = writer->lookup ? (writer->lookupmask + 1) * 2 : 1024;
+    uint32_t i, j;
+
+    gas_free(writer->lookup);
+
+    writer->lookup = gas_malloc(size * sizeof(*writer->lookup));
+    memset(writer->lookup, 0, size * sizeof(*writer->lookup));
+    writer->lookupmask = size - 1;
+
+    for (i = 0; i < writer->nstrings; i++) {
+        const struct cfgcache_string_t *string = &writer->strings[i];
+        uint64_t hash = gas_hash64(writer->strtab + string->offset,
+                                   string->length & ~CFGCACHE_INTERNED);
+
+        for (j = hash & writer->lookupmask; writer->lookup[j];
+             j = (j + 1) & writer->lookupmask)
+            ;
+        writer->lookup[j] = i + 1;
+    }
+}
+
+static uint32_t cfgcache_string(struct cfgcache_writer_t *writer,
+                                const char *string, bool interned)
+{
+    size_t len = strlen(string);
+    uint32_t length = len | (interned ? CFGCACHE_INTERNED : 0);
+    uint64_t hash;
+    uint32_t i, index;
+
+    if ((writer->nstrings + 1) * 2 > writer->lookupmask + 1)
+        cfgcache_rehash(writer);
+
+    hash = gas_hash64(string, len);
+
+    for (i = hash & writer->lookupmask; writer->lookup[i];
+         i = (i + 1) & writer->lookupmask) {
+        const struct cfgcache_string_t *entry;
+
+        entry = &writer->strings[writer->lookup[i] - 1];
+        if (entry->length == length
+            && memcmp(writer->strtab + entry->offset, string, len) == 0)
+            return writer->lookup[i] - 1;
+    }
+
+    while (writer->strtabsize + len + 1 > writer->strtaballoc) {
+        writer->strtaballoc = writer->strtaballoc
+                              ? writer->strtaballoc * 2 : 64 * 1024;
+        writer->strtab = gas_realloc(writer->strtab, writer->strtaballoc);
+    }
+
+    writer->strings = cfgcache_grow(writer->strings, &writer->stringsize,
+                                    writer->nstrings,
+                                    sizeof(*writer->strings));
+
+    index = writer->nstrings++;
+    writer->strings[index].offset = writer->strtabsize;
+    writer->strings[index].length = length;
+    writer->lookup[i] = index + 1;
+
+    memcpy(writer->strtab + writer->strtabsize, string, len + 1);
+    writer->strtabsize += len + 1;
+
+    return index;
+}
+
+static uint32_t cfgcache_add_node(struct cfgcache_writer_t *writer,
+                                  const directive_t *dir)
+{
+    struct cfgcache_node_t *node;
+    uint32_t index;
+    int i;
+
+    writer->nodes = cfgcache_grow(writer->nodes, &writer->nodesize,
+                                  writer->nnodes, sizeof(*writer->nodes));
+
+    index = writer->nnodes++;
+    node = &writer->nodes[index];
+
+    node->directive = cfgcache_string(writer, dir->directive, true);
+    node->filename = cfgcache_string(writer, dir->filename, true);
+    node->linenum = dir->linenum;
+    node->argc = dir->argc;
+    node->argv = writer->nargs;
+    node->child = CFGCACHE_NONE;
+    node->next = CFGCACHE_NONE;
+
+    for (i = 0; i < dir->argc; i++) {
+        uint32_t string;
+
+        string = cfgcache_string(writer, dir->argv[i], false);
+
+        writer->args = cfgcache_grow(writer->args, &writer->argsize,
+                                     writer->nargs, sizeof(*writer->args));
+        writer->args[writer->nargs++] = string;
+    }
+
+    return index;
+}
+
+/* Flatten the tree in preorder. The stack holds the indices of the
+   ancestors of the current node. */
+static void cfgcache_add_tree(struct cfgcache_writer_t *writer,
+                              const directive_t *dir)
+{
+    uint32_t *stack = NULL, depth = 0, stacksize = 0;
+    uint32_t index;
+
+    while (dir != NULL) {
+        index = cfgcache_add_node(writer, dir);
+
+        if (dir->child != NULL) {
+            stack = cfgcache_grow(stack, &stacksize, depth, sizeof(*stack));
+            stack[depth++] = index;
+
+            writer->nodes[index].child = writer->nnodes;
+            dir = dir->child;
+            continue;
+        }
+
+        while (dir != NULL && dir->next == NULL) {
+            dir = dir->parent;
+            if (dir != NULL)
+                index = stack[--depth];
+        }
+
+        if (dir != NULL) {
+            writer->nodes[index].next = writer->nnodes;
+            dir = dir->next;
+        }
+    }
+
+    gas_free(stack);
+}
+
+static int cfgcache_write(const char *path, const struct iovec *iov,
+                          int iovcnt)
+{
+    char *tmppath;
+    int fd, i, saved_errno;
+
+    tmppath = gas_malloc(strlen(path) + sizeof(".XXXXXX"));
+    sprintf(tmppath, "%s.XXXXXX", path);
+
+    fd = mkstemp(tmppath);
+    if (fd < 0)
+        goto write_failed;
+
+    for (i = 0; i < iovcnt; i++) {
+        const char *p = iov[i].iov_base;
+        size_t left = iov[i].iov_len;
+
+        while (left > 0) {
+            ssize_t n = write(fd, p, left);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                saved_errno = errno;
+                close(fd);
+                unlink(tmppath);
+                errno = saved_errno;
+                goto write_failed;
+            }
+
+            p += n;
+            left -= n;
+        }
+    }
+
+    if (close(fd) < 0 || rename(tmppath, path) < 0) {
+        saved_errno = errno;
+        unlink(tmppath);
+        errno = saved_errno;
+        goto write_failed;
+    }
+
+    gas_free(tmppath);
+
+    return GAS_SUCCESS;
+
+write_failed:
+    gas_free(tmppath);
+
+    return -GAS_FAILURE;
+}
+
+/* Write the cache image of a tree parsed from a configuration file. The
+   image is written to a temporary file and renamed into place, so a
+   concurrent load sees either the old or the new image. */
+int cfgcache_save(const char *filename, const conftree_t *conftree)
+{
+    struct cfgcache_writer_t writer;
+    struct cfgcache_header_t header;
+    const struct conf_file_t *file;
+    struct iovec iov[6];
+    const void *sections[5];
+    size_t sizes[5];
+    char *path;
+    int result, i;
+
+    path = cfgcache_path(filename);
+    if (!cfgcache_writable(path)) {
+        log_print(LOG_DEBUG, errno, "not writing configuration cache '%s'",
+                  path);
+        gas_free(path);
+        return -GAS_FAILURE;
+    }
+
+    memset(&writer, 0, sizeof(writer));
+
+    for (file = conftree->files; file != NULL; file = file->next)
+        writer.nfiles++;
+
+    writer.files = gas_malloc(writer.nfiles * sizeof(*writer.files));
+
+    /* The first file is the configuration file itself. */
+    i = 0;
+    for (file = conftree->files; file != NULL; file = file->next) {
+        struct cfgcache_file_t *entry = &writer.files[i++];
+
+        entry->filename = cfgcache_string(&writer, file->filename, true);
+        entry->flags = file->directory ? CFGCACHE_DIRECTORY : 0;
+        entry->mtime_sec = file->mtime.tv_sec;
+        entry->mtime_nsec = file->mtime.tv_nsec;
+        entry->size = file->size;
+        entry->hash = file->hash;
+    }
+
+    cfgcache_add_tree(&writer, conftree->root);
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = writer.files;
+    iov[1].iov_len = writer.nfiles * sizeof(*writer.files);
+    iov[2].iov_base = writer.nodes;
+    iov[2].iov_len = writer.nnodes * sizeof(*writer.nodes);
+    iov[3].iov_base = writer.args;
+    iov[3].iov_len = writer.nargs * sizeof(*writer.args);
+    iov[4].iov_base = writer.strings;
+    iov[4].iov_len = writer.nstrings * sizeof(*writer.strings);
+    iov[5].iov_base = writer.strtab;
+    iov[5].iov_len = writer.strtabsize;
+
+    for (i = 0; i < 5; i++) {
+        sections[i] = iov[i + 1].iov_base;
+        sizes[i] = iov[i + 1].iov_len;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CFGCACHE_MAGIC, sizeof(header.magic));
+    header.version = CFGCACHE_VERSION;
+    header.byteorder = CFGCACHE_BYTEORDER;
+    header.size = sizeof(header) + sizes[0] + sizes[1] + sizes[2] + sizes[3]
+                  + sizes[4];
+    header.checksum = cfgcache_checksum(sections, sizes);
+    header.nfiles = writer.nfiles;
+    header.nnodes = writer.nnodes;
+    header.nargs = writer.nargs;
+    header.nstrings = writer.nstrings;
+    header.strtabsize = writer.strtabsize;
+
+    result = cfgcache_write(path, iov, 6);
+    if (result < 0) {
+        log_print(LOG_WARNING, errno, "cannot write configuration cache "
+                  "'%s'", path);
+    }
+
+    gas_free(path);
+    gas_free(writer.files);
+    gas_free(writer.nodes);
+    gas_free(writer.args);
+    gas_free(writer.strings);
+    gas_free(writer.strtab);
+    gas_free(writer.lookup);
+
+    return result;
+}
@@ -16,28 +16,242 @@
 
 #include "gasconfig.h"
 
+#define LOG_SUBSYSTEM LOG_CONFIG
+
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 
+#include "log.h"
+#include "metrics.h"
+#include "trace.h"
+#include "profile.h"
 #include "cfgtree.h"
 #include "parser.h"
+#include "cfgcache.h"
+#include "cfgquery.h"
+#include "cfgfrozen.h"
+#include "cfgwatch.h"
+#include "cfgschema.h"
+#include "cfgsnap.h"
 #include "cfgfile.h"
 
 #define DEFAULT_CONFIG_FILE SYSCONFDIR "/gastoold.conf"
 
+/* Use the compiled configuration cache. */
+static bool config_cache = true;
+
+/* The configuration file name, the current configuration and its
+   index, NULL until it is first used. Only the thread that reads the
+   configuration uses them, and the thread of reload_config_parse()
+   while it runs. */
+static const char *config_file = NULL;
+static conftree_t conftree;
+static cfgindex_t *cfgindex = NULL;
+
+/* What reload_config_parse() leaves for reload_config_publish(): whether
+   the tree changed, the frozen copy of the new tree and its settings,
+   NULL if they are not valid, and when the reload started. */
+static bool reload_changed = false;
+static cfgfrozen_t *reload_frozen = NULL;
+static struct gas_config_t reload_settings;
+static uint64_t reload_start;
+
+/* The published snapshot: the frozen copy of the tree and the settings
+   read from it. */
+static struct cfgsnap_t *snapshot = NULL;
+
+/* Watches the configuration files, if inotify is available. */
+static cfgwatch_t *cfgwatch = NULL;
+
+/* Count a configuration published after start nanoseconds. */
+static void config_count_load(const cfgfrozen_t *frozen, uint64_t start)
+{
+    metrics_add(METRIC_CONFIG_LOADS, 1);
+    metrics_set(METRIC_CONFIG_DIRECTIVES, frozen->count);
+    metrics_record(METRIC_CONFIG_LOAD_TIME, metrics_now() - start);
+}
+
+/* Start or stop watching the configuration files as the settings say,
+   and watch the files of the current tree. */
+static void config_watch_update(void)
+{
+    bool watch = snapshot->config.reload.watch;
+
+    if (watch && cfgwatch == NULL) {
+        cfgwatch = cfgwatch_create();
+    } else if (!watch && cfgwatch != NULL) {
+        cfgwatch_free(cfgwatch);
+        cfgwatch = NULL;
+    }
+
+    if (cfgwatch != NULL)
+        cfgwatch_update(cfgwatch, &conftree);
+}
+
+void read_config_set_cache(bool enable)
+{
+    config_cache = enable;
+}
+
 void read_config(const char *configfile)
 {
-    int result;
-    directive_t *conftree = NULL;
+    struct gas_config_t config;
+    cfgfrozen_t *frozen;
+    uint64_t start = metrics_now();
+    int result, phase;
+
+    TRACE_SCOPE("read_config");
 
     if (!configfile)
         configfile = DEFAULT_CONFIG_FILE;
+    config_file = configfile;
+
+    /* Use the cache image when it is up to date, otherwise parse the text
+       and write a new image for the next start. */
+    phase = profile_switch(PROFILE_CACHE);
+    if (!config_cache || cfgcache_load(configfile, &conftree) < 0) {
+        profile_switch(phase);
+        result = read_config_file(configfile, &conftree);
+        if (result < 0) {
+            /* Failed to parse the configuration file.
+               The cause should have already been logged. */
+            exit(EXIT_FAILURE);
+        }
+
+        profile_switch(PROFILE_CACHE);
+        if (config_cache)
+            cfgcache_save(configfile, &conftree);
+    }
 
-    result = read_config_file(configfile, &conftree);
-    if (result < 0) {
-        /* Failed to parse the configuration file.
-           The cause should have already been logged. */
+    metrics_record(METRIC_CONFIG_PARSE_TIME, metrics_now() - start);
+
+    /* Other threads read the frozen copy and the settings through the
+       published snapshot. */
+    profile_switch(PROFILE_VALIDATE);
+    frozen = cfg_freeze(conftree.root);
+    if (frozen == NULL)
+        exit(EXIT_FAILURE);
+
+    if (cfg_schema_load(frozen, &config) < 0)
         exit(EXIT_FAILURE);
+
+    snapshot = cfgsnap_create(frozen, &config);
+    cfgsnap_publish(snapshot);
+    config_count_load(frozen, start);
+
+    profile_switch(phase);
+
+    config_watch_update();
+}
+
+void reload_config_parse(void)
+{
+    bool changed;
+
+    TRACE_SCOPE("reload_config_parse");
+
+    reload_start = metrics_now();
+    reload_changed = false;
+    reload_frozen = NULL;
+
+    /* Only the files that changed are parsed again. On errors, the
+       current configuration stays. */
+    if (reload_config_file(&conftree, &changed) < 0) {
+        log_print(LOG_ERR, 0, "cannot reload configuration file '%s', "
+                  "keeping the current configuration", config_file);
+        metrics_add(METRIC_CONFIG_ERRORS, 1);
+        return;
     }
 
-    free_conf_tree(conftree);
+    if (!changed)
+        return;
+
+    reload_changed = true;
+    metrics_record(METRIC_CONFIG_PARSE_TIME, metrics_now() - reload_start);
+
+    /* The index refers to the nodes of the previous tree. */
+    cfg_index_free(cfgindex);
+    cfgindex = NULL;
+
+    /* Should the new tree be too large, or its settings be wrong, the
+       previous snapshot, whose frozen copy owns its strings, stays.
+       Readers of the previous snapshot keep it until they are done. */
+    reload_frozen = cfg_freeze(conftree.root);
+    if (reload_frozen != NULL
+        && cfg_schema_load(reload_frozen, &reload_settings) < 0) {
+        log_print(LOG_ERR, 0, "invalid settings in configuration file "
+                  "'%s', keeping the current ones", config_file);
+        cfg_frozen_free(reload_frozen);
+        reload_frozen = NULL;
+    }
+
+    if (reload_frozen == NULL)
+        metrics_add(METRIC_CONFIG_ERRORS, 1);
+
+    if (config_cache)
+        cfgcache_save(config_file, &conftree);
+}
+
+void reload_config_publish(void)
+{
+    TRACE_SCOPE("reload_config_publish");
+
+    if (!reload_changed)
+        return;
+
+    if (reload_frozen != NULL) {
+        snapshot = cfgsnap_create(reload_frozen, &reload_settings);
+        cfgsnap_publish(snapshot);
+        config_count_load(reload_frozen, reload_start);
+    }
+
+    config_watch_update();
+
+    if (reload_frozen != NULL)
+        log_print(LOG_INFO, 0, "configuration file '%s' reloaded",
+                  config_file);
+
+    reload_changed = false;
+    reload_frozen = NULL;
+}
+
+const cfgindex_t *config_index(void)
+{
+    /* Built on first use: the settings are loaded from the frozen copy,
+       and most runs never look directives up by path. */
+    if (cfgindex == NULL)
+        cfgindex = cfg_index_build(conftree.root);
+
+    return cfgindex;
+}
+
+const struct gas_config_t *config_get(void)
+{
+    return &snapshot->config;
+}
+
+int config_watch_fd(void)
+{
+    return cfgwatch != NULL ? cfgwatch_fd(cfgwatch) : -1;
+}
+
+bool config_watch_changed(void)
+{
+    return cfgwatch != NULL && cfgwatch_changed(cfgwatch);
+}
+
+void free_config(void)
+{
+    cfgwatch_free(cfgwatch);
+    cfgwatch = NULL;
+
+    /* No other thread reads the configuration any more. */
+    cfgsnap_publish(NULL);
+    snapshot = NULL;
+
+    cfg_index_free(cfgindex);
+    cfgindex = NULL;
+
+    free_conf_tree(&conftree);
 }
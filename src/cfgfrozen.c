@@ -0,0 +1,267 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "gasconfig.h"
+
+#define LOG_SUBSYSTEM LOG_CONFIG
+#define GAS_ALLOC_TAG GAS_ALLOC_CONFIG
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "log.h"
+#include "cfgtree.h"
+#include "cfgfrozen.h"
+
+/* Frozen configuration under construction. */
+struct cfgfreeze_t {
+    cfgfrozen_t *frozen;
+    size_t nodesize;
+    size_t nargs, argsize;
+    size_t stringalloc;
+
+    /* String offsets by string pointer: interned strings are stored once.
+       An open addressing table, at most half full. */
+    const char **keys;
+    uint32_t *offsets;
+    size_t nkeys, keymask;
+
+    /* Set when an index or offset does not fit in 32 bits. */
+    bool overflow;
+};
+
+static size_t cfgfreeze_slot(const struct cfgfreeze_t *freeze,
+                             const char *string)
+{
+    return gas_hash64(&string, sizeof(string)) & freeze->keymask;
+}
+
+static void cfgfreeze_rehash(struct cfgfreeze_t *freeze)
+{
+    size_t size = freeze->keys ? (freeze->keymask + 1) * 2 : 1024;
+    const char **keys = freeze->keys;
+    uint32_t *offsets = freeze->offsets;
+    size_t oldsize = freeze->keys ? freeze->keymask + 1 : 0, i, j;
+
+    freeze->keys = gas_malloc(size * sizeof(*freeze->keys));
+    memset(freeze->keys, 0, size * sizeof(*freeze->keys));
+    freeze->offsets = gas_malloc(size * sizeof(*freeze->offsets));
+    freeze->keymask = size - 1;
+
+    for (i = 0; i < oldsize; i++) {
+        if (keys[i] == NULL)
+            continue;
+
+        for (j = cfgfreeze_slot(freeze, keys[i]); freeze->keys[j] != NULL;
+             j = (j + 1) & freeze->keymask)
+            ;
+        freeze->keys[j] = keys[i];
+        freeze->offsets[j] = offsets[i];
+    }
+
+    gas_free(keys);
+    gas_free(offsets);
+}
+
+static uint32_t cfgfreeze_string(struct cfgfreeze_t *freeze,
+                                 const char *string)
+{
+    cfgfrozen_t *frozen = freeze->frozen;
+    size_t len, i;
+
+    if ((freeze->nkeys + 1) * 2 > freeze->keymask + 1)
+        cfgfreeze_rehash(freeze);
+
+    for (i = cfgfreeze_slot(freeze, string); freeze->keys[i] != NULL;
+         i = (i + 1) & freeze->keymask) {
+        if (freeze->keys[i] == string)
+            return freeze->offsets[i];
+    }
+
+    len = strlen(string);
+
+    if (frozen->stringsize + len + 1 > UINT32_MAX) {
+        freeze->overflow = true;
+        return 0;
+    }
+
+    while (frozen->stringsize + len + 1 > freeze->stringalloc) {
+        freeze->stringalloc = freeze->stringalloc
+                              ? freeze->stringalloc * 2 : 64 * 1024;
+        frozen->strings = gas_realloc(frozen->strings, freeze->stringalloc);
+    }
+
+    freeze->keys[i] = string;
+    freeze->offsets[i] = frozen->stringsize;
+    freeze->nkeys++;
+
+    memcpy(frozen->strings + frozen->stringsize, string, len + 1);
+    frozen->stringsize += len + 1;
+
+    return freeze->offsets[i];
+}
+
+static uint32_t cfgfreeze_node(struct cfgfreeze_t *freeze,
+                               const directive_t *dir, uint32_t parent,
+                               uint32_t depth)
+{
+    cfgfrozen_t *frozen = freeze->frozen;
+    cfgnode_t *node;
+    uint32_t id;
+    int i;
+
+    if (frozen->count == CFGNODE_NONE - 1
+        || freeze->nargs + dir->argc > UINT32_MAX) {
+        freeze->overflow = true;
+        return CFGNODE_NONE;
+    }
+
+    if (frozen->count == freeze->nodesize) {
+        freeze->nodesize = freeze->nodesize ? freeze->nodesize * 2 : 1024;
+        frozen->nodes = gas_realloc(frozen->nodes,
+                                    freeze->nodesize * sizeof(*frozen->nodes));
+    }
+
+    while (freeze->nargs + dir->argc > freeze->argsize) {
+        freeze->argsize = freeze->argsize ? freeze->argsize * 2 : 1024;
+        frozen->args = gas_realloc(frozen->args,
+                                   freeze->argsize * sizeof(*frozen->args));
+    }
+
+    id = frozen->count++;
+    node = &frozen->nodes[id];
+
+    node->directive = cfgfreeze_string(freeze, dir->directive);
+    node->filename = cfgfreeze_string(freeze, dir->filename);
+    node->linenum = dir->linenum;
+    node->argc = dir->argc;
+    node->args = freeze->nargs;
+    node->parent = parent;
+    node->depth = depth;
+    node->end = id + 1;
+
+    for (i = 0; i < dir->argc; i++)
+        frozen->args[freeze->nargs++] = cfgfreeze_string(freeze,
+                                                         dir->argv[i]);
+
+    return id;
+}
+
+cfgfrozen_t *cfg_freeze(const directive_t *root)
+{
+    struct cfgfreeze_t freeze;
+    cfgfrozen_t *frozen;
+    const directive_t *dir;
+    uint32_t *stack = NULL, depth = 0, stacksize = 0, id;
+
+    frozen = gas_malloc(sizeof(*frozen));
+    memset(frozen, 0, sizeof(*frozen));
+    arena_init(&frozen->values);
+
+    memset(&freeze, 0, sizeof(freeze));
+    freeze.frozen = frozen;
+
+    /* Preorder walk. The stack holds the ids of the enclosing blocks,
+       whose subtrees end when the walk climbs out of them. */
+    for (dir = root; dir != NULL && !freeze.overflow; ) {
+        id = cfgfreeze_node(&freeze, dir, depth ? stack[depth - 1]
+                                                : CFGNODE_NONE, depth);
+
+        if (dir->child != NULL) {
+            if (depth == stacksize) {
+                stacksize = stacksize ? stacksize * 2 : 16;
+                stack = gas_realloc(stack, stacksize * sizeof(*stack));
+            }
+            stack[depth++] = id;
+
+            dir = dir->child;
+            continue;
+        }
+
+        while (dir != NULL && dir->next == NULL) {
+            dir = dir->parent;
+            if (dir != NULL)
+                frozen->nodes[stack[--depth]].end = frozen->count;
+        }
+
+        if (dir != NULL)
+            dir = dir->next;
+    }
+
+    gas_free(stack);
+    gas_free(freeze.keys);
+    gas_free(freeze.offsets);
+
+    if (freeze.overflow) {
+        log_print(LOG_ERR, 0, "configuration too large to freeze");
+        cfg_frozen_free(frozen);
+        return NULL;
+    }
+
+    /* Give back the unused room. */
+    if (frozen->count > 0)
+        frozen->nodes = gas_realloc(frozen->nodes,
+                                    frozen->count * sizeof(*frozen->nodes));
+    if (freeze.nargs > 0)
+        frozen->args = gas_realloc(frozen->args,
+                                   freeze.nargs * sizeof(*frozen->args));
+    if (frozen->stringsize > 0)
+        frozen->strings = gas_realloc(frozen->strings, frozen->stringsize);
+
+    return frozen;
+}
+
+void cfg_frozen_free(cfgfrozen_t *frozen)
+{
+    if (frozen == NULL)
+        return;
+
+    gas_free(frozen->nodes);
+    gas_free(frozen->args);
+    gas_free(frozen->strings);
+    arena_free(&frozen->values);
+    gas_free(frozen);
+}
+
+int cfg_visit(const cfgfrozen_t *frozen, uint32_t id, cfg_visit_t visit,
+              void *arg)
+{
+    uint32_t end;
+    int result;
+
+    if (id == CFGNODE_NONE) {
+        id = 0;
+        end = frozen->count;
+    } else {
+        end = frozen->nodes[id].end;
+    }
+
+    while (id < end) {
+        result = visit(frozen, id, arg);
+        if (result < 0)
+            return result;
+
+        if (result == CFG_VISIT_SKIP)
+            id = frozen->nodes[id].end;
+        else
+            id++;
+    }
+
+    return GAS_SUCCESS;
+}
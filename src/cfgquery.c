@@ -0,0 +1,288 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "gasconfig.h"
+
+#define GAS_ALLOC_TAG GAS_ALLOC_CONFIG
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "common.h"
+#include "cfgtree.h"
+#include "cfgquery.h"
+
+/* Every directive is entered twice: under its parent path, and under its
+   parent node. Both keys are a scope pointer and an interned name; the
+   scope is either an interned path string ("" at the top level) or a
+   directive node, and the two can never be equal. */
+struct cfgindex_entry_t {
+    const void *scope;
+    const char *name;
+
+    size_t count;
+    directive_t **nodes;
+};
+
+struct cfgindex_t {
+    /* Open addressing hash table, at most half full. */
+    struct cfgindex_entry_t *entries;
+    size_t mask;
+
+    /* The node arrays of all entries. */
+    arena_t arena;
+};
+
+static size_t cfg_index_hash(const void *scope, const char *name)
+{
+    uint64_t key[2] = { (uintptr_t)scope, (uintptr_t)name };
+
+    return gas_hash64(key, sizeof(key));
+}
+
+static struct cfgindex_entry_t *cfg_index_slot(const cfgindex_t *index,
+                                               const void *scope,
+                                               const char *name)
+{
+    struct cfgindex_entry_t *entry;
+    size_t i;
+
+    for (i = cfg_index_hash(scope, name) & index->mask; ;
+         i = (i + 1) & index->mask) {
+        entry = &index->entries[i];
+
+        if (entry->name == NULL
+            || (entry->scope == scope && entry->name == name))
+            return entry;
+    }
+}
+
+/* The name a directive is indexed under: blocks without their '<'. */
+static const char *cfg_index_name(const directive_t *dir)
+{
+    if (dir->directive[0] == '<')
+        return gas_intern(dir->directive + 1);
+
+    return dir->directive;
+}
+
+/* Walk the tree in preorder, calling visit for each node with the
+   interned path of its parent. The stack holds the paths of the
+   enclosing blocks. */
+static void cfg_index_walk(cfgindex_t *index, const directive_t *dir,
+                           void (*visit)(cfgindex_t *, const directive_t *,
+                                         const char *, const char *))
+{
+    const char **stack = NULL, *path = "", *name;
+    size_t depth = 0, stacksize = 0;
+    char *buf = NULL;
+    size_t bufsize = 0;
+
+    path = gas_intern(path);
+
+    while (dir != NULL) {
+        name = cfg_index_name(dir);
+
+        visit(index, dir, path, name);
+
+        if (dir->child != NULL) {
+            size_t pathlen = strlen(path), namelen = strlen(name);
+
+            if (depth == stacksize) {
+                stacksize = stacksize ? stacksize * 2 : 16;
+                stack = gas_realloc(stack, stacksize * sizeof(*stack));
+            }
+            stack[depth++] = path;
+
+            if (bufsize < pathlen + namelen + 2) {
+                bufsize = pathlen + namelen + 2;
+                buf = gas_realloc(buf, bufsize);
+            }
+
+            if (pathlen > 0) {
+                memcpy(buf, path, pathlen);
+                buf[pathlen++] = '/';
+            }
+            memcpy(buf + pathlen, name, namelen);
+
+            path = gas_intern_n(buf, pathlen + namelen);
+            dir = dir->child;
+            continue;
+        }
+
+        while (dir != NULL && dir->next == NULL) {
+            dir = dir->parent;
+            if (dir != NULL)
+                path = stack[--depth];
+        }
+
+        if (dir != NULL)
+            dir = dir->next;
+    }
+
+    gas_free(stack);
+    gas_free(buf);
+}
+
+static void cfg_index_claim(cfgindex_t *index, const void *scope,
+                            const char *name)
+{
+    struct cfgindex_entry_t *entry = cfg_index_slot(index, scope, name);
+
+    entry->scope = scope;
+    entry->name = name;
+    entry->count++;
+}
+
+static void cfg_index_count(cfgindex_t *index, const directive_t *dir,
+                            const char *path, const char *name)
+{
+    cfg_index_claim(index, path, name);
+    cfg_index_claim(index, dir->parent, name);
+}
+
+static void cfg_index_add(cfgindex_t *index, const directive_t *dir,
+                          const char *path, const char *name)
+{
+    struct cfgindex_entry_t *entry;
+
+    entry = cfg_index_slot(index, path, name);
+    entry->nodes[entry->count++] = (directive_t *)dir;
+
+    entry = cfg_index_slot(index, dir->parent, name);
+    entry->nodes[entry->count++] = (directive_t *)dir;
+}
+
+cfgindex_t *cfg_index_build(const directive_t *root)
+{
+    cfgindex_t *index;
+    const directive_t *dir;
+    size_t nnodes = 0, size = 16, i;
+
+    /* Count the nodes to size the table: at most two keys each. */
+    for (dir = root; dir != NULL; ) {
+        nnodes++;
+
+        if (dir->child != NULL) {
+            dir = dir->child;
+            continue;
+        }
+
+        while (dir != NULL && dir->next == NULL)
+            dir = dir->parent;
+        if (dir != NULL)
+            dir = dir->next;
+    }
+
+    while (size < nnodes * 4)
+        size *= 2;
+
+    index = gas_malloc(sizeof(*index));
+    index->entries = gas_malloc(size * sizeof(*index->entries));
+    memset(index->entries, 0, size * sizeof(*index->entries));
+    index->mask = size - 1;
+    arena_init(&index->arena);
+
+    /* First pass: create the entries and count their nodes. */
+    cfg_index_walk(index, root, cfg_index_count);
+
+    /* Second pass: fill the node arrays, in file order. */
+    for (i = 0; i < size; i++) {
+        struct cfgindex_entry_t *entry = &index->entries[i];
+
+        if (entry->name == NULL)
+            continue;
+
+        entry->nodes = arena_alloc(&index->arena,
+                                   entry->count * sizeof(*entry->nodes));
+        entry->count = 0;
+    }
+
+    cfg_index_walk(index, root, cfg_index_add);
+
+    return index;
+}
+
+void cfg_index_free(cfgindex_t *index)
+{
+    if (index == NULL)
+        return;
+
+    arena_free(&index->arena);
+    gas_free(index->entries);
+    gas_free(index);
+}
+
+static size_t cfg_index_find(const cfgindex_t *index, const void *scope,
+                             const char *name, size_t namelen,
+                             directive_t *const **nodes)
+{
+    const struct cfgindex_entry_t *entry;
+
+    /* A name that was never interned is in no configuration. */
+    name = gas_intern_find(name, namelen);
+    if (name == NULL)
+        goto find_none;
+
+    entry = cfg_index_slot(index, scope, name);
+    if (entry->name == NULL)
+        goto find_none;
+
+    *nodes = entry->nodes;
+    return entry->count;
+
+find_none:
+    *nodes = NULL;
+    return 0;
+}
+
+size_t cfg_find_all(const cfgindex_t *index, const char *path,
+                    directive_t *const **nodes)
+{
+    const char *name = strrchr(path, '/'), *scope;
+
+    if (name == NULL) {
+        scope = gas_intern_find("", 0);
+        name = path;
+    } else {
+        scope = gas_intern_find(path, name - path);
+        name++;
+    }
+
+    if (scope == NULL) {
+        *nodes = NULL;
+        return 0;
+    }
+
+    return cfg_index_find(index, scope, name, strlen(name), nodes);
+}
+
+directive_t *cfg_find(const cfgindex_t *index, const char *path)
+{
+    directive_t *const *nodes;
+
+    if (cfg_find_all(index, path, &nodes) == 0)
+        return NULL;
+
+    return nodes[0];
+}
+
+size_t cfg_find_children(const cfgindex_t *index, const directive_t *block,
+                         const char *name, directive_t *const **nodes)
+{
+    return cfg_index_find(index, block, name, strlen(name), nodes);
+}
@@ -0,0 +1,237 @@
+# Compile the directive schema into a perfect hash dispatcher.
+# Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+# Usage: awk -f cfgschema.awk cfgschema.tab > cfgschema-table.c
+#
+# The table is a perfect hash built by hash and displace. The names are
+# split into buckets by their hash with seed 0; then, largest bucket
+# first, each bucket gets the first seed that sends all its names to
+# free slots. A lookup hashes the name twice, once for its bucket and
+# once with the seed of the bucket for its slot, and compares one
+# string. Only POSIX awk is used: every intermediate value fits a double
+# exactly.
+
+function fail(msg)
+{
+    printf "%s:%d: %s\n", FILENAME, FNR, msg > "/dev/stderr"
+    failed = 1
+    exit 1
+}
+
+# The name as it appears in the tree: blocks keep their '<' only.
+function tree_name(name)
+{
+    sub(/>$/, "", name)
+    return name
+}
+
+# h * 2654435761 modulo 2^32, in two halves to stay exact.
+function mul(h,    lo, hi)
+{
+    lo = h % 65536
+    hi = int(h / 65536)
+    return (lo * 2654435761 + (hi * 2654435761) % 65536 * 65536) \
+        % 4294967296
+}
+
+# Must match cfg_schema_hash() below.
+function hash(name, seed,    h, i)
+{
+    h = mul(seed + 1)
+    for (i = 1; i <= length(name); i++)
+        h = (h * 31 + ord[substr(name, i, 1)]) % 4294967296
+    return int(mul(h) / 65536)
+}
+
+# Find the seed of bucket b; return 0 if there is none.
+function place(b,    seed, k, s, used)
+{
+    for (seed = 1; seed < 65536; seed++) {
+        split("", used)
+        for (k = 0; k < bucketsize[b]; k++) {
+            s = hash(names[bucket[b, k]], seed) % size
+            if ((s in slots) || (s in used))
+                break
+            used[s] = bucket[b, k]
+        }
+        if (k == bucketsize[b]) {
+            for (s in used)
+                slots[s] = used[s]
+            seeds[b] = seed
+            return 1
+        }
+    }
+    return 0
+}
+
+# Build the table for the current size; return 0 if it does not fit.
+function build(    b, i, k)
+{
+    nbuckets = size > 1 ? size / 2 : 1
+    split("", bucket)
+    split("", bucketsize)
+    split("", seeds)
+    split("", slots)
+
+    for (b = 0; b < nbuckets; b++)
+        bucketsize[b] = 0
+    for (i = 0; i < n; i++) {
+        b = hash(names[i], 0) % nbuckets
+        bucket[b, bucketsize[b]++] = i
+    }
+
+    for (k = n; k > 0; k--) {
+        for (b = 0; b < nbuckets; b++) {
+            if (bucketsize[b] == k && !place(b))
+                return 0
+        }
+    }
+
+    return 1
+}
+
+BEGIN {
+    for (i = 1; i < 128; i++)
+        ord[sprintf("%c", i)] = i
+
+    split("int size duration bool path level", typelist, " ")
+    for (i in typelist)
+        types[typelist[i]] = "CFGTYPE_" toupper(typelist[i])
+
+    n = 0
+    nargs = 0
+}
+
+/^[ \t]*(#|$)/ {
+    next
+}
+
+{
+    if (NF < 2)
+        fail("missing parent block")
+
+    if ($1 !~ /^(<[A-Za-z][A-Za-z0-9]*>|[A-Za-z][A-Za-z0-9]*)$/)
+        fail("invalid directive name '" $1 "'")
+    if ($2 != "-" && $2 !~ /^<[A-Za-z][A-Za-z0-9]*>$/)
+        fail("invalid parent block '" $2 "'")
+
+    name = tree_name($1)
+    if (name in seen)
+        fail("duplicate directive '" $1 "'")
+    seen[name] = 1
+
+    names[n] = name
+    parents[n] = $2 == "-" ? "NULL" : "\"" tree_name($2) "\""
+    firstarg[n] = nargs
+    argcs[n] = NF - 2
+
+    for (i = 3; i <= NF; i++) {
+        if (split($i, pair, ":") != 2 || !(pair[1] in types) \
+            || pair[2] !~ /^[a-z_][a-z0-9_.]*(\[[A-Z0-9_]+\])?$/)
+            fail("invalid argument '" $i "'")
+
+        argtypes[nargs] = types[pair[1]]
+        argfields[nargs] = pair[2]
+        nargs++
+    }
+
+    n++
+}
+
+END {
+    if (failed)
+        exit 1
+
+    for (size = 1; size < n; size *= 2)
+        ;
+    while (!build())
+        size *= 2
+
+    print "/* Generated by cfgschema.awk from cfgschema.tab. Do not edit. */"
+    print ""
+    print "#include \"gasconfig.h\""
+    print ""
+    print "#include <stddef.h>"
+    print "#include <stdint.h>"
+    print "#include <string.h>"
+    print ""
+    print "#include \"cfgschema.h\""
+    print ""
+
+    if (nargs > 0) {
+        print "static const struct cfgschema_arg_t cfg_schema_args[] = {"
+        for (i = 0; i < nargs; i++)
+            printf "    { %s, offsetof(struct gas_config_t, %s) },\n", \
+                argtypes[i], argfields[i]
+        print "};"
+        print ""
+
+        # The fields must have the C type of their schema type.
+        for (i = 0; i < nargs; i++)
+            printf "_Static_assert(_Generic(((struct gas_config_t *)0)->%s,\n" \
+                "                        %s: 1, default: 0),\n" \
+                "               \"%s is not of type %s\");\n", \
+                argfields[i], "CFGTYPE_C_" substr(argtypes[i], 9), \
+                argfields[i], tolower(substr(argtypes[i], 9))
+        print ""
+    }
+
+    print "static const struct cfgschema_t cfg_schema_entries[] = {"
+    for (i = 0; i < n; i++)
+        printf "    { \"%s\", %s, %d, %s },\n", names[i], parents[i], \
+            argcs[i], \
+            (argcs[i] ? "&cfg_schema_args[" firstarg[i] "]" : "NULL")
+    print "};"
+    print ""
+
+    printf "#define CFG_SCHEMA_BUCKETS %d\n", nbuckets
+    printf "#define CFG_SCHEMA_SIZE %d\n", size
+    print ""
+    print "static const uint16_t cfg_schema_seeds[CFG_SCHEMA_BUCKETS] = {"
+    for (i = 0; i < nbuckets; i++)
+        printf "    %d,\n", seeds[i]
+    print "};"
+    print ""
+    print "static const short cfg_schema_slots[CFG_SCHEMA_SIZE] = {"
+    for (i = 0; i < size; i++)
+        printf "    %d,\n", (i in slots) ? slots[i] : -1
+    print "};"
+    print ""
+    print "static uint32_t cfg_schema_hash(const char *name, uint32_t seed)"
+    print "{"
+    print "    uint32_t h = (seed + 1) * 2654435761u;"
+    print ""
+    print "    for (; *name != '\\0'; name++)"
+    print "        h = h * 31 + (unsigned char)*name;"
+    print ""
+    print "    return (h * 2654435761u) >> 16;"
+    print "}"
+    print ""
+    print "const struct cfgschema_t *cfg_schema_find(const char *name)"
+    print "{"
+    print "    uint32_t seed;"
+    print "    int i;"
+    print ""
+    print "    seed = cfg_schema_seeds[cfg_schema_hash(name, 0)"
+    print "                            % CFG_SCHEMA_BUCKETS];"
+    print "    i = cfg_schema_slots[cfg_schema_hash(name, seed)"
+    print "                         % CFG_SCHEMA_SIZE];"
+    print "    if (i < 0 || strcmp(cfg_schema_entries[i].name, name) != 0)"
+    print "        return NULL;"
+    print ""
+    print "    return &cfg_schema_entries[i];"
+    print "}"
+}
@@ -0,0 +1,350 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+
+#include "gasconfig.h"
+
+#define LOG_SUBSYSTEM LOG_CONFIG
+#define GAS_ALLOC_TAG GAS_ALLOC_CONFIG
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "common.h"
+#include "log.h"
+#include "cfgfrozen.h"
+#include "cfgschema.h"
+
+static const struct gas_config_t cfg_schema_default = {
+    .reload = {
+        .delay = 200,
+        .watch = true
+    },
+    .workers = {
+        .threads = 0,
+        .queue_size = 1024
+    },
+    .control = {
+        .socket = NULL
+    },
+    .log = {
+        .async = false,
+        .buffer_size = 256 * 1024,
+        .block_when_full = false,
+        .binary_file = NULL,
+        .to_stderr = true,
+        .stderr_level = LOG_DEBUG,
+        .file = NULL,
+        .file_level = LOG_DEBUG,
+        .to_syslog = false,
+        .syslog_level = LOG_DEBUG,
+        .level = LOG_INFO,
+        .levels = {
+            [LOG_CORE] = -1,
+            [LOG_CONFIG] = -1,
+            [LOG_PARSER] = -1
+        },
+        .rate = 0,
+        .burst = 10,
+        .rates = { -1, -1, -1, -1, -1, -1, -1, -1 },
+        .bursts = { -1, -1, -1, -1, -1, -1, -1, -1 },
+        .repeat_window = 0,
+        .repeat_windows = { -1, -1, -1, -1, -1, -1, -1, -1 }
+    }
+};
+
+static const char *const cfg_type_names[] = {
+    [CFGTYPE_INT] = "integer",
+    [CFGTYPE_SIZE] = "size",
+    [CFGTYPE_DURATION] = "duration",
+    [CFGTYPE_BOOL] = "boolean",
+    [CFGTYPE_PATH] = "path",
+    [CFGTYPE_LEVEL] = "log level"
+};
+
+static int parse_int(const char *s, int *value)
+{
+    char *end;
+    long n;
+
+    errno = 0;
+    n = strtol(s, &end, 10);
+    if (end == s || *end != '\0' || errno != 0 || n < INT_MIN || n > INT_MAX)
+        return -GAS_FAILURE;
+
+    *value = n;
+    return GAS_SUCCESS;
+}
+
+/* A decimal number without sign; end is set to what follows it. */
+static int parse_number(const char *s, unsigned long long *value,
+                        const char **end)
+{
+    char *p;
+
+    if (*s < '0' || *s > '9')
+        return -GAS_FAILURE;
+
+    errno = 0;
+    *value = strtoull(s, &p, 10);
+    if (errno != 0)
+        return -GAS_FAILURE;
+
+    *end = p;
+    return GAS_SUCCESS;
+}
+
+static int parse_size(const char *s, size_t *value)
+{
+    unsigned long long n;
+    const char *unit;
+    int shift;
+
+    if (parse_number(s, &n, &unit) < 0)
+        return -GAS_FAILURE;
+
+    switch (*unit) {
+    case '\0':           shift = 0;  break;
+    case 'k': case 'K':  shift = 10; break;
+    case 'm': case 'M':  shift = 20; break;
+    case 'g': case 'G':  shift = 30; break;
+    case 't': case 'T':  shift = 40; break;
+    default:
+        return -GAS_FAILURE;
+    }
+
+    if (*unit != '\0' && unit[1] != '\0')
+        return -GAS_FAILURE;
+
+    if (n > SIZE_MAX >> shift)
+        return -GAS_FAILURE;
+
+    *value = (size_t)n << shift;
+    return GAS_SUCCESS;
+}
+
+static int parse_duration(const char *s, long *value)
+{
+    static const struct {
+        const char *unit;
+        long ms;
+    } units[] = {
+        { "ms", 1 },
+        { "", 1000 },
+        { "s", 1000 },
+        { "m", 60 * 1000 },
+        { "h", 60 * 60 * 1000 },
+        { "d", 24 * 60 * 60 * 1000 }
+    };
+    unsigned long long n;
+    const char *unit;
+    size_t i;
+
+    if (parse_number(s, &n, &unit) < 0)
+        return -GAS_FAILURE;
+
+    for (i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+        if (strcmp(unit, units[i].unit) != 0)
+            continue;
+
+        if (n > (unsigned long long)(LONG_MAX / units[i].ms))
+            return -GAS_FAILURE;
+
+        *value = (long)n * units[i].ms;
+        return GAS_SUCCESS;
+    }
+
+    return -GAS_FAILURE;
+}
+
+static int parse_bool(const char *s, bool *value)
+{
+    static const char *const words[][2] = {
+        { "off", "on" },
+        { "no", "yes" },
+        { "false", "true" },
+        { "0", "1" }
+    };
+    size_t i;
+    int j;
+
+    for (i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        for (j = 0; j < 2; j++) {
+            if (strcasecmp(s, words[i][j]) == 0) {
+                *value = j;
+                return GAS_SUCCESS;
+            }
+        }
+    }
+
+    return -GAS_FAILURE;
+}
+
+/* Relative paths are relative to the directory of the file they are
+   given in. Paths are not interned: a reload may change them at will.
+   They point into the frozen copy, or are resolved into its values
+   arena. */
+static int parse_path(const char *s, const char *filename,
+                      arena_t *values, const char **value)
+{
+    const char *slash;
+    size_t dirlen, len;
+    char *buf;
+
+    if (*s == '\0')
+        return -GAS_FAILURE;
+
+    slash = strrchr(filename, '/');
+    if (*s == '/' || slash == NULL) {
+        *value = s;
+        return GAS_SUCCESS;
+    }
+
+    dirlen = slash - filename + 1;
+    len = strlen(s);
+    buf = arena_alloc(values, dirlen + len + 1);
+    memcpy(buf, filename, dirlen);
+    memcpy(buf + dirlen, s, len + 1);
+
+    *value = buf;
+    return GAS_SUCCESS;
+}
+
+static int parse_level(const char *s, int *value)
+{
+    int level = log_level_find(s);
+
+    if (level < 0)
+        return -GAS_FAILURE;
+
+    *value = level;
+    return GAS_SUCCESS;
+}
+
+static int cfg_schema_convert(const struct cfgschema_arg_t *arg,
+                              const char *s, const char *filename,
+                              arena_t *values, struct gas_config_t *config)
+{
+    void *field = (char *)config + arg->offset;
+
+    switch (arg->type) {
+    case CFGTYPE_INT:
+        return parse_int(s, field);
+    case CFGTYPE_SIZE:
+        return parse_size(s, field);
+    case CFGTYPE_DURATION:
+        return parse_duration(s, field);
+    case CFGTYPE_BOOL:
+        return parse_bool(s, field);
+    case CFGTYPE_PATH:
+        return parse_path(s, filename, values, field);
+    case CFGTYPE_LEVEL:
+        return parse_level(s, field);
+    }
+
+    return -GAS_FAILURE;
+}
+
+struct cfg_schema_load_t {
+    struct gas_config_t config;
+    arena_t *values;
+    bool failed;
+};
+
+static int cfg_schema_visit(const cfgfrozen_t *frozen, uint32_t id,
+                            void *arg)
+{
+    struct cfg_schema_load_t *load = arg;
+    const cfgnode_t *node = &frozen->nodes[id];
+    const struct cfgschema_t *schema;
+    const char *name = cfg_node_name(frozen, id);
+    const char *filename = cfg_node_filename(frozen, id);
+    const char *parent, *value;
+    int i;
+
+    schema = cfg_schema_find(name);
+    if (schema == NULL) {
+        log_print(LOG_ERR, 0, "unknown directive '%s' in file '%s' "
+                  "at line %d", name, filename, node->linenum);
+        goto visit_failed;
+    }
+
+    parent = node->parent == CFGNODE_NONE
+             ? NULL : cfg_node_name(frozen, node->parent);
+    if (parent == NULL ? schema->parent != NULL
+        : schema->parent == NULL || strcmp(parent, schema->parent) != 0) {
+        if (schema->parent == NULL)
+            log_print(LOG_ERR, 0, "directive '%s' in file '%s' at line %d "
+                      "is only allowed at the top level", name, filename,
+                      node->linenum);
+        else
+            log_print(LOG_ERR, 0, "directive '%s' in file '%s' at line %d "
+                      "is only allowed in %s>", name, filename,
+                      node->linenum, schema->parent);
+        goto visit_failed;
+    }
+
+    if ((int)node->argc != schema->argc) {
+        log_print(LOG_ERR, 0, "directive '%s' in file '%s' at line %d "
+                  "takes %d argument%s", name, filename, node->linenum,
+                  schema->argc, schema->argc == 1 ? "" : "s");
+        goto visit_failed;
+    }
+
+    /* A directive given twice: the last one wins. */
+    for (i = 0; i < schema->argc; i++) {
+        value = cfg_node_arg(frozen, id, i);
+
+        if (cfg_schema_convert(&schema->args[i], value, filename,
+                               load->values, &load->config) < 0) {
+            log_print(LOG_ERR, 0, "invalid %s '%s' for directive '%s' "
+                      "in file '%s' at line %d",
+                      cfg_type_names[schema->args[i].type], value, name,
+                      filename, node->linenum);
+            load->failed = true;
+        }
+    }
+
+    return GAS_SUCCESS;
+
+visit_failed:
+    /* The directives inside a block that is wrong would only add
+       errors. */
+    load->failed = true;
+    return CFG_VISIT_SKIP;
+}
+
+int cfg_schema_load(cfgfrozen_t *frozen, struct gas_config_t *config)
+{
+    struct cfg_schema_load_t load;
+
+    load.config = cfg_schema_default;
+    load.values = &frozen->values;
+    load.failed = false;
+
+    cfg_visit(frozen, CFGNODE_NONE, cfg_schema_visit, &load);
+
+    if (load.failed)
+        return -GAS_FAILURE;
+
+    *config = load.config;
+    return GAS_SUCCESS;
+}
@@ -0,0 +1,222 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+
+#include "gasconfig.h"
+
+#define GAS_ALLOC_TAG GAS_ALLOC_CONFIG
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "log.h"
+#include "cfgfrozen.h"
+#include "cfgschema.h"
+#include "cfgsnap.h"
+
+/* Epoch based reclamation. The epoch is bumped every time a snapshot is
+   replaced, and the replaced snapshot is tagged with the new epoch. A
+   thread entering a read section records the epoch it saw; if every
+   thread in a read section recorded the tag of a snapshot or a later
+   epoch, they all entered after the snapshot was replaced and none of
+   them can be using it. */
+
+/* A thread that entered a read section. Each one has its own cache
+   line, the only memory a thread writes to enter or leave a section. */
+struct cfgsnap_reader_t {
+    struct gas_thread_record_t record;
+
+    /* The epoch the thread entered its read section in, 0 outside read
+       sections. */
+    atomic_uint_least64_t epoch;
+};
+
+static _Atomic(struct cfgsnap_t *) current = NULL;
+static atomic_uint_least64_t epoch = 1;
+
+static void cfgsnap_reader_release(struct gas_thread_record_t *record);
+
+/* The records of the threads that entered a read section. The lock is
+   only taken when a thread enters its first read section or exits, and
+   by the publishing thread. */
+static struct gas_thread_registry_t readers =
+    GAS_THREAD_REGISTRY_INIT(struct cfgsnap_reader_t, NULL,
+                             cfgsnap_reader_release);
+
+static _Thread_local struct cfgsnap_reader_t *reader = NULL;
+static _Thread_local unsigned int nesting = 0;
+
+/* Replaced snapshots not freed yet. Only the publishing thread uses
+   the list. */
+static struct cfgsnap_t *retired = NULL;
+
+/* There is a new snapshot on every reload. */
+static gas_pool_t *snap_pool;
+static pthread_once_t snap_pool_once = PTHREAD_ONCE_INIT;
+
+static void cfgsnap_pool_create(void)
+{
+    snap_pool = gas_pool_create(struct cfgsnap_t);
+}
+
+struct cfgsnap_t *cfgsnap_create(cfgfrozen_t *frozen,
+                                 const struct gas_config_t *config)
+{
+    struct cfgsnap_t *snap;
+
+    pthread_once(&snap_pool_once, cfgsnap_pool_create);
+    snap = gas_pool_alloc(snap_pool);
+    snap->config = *config;
+    snap->frozen = frozen;
+    atomic_init(&snap->refs, 0);
+    snap->retired = 0;
+    snap->next = NULL;
+
+    return snap;
+}
+
+static void cfgsnap_free(struct cfgsnap_t *snap)
+{
+    cfg_frozen_free(snap->frozen);
+    gas_pool_free(snap_pool, snap);
+}
+
+static void cfgsnap_reader_release(struct gas_thread_record_t *record)
+{
+    struct cfgsnap_reader_t *exiting = (struct cfgsnap_reader_t *)record;
+
+    atomic_store_explicit(&exiting->epoch, 0, memory_order_release);
+    reader = NULL;
+}
+
+static struct cfgsnap_reader_t *cfgsnap_reader_register(void)
+{
+    struct cfgsnap_reader_t *record = gas_thread_record_take(&readers);
+
+    if (record == NULL) {
+        log_print(LOG_CRIT, 0, "memory exhausted");
+        exit(EXIT_FAILURE);
+    }
+
+    return record;
+}
+
+const struct cfgsnap_t *cfgsnap_read_lock(void)
+{
+    if (nesting++ == 0) {
+        if (reader == NULL)
+            reader = cfgsnap_reader_register();
+
+        atomic_store_explicit(&reader->epoch,
+                              atomic_load_explicit(&epoch,
+                                                   memory_order_relaxed),
+                              memory_order_relaxed);
+
+        /* Pairs with the fence in cfgsnap_oldest_reader(): either the
+           publisher sees this epoch, or this thread sees the snapshot
+           published before the epoch was bumped. */
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+
+    return atomic_load_explicit(&current, memory_order_acquire);
+}
+
+void cfgsnap_read_unlock(void)
+{
+    if (--nesting == 0)
+        atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+
+void cfgsnap_ref(const struct cfgsnap_t *snap)
+{
+    struct cfgsnap_t *s = (struct cfgsnap_t *)snap;
+
+    atomic_fetch_add_explicit(&s->refs, 1, memory_order_relaxed);
+}
+
+void cfgsnap_unref(const struct cfgsnap_t *snap)
+{
+    struct cfgsnap_t *s = (struct cfgsnap_t *)snap;
+
+    atomic_fetch_sub_explicit(&s->refs, 1, memory_order_release);
+}
+
+/* The oldest epoch a thread in a read section entered in, or
+   UINT64_MAX if there is no such thread. */
+static uint64_t cfgsnap_oldest_reader(void)
+{
+    struct gas_thread_record_t *record;
+    uint64_t oldest = UINT64_MAX, e;
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    pthread_mutex_lock(&readers.lock);
+
+    for (record = readers.records; record != NULL; record = record->next) {
+        e = atomic_load_explicit(&((struct cfgsnap_reader_t *)record)->epoch,
+                                 memory_order_acquire);
+        if (e != 0 && e < oldest)
+            oldest = e;
+    }
+
+    pthread_mutex_unlock(&readers.lock);
+
+    return oldest;
+}
+
+bool cfgsnap_reclaim(void)
+{
+    struct cfgsnap_t **p, *snap;
+    uint64_t oldest;
+
+    if (retired == NULL)
+        return false;
+
+    oldest = cfgsnap_oldest_reader();
+
+    for (p = &retired; (snap = *p) != NULL; ) {
+        if (snap->retired <= oldest
+            && atomic_load_explicit(&snap->refs, memory_order_acquire) == 0) {
+            *p = snap->next;
+            cfgsnap_free(snap);
+        } else {
+            p = &snap->next;
+        }
+    }
+
+    return retired != NULL;
+}
+
+void cfgsnap_publish(struct cfgsnap_t *snap)
+{
+    struct cfgsnap_t *old;
+
+    old = atomic_exchange_explicit(&current, snap, memory_order_seq_cst);
+
+    if (old != NULL) {
+        old->retired = atomic_fetch_add_explicit(&epoch, 1,
+                                                 memory_order_seq_cst) + 1;
+        old->next = retired;
+        retired = old;
+    }
+
+    cfgsnap_reclaim();
+}
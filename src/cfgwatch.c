@@ -0,0 +1,248 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "gasconfig.h"
+
+#define LOG_SUBSYSTEM LOG_CONFIG
+#define GAS_ALLOC_TAG GAS_ALLOC_CONFIG
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "common.h"
+#include "log.h"
+#include "cfgtree.h"
+#include "cfgwatch.h"
+
+/* The events that can change what a directory holds. */
+#define CFGWATCH_EVENTS \
+    (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+/* A watched directory. */
+struct cfgwatch_dir_t {
+    /* The interned directory name. */
+    const char *dirname;
+    int wd;
+
+    /* Whether any change in the directory counts, because an Include
+       pattern is expanded in it. */
+    bool any;
+};
+
+/* A watched file: a name in a watched directory. */
+struct cfgwatch_file_t {
+    int wd;
+    const char *name;
+};
+
+struct cfgwatch_t {
+    int fd;
+
+    struct cfgwatch_dir_t *dirs;
+    size_t ndirs;
+
+    struct cfgwatch_file_t *files;
+    size_t nfiles;
+};
+
+cfgwatch_t *cfgwatch_create(void)
+{
+    cfgwatch_t *watch;
+    int fd;
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        log_print(LOG_WARNING, errno, "cannot watch configuration files");
+        return NULL;
+    }
+
+    watch = gas_malloc(sizeof(*watch));
+    memset(watch, 0, sizeof(*watch));
+    watch->fd = fd;
+
+    return watch;
+}
+
+static void cfgwatch_clear(cfgwatch_t *watch)
+{
+    size_t i;
+
+    for (i = 0; i < watch->ndirs; i++)
+        inotify_rm_watch(watch->fd, watch->dirs[i].wd);
+
+    gas_free(watch->dirs);
+    gas_free(watch->files);
+
+    watch->dirs = NULL;
+    watch->ndirs = 0;
+    watch->files = NULL;
+    watch->nfiles = 0;
+}
+
+void cfgwatch_free(cfgwatch_t *watch)
+{
+    if (watch == NULL)
+        return;
+
+    cfgwatch_clear(watch);
+    close(watch->fd);
+    gas_free(watch);
+}
+
+int cfgwatch_fd(const cfgwatch_t *watch)
+{
+    return watch->fd;
+}
+
+/* Watch a directory, once, and return its watch descriptor. */
+static int cfgwatch_add_dir(cfgwatch_t *watch, const char *dirname,
+                            size_t len, bool any)
+{
+    struct cfgwatch_dir_t *dir;
+    size_t i;
+    int wd;
+
+    dirname = len > 0 ? gas_intern_n(dirname, len) : gas_intern(".");
+
+    for (i = 0; i < watch->ndirs; i++) {
+        dir = &watch->dirs[i];
+
+        if (dir->dirname == dirname) {
+            dir->any = dir->any || any;
+            return dir->wd;
+        }
+    }
+
+    wd = inotify_add_watch(watch->fd, dirname, CFGWATCH_EVENTS);
+    if (wd < 0) {
+        log_print(LOG_WARNING, errno, "cannot watch directory '%s'",
+                  dirname);
+        return -GAS_FAILURE;
+    }
+
+    dir = &watch->dirs[watch->ndirs++];
+    dir->dirname = dirname;
+    dir->wd = wd;
+    dir->any = any;
+
+    return wd;
+}
+
+int cfgwatch_update(cfgwatch_t *watch, const conftree_t *conftree)
+{
+    const struct conf_file_t *file;
+    size_t count = 0;
+    int result = GAS_SUCCESS;
+
+    cfgwatch_clear(watch);
+
+    for (file = conftree->files; file != NULL; file = file->next)
+        count++;
+
+    watch->dirs = gas_malloc(count * sizeof(*watch->dirs));
+    watch->files = gas_malloc(count * sizeof(*watch->files));
+
+    for (file = conftree->files; file != NULL; file = file->next) {
+        const char *slash = strrchr(file->filename, '/');
+        struct cfgwatch_file_t *watched;
+        int wd;
+
+        if (file->directory) {
+            if (cfgwatch_add_dir(watch, file->filename,
+                                 strlen(file->filename), true) < 0)
+                result = -GAS_FAILURE;
+            continue;
+        }
+
+        if (slash == NULL)
+            wd = cfgwatch_add_dir(watch, NULL, 0, false);
+        else if (slash == file->filename)
+            wd = cfgwatch_add_dir(watch, "/", 1, false);
+        else
+            wd = cfgwatch_add_dir(watch, file->filename,
+                                  slash - file->filename, false);
+
+        if (wd < 0) {
+            result = -GAS_FAILURE;
+            continue;
+        }
+
+        watched = &watch->files[watch->nfiles++];
+        watched->wd = wd;
+        watched->name = slash != NULL ? slash + 1 : file->filename;
+    }
+
+    return result;
+}
+
+/* Whether an event concerns the configuration. */
+static bool cfgwatch_match(const cfgwatch_t *watch,
+                           const struct inotify_event *event)
+{
+    size_t i;
+
+    /* Events were lost: anything may have changed. */
+    if (event->mask & IN_Q_OVERFLOW)
+        return true;
+
+    for (i = 0; i < watch->ndirs; i++) {
+        if (watch->dirs[i].wd == event->wd && watch->dirs[i].any)
+            return true;
+    }
+
+    if (event->len == 0)
+        return false;
+
+    for (i = 0; i < watch->nfiles; i++) {
+        if (watch->files[i].wd == event->wd
+            && strcmp(watch->files[i].name, event->name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+bool cfgwatch_changed(cfgwatch_t *watch)
+{
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    bool changed = false;
+    ssize_t len;
+    char *p;
+
+    for (;;) {
+        len = read(watch->fd, buf, sizeof(buf));
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            break;
+
+        for (p = buf; p < buf + len;
+             p += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *)p;
+
+            if (!changed && cfgwatch_match(watch, event))
+                changed = true;
+        }
+    }
+
+    return changed;
+}
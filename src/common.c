@@ -17,11 +17,18 @@
 #include "gasconfig.h"
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include "log.h"
 #include "common.h"
+#include "allocstats.h"
+
+_Thread_local uint64_t gas_alloc_count = 0;
 
 static void gas_alloc_die(void)
 {
@@ -29,28 +36,775 @@ static void gas_alloc_die(void)
     exit(EXIT_FAILURE);
 }
 
-void *gas_malloc(size_t n)
+#ifdef GAS_ALLOC_STATS
+
+/* With allocation statistics, every block starts with a header, right
+   before the pointer returned, giving its size and tag for gas_free()
+   and gas_realloc(). It takes ALLOC_HEADER_SIZE bytes, so that the
+   pointer keeps the alignment of malloc(), or the alignment asked for
+   by gas_aligned_alloc(). */
+struct alloc_header_t {
+    size_t size;
+
+    /* From the start of the block to the pointer. */
+    uint32_t offset;
+    uint32_t tag;
+};
+
+#define ALLOC_HEADER_SIZE                                               \
+    ((sizeof(struct alloc_header_t) + _Alignof(max_align_t) - 1)        \
+     & ~(_Alignof(max_align_t) - 1))
+
+static void *gas_alloc_init(char *block, size_t offset, size_t n,
+                            enum gas_alloc_tag_t tag)
+{
+    struct alloc_header_t *header;
+
+    header = (struct alloc_header_t *)(block + offset) - 1;
+    header->size = n;
+    header->offset = offset;
+    header->tag = tag;
+
+    gas_alloc_count++;
+    alloc_stats_add(tag, n);
+
+    return block + offset;
+}
+
+static struct alloc_header_t *gas_alloc_header(void *p)
+{
+    return (struct alloc_header_t *)p - 1;
+}
+
+void *gas_malloc_tag(size_t n, enum gas_alloc_tag_t tag)
+{
+    char *block = malloc(ALLOC_HEADER_SIZE + n);
+    if (!block)
+        gas_alloc_die();
+    return gas_alloc_init(block, ALLOC_HEADER_SIZE, n, tag);
+}
+
+void *gas_realloc_tag(void *p, size_t n, enum gas_alloc_tag_t tag)
+{
+    struct alloc_header_t *header;
+    char *block;
+
+    if (p == NULL)
+        return gas_malloc_tag(n, tag);
+
+    header = gas_alloc_header(p);
+    tag = header->tag;
+    alloc_stats_sub(tag, header->size);
+
+    block = realloc((char *)p - ALLOC_HEADER_SIZE, ALLOC_HEADER_SIZE + n);
+    if (!block)
+        gas_alloc_die();
+    return gas_alloc_init(block, ALLOC_HEADER_SIZE, n, tag);
+}
+
+void *gas_aligned_alloc_tag(size_t alignment, size_t n,
+                            enum gas_alloc_tag_t tag)
+{
+    size_t offset = alignment > ALLOC_HEADER_SIZE
+                    ? alignment : ALLOC_HEADER_SIZE;
+    char *block;
+
+    block = aligned_alloc(alignment,
+                          (offset + n + alignment - 1) & ~(alignment - 1));
+    if (!block)
+        gas_alloc_die();
+    return gas_alloc_init(block, offset, n, tag);
+}
+
+void gas_free(void *p)
+{
+    struct alloc_header_t *header;
+
+    if (p == NULL)
+        return;
+
+    header = gas_alloc_header(p);
+    alloc_stats_sub(header->tag, header->size);
+    free((char *)p - header->offset);
+}
+
+#else  /* !GAS_ALLOC_STATS */
+
+void *gas_malloc_tag(size_t n, enum gas_alloc_tag_t tag)
 {
     void *p = malloc(n);
+    (void)tag;
     if (!p)
         gas_alloc_die();
+    gas_alloc_count++;
     return p;
 }
 
-void *gas_realloc(void *p, size_t n)
+void *gas_realloc_tag(void *p, size_t n, enum gas_alloc_tag_t tag)
 {
     void *r = realloc(p, n);
+    (void)tag;
     if (!r && n)
         gas_alloc_die();
+    gas_alloc_count++;
     return r;
 }
 
-char *gas_strdup(const char *string)
+/* n is rounded up to a multiple of alignment, as aligned_alloc()
+   requires. */
+void *gas_aligned_alloc_tag(size_t alignment, size_t n,
+                            enum gas_alloc_tag_t tag)
 {
-    char *s = strdup(string);
-    if (!s)
+    void *p;
+
+    (void)tag;
+    n = (n + alignment - 1) & ~(alignment - 1);
+    p = aligned_alloc(alignment, n);
+    if (!p)
         gas_alloc_die();
-    return s;
+    gas_alloc_count++;
+    return p;
+}
+
+void gas_free(void *p)
+{
+    free(p);
+}
+
+#endif  /* !GAS_ALLOC_STATS */
+
+char *gas_strdup_tag(const char *string, enum gas_alloc_tag_t tag)
+{
+    size_t len = strlen(string) + 1;
+
+    return memcpy(gas_malloc_tag(len, tag), string, len);
+}
+
+/* Arena blocks start at 64 KiB and double up to 4 MiB, so even very large
+   trees are built in a handful of blocks. */
+#define ARENA_BLOCK_MIN (64 * 1024)
+#define ARENA_BLOCK_MAX (4 * 1024 * 1024)
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+struct arena_block_t {
+    struct arena_block_t *next;
+    max_align_t data[];
+};
+
+void arena_init_tag(arena_t *arena, enum gas_alloc_tag_t tag)
+{
+    arena->blocks = NULL;
+    arena->ptr = NULL;
+    arena->end = NULL;
+    arena->blocksize = ARENA_BLOCK_MIN;
+    arena->tag = tag;
+}
+
+static void *arena_grow(arena_t *arena, size_t n)
+{
+    struct arena_block_t *block;
+    size_t size = arena->blocksize;
+
+    /* Oversized requests get a block of their own, chained behind the
+       current one so its free space is not lost. */
+    if (n > arena->blocksize / 4 && arena->blocks != NULL) {
+        block = gas_malloc_tag(sizeof(struct arena_block_t) + n,
+                               arena->tag);
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+
+        return block->data;
+    }
+
+    if (size < n)
+        size = n;
+
+    block = gas_malloc_tag(sizeof(struct arena_block_t) + size, arena->tag);
+    block->next = arena->blocks;
+    arena->blocks = block;
+
+    arena->ptr = (char *)block->data + n;
+    arena->end = (char *)block->data + size;
+
+    if (arena->blocksize < ARENA_BLOCK_MAX)
+        arena->blocksize *= 2;
+
+    return block->data;
+}
+
+void *arena_alloc(arena_t *arena, size_t n)
+{
+    char *p;
+
+    p = (char *)(((uintptr_t)arena->ptr + ARENA_ALIGN - 1)
+                 & ~(uintptr_t)(ARENA_ALIGN - 1));
+
+    if (arena->ptr == NULL || p > arena->end
+        || (size_t)(arena->end - p) < n)
+        return arena_grow(arena, n);
+
+    arena->ptr = p + n;
+
+    return p;
+}
+
+char *arena_strndup(arena_t *arena, const char *string, size_t len)
+{
+    char *p;
+
+    /* Strings need no alignment, so they are packed back to back. */
+    if ((size_t)(arena->end - arena->ptr) <= len)
+        p = arena_grow(arena, len + 1);
+    else {
+        p = arena->ptr;
+        arena->ptr += len + 1;
+    }
+
+    memcpy(p, string, len);
+    p[len] = '\0';
+
+    return p;
+}
+
+char *arena_strdup(arena_t *arena, const char *string)
+{
+    return arena_strndup(arena, string, strlen(string));
+}
+
+void arena_free(arena_t *arena)
+{
+    struct arena_block_t *block, *next;
+
+    for (block = arena->blocks; block != NULL; block = next) {
+        next = block->next;
+        gas_free(block);
+    }
+
+    arena_init_tag(arena, arena->tag);
+}
+
+/* Objects are carved out of slabs of 64 KiB, or of room for
+   POOL_SLAB_OBJECTS_MIN objects if those are larger. A thread keeps up to
+   POOL_CACHE_SIZE free objects per pool, and moves half of that at a
+   time to and from the pool. */
+#define POOL_SLAB_SIZE (64 * 1024)
+#define POOL_SLAB_OBJECTS_MIN 8
+#define POOL_CACHE_SIZE 32
+#define POOL_BATCH (POOL_CACHE_SIZE / 2)
+
+/* A free object is linked through its first bytes. */
+struct pool_object_t {
+    struct pool_object_t *next;
+};
+
+struct pool_slab_t {
+    struct pool_slab_t *next;
+};
+
+struct gas_pool_t {
+    /* The object size, a multiple of the alignment. */
+    size_t size;
+    size_t alignment;
+    enum gas_alloc_tag_t tag;
+
+    /* The slot of the pool in the registry, and a number no other pool
+       had, which tells the objects of a thread cache of this pool from
+       those of a destroyed pool that had the same slot. */
+    unsigned int id;
+    uint64_t generation;
+
+    pthread_mutex_t lock;
+
+    /* The objects freed by the threads, and those of the last slab not
+       handed out yet. */
+    struct pool_object_t *free;
+    char *next;
+    char *end;
+
+    struct pool_slab_t *slabs;
+};
+
+struct pool_cache_t {
+    gas_pool_t *pool;
+    uint64_t generation;
+
+    unsigned int count;
+    void *objects[POOL_CACHE_SIZE];
+};
+
+/* The pools that exist. A thread that exits gives the objects of its
+   caches back to their pool, if the pool still exists. */
+static struct {
+    gas_pool_t *pool;
+    uint64_t generation;
+} pools[GAS_POOL_MAX];
+static uint64_t pool_generation = 0;
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+
+/* The caches of the thread, GAS_POOL_MAX of them, indexed by pool id. */
+static _Thread_local struct pool_cache_t *pool_caches = NULL;
+
+gas_pool_t *gas_pool_create_tag(size_t size, size_t alignment,
+                                enum gas_alloc_tag_t tag)
+{
+    gas_pool_t *pool;
+    unsigned int id;
+
+    if (alignment < _Alignof(struct pool_object_t))
+        alignment = _Alignof(struct pool_object_t);
+    if (size < sizeof(struct pool_object_t))
+        size = sizeof(struct pool_object_t);
+
+    pool = gas_malloc(sizeof(*pool));
+    pool->size = (size + alignment - 1) & ~(alignment - 1);
+    pool->alignment = alignment;
+    pool->tag = tag;
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->free = NULL;
+    pool->next = NULL;
+    pool->end = NULL;
+    pool->slabs = NULL;
+
+    pthread_mutex_lock(&pools_lock);
+
+    for (id = 0; id < GAS_POOL_MAX && pools[id].pool != NULL; id++)
+        ;
+
+    if (id == GAS_POOL_MAX) {
+        pthread_mutex_unlock(&pools_lock);
+        log_print(LOG_CRIT, 0, "too many object pools");
+        exit(EXIT_FAILURE);
+    }
+
+    pool->id = id;
+    pool->generation = ++pool_generation;
+    pools[id].pool = pool;
+    pools[id].generation = pool->generation;
+
+    pthread_mutex_unlock(&pools_lock);
+
+    return pool;
+}
+
+void gas_pool_destroy(gas_pool_t *pool)
+{
+    struct pool_slab_t *slab, *next;
+
+    /* From now on, exiting threads leave the pool alone. */
+    pthread_mutex_lock(&pools_lock);
+    pools[pool->id].pool = NULL;
+    pthread_mutex_unlock(&pools_lock);
+
+    for (slab = pool->slabs; slab != NULL; slab = next) {
+        next = slab->next;
+        gas_free(slab);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    gas_free(pool);
+}
+
+/* Carve a new slab. The slab header takes the room of one object, to
+   keep the objects aligned. */
+static void pool_grow(gas_pool_t *pool)
+{
+    struct pool_slab_t *slab;
+    size_t offset, size;
+
+    offset = (sizeof(*slab) + pool->alignment - 1) & ~(pool->alignment - 1);
+    size = POOL_SLAB_SIZE;
+    if (size < offset + POOL_SLAB_OBJECTS_MIN * pool->size)
+        size = offset + POOL_SLAB_OBJECTS_MIN * pool->size;
+
+    slab = gas_aligned_alloc_tag(pool->alignment > _Alignof(max_align_t)
+                                 ? pool->alignment : _Alignof(max_align_t),
+                                 size, pool->tag);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    pool->next = (char *)slab + offset;
+    pool->end = (char *)slab + size;
+}
+
+/* Push a chain of objects to the pool; the caller holds its lock. */
+static void pool_push(gas_pool_t *pool, void **objects, size_t n)
+{
+    struct pool_object_t *object;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        object = objects[i];
+        object->next = pool->free;
+        pool->free = object;
+    }
+}
+
+static void pool_caches_release(void *arg)
+{
+    struct pool_cache_t *caches = arg, *cache;
+    unsigned int id;
+
+    pthread_mutex_lock(&pools_lock);
+
+    for (id = 0; id < GAS_POOL_MAX; id++) {
+        cache = &caches[id];
+        if (cache->count == 0 || pools[id].pool != cache->pool
+            || pools[id].generation != cache->generation)
+            continue;
+
+        pthread_mutex_lock(&cache->pool->lock);
+        pool_push(cache->pool, cache->objects, cache->count);
+        pthread_mutex_unlock(&cache->pool->lock);
+    }
+
+    pthread_mutex_unlock(&pools_lock);
+
+    pool_caches = NULL;
+    gas_free(caches);
+}
+
+static void pool_key_create(void)
+{
+    pthread_key_create(&pool_key, pool_caches_release);
+}
+
+/* The cache of the thread for a pool. A cache that held objects of a
+   destroyed pool is emptied: the objects went with the pool. */
+static struct pool_cache_t *pool_cache(gas_pool_t *pool)
+{
+    struct pool_cache_t *cache;
+
+    if (pool_caches == NULL) {
+        pthread_once(&pool_key_once, pool_key_create);
+        pool_caches = gas_malloc(GAS_POOL_MAX * sizeof(*pool_caches));
+        memset(pool_caches, 0, GAS_POOL_MAX * sizeof(*pool_caches));
+        pthread_setspecific(pool_key, pool_caches);
+    }
+
+    cache = &pool_caches[pool->id];
+    if (cache->pool != pool || cache->generation != pool->generation) {
+        cache->pool = pool;
+        cache->generation = pool->generation;
+        cache->count = 0;
+    }
+
+    return cache;
+}
+
+void *gas_pool_alloc(gas_pool_t *pool)
+{
+    struct pool_cache_t *cache = pool_cache(pool);
+    struct pool_object_t *object;
+
+    if (cache->count > 0)
+        return cache->objects[--cache->count];
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (cache->count < POOL_BATCH) {
+        if (pool->free != NULL) {
+            object = pool->free;
+            pool->free = object->next;
+        } else {
+            if (pool->next == NULL
+                || (size_t)(pool->end - pool->next) < pool->size)
+                pool_grow(pool);
+
+            object = (struct pool_object_t *)pool->next;
+            pool->next += pool->size;
+        }
+
+        cache->objects[cache->count++] = object;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return cache->objects[--cache->count];
+}
+
+void gas_pool_free(gas_pool_t *pool, void *p)
+{
+    gas_pool_free_bulk(pool, &p, 1);
+}
+
+void gas_pool_free_bulk(gas_pool_t *pool, void **objects, size_t n)
+{
+    struct pool_cache_t *cache = pool_cache(pool);
+    size_t room;
+
+    /* What does not fit in the cache, and half of the cache if it fills
+       up, goes back to the pool at once. */
+    room = POOL_CACHE_SIZE - cache->count;
+    if (n <= room) {
+        memcpy(cache->objects + cache->count, objects, n * sizeof(void *));
+        cache->count += n;
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    pool_push(pool, objects, n);
+    if (cache->count > POOL_BATCH) {
+        pool_push(pool, cache->objects + POOL_BATCH,
+                  cache->count - POOL_BATCH);
+        cache->count = POOL_BATCH;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void gas_thread_record_release(void *arg)
+{
+    struct gas_thread_record_t *record = arg;
+    struct gas_thread_registry_t *registry = record->registry;
+
+    pthread_mutex_lock(&registry->lock);
+
+    if (registry->release != NULL)
+        registry->release(record);
+    record->owned = false;
+
+    pthread_mutex_unlock(&registry->lock);
+}
+
+void *gas_thread_record_take(struct gas_thread_registry_t *registry)
+{
+    struct gas_thread_record_t *record;
+
+    pthread_mutex_lock(&registry->lock);
+
+    if (!registry->key_created) {
+        if (pthread_key_create(&registry->key,
+                               gas_thread_record_release) != 0) {
+            pthread_mutex_unlock(&registry->lock);
+            return NULL;
+        }
+        registry->key_created = true;
+    }
+
+    for (record = registry->records; record != NULL; record = record->next) {
+        if (!record->owned)
+            break;
+    }
+
+    if (record == NULL) {
+        record = aligned_alloc(CACHE_LINE_SIZE,
+                               (registry->size + CACHE_LINE_SIZE - 1)
+                               & ~(size_t)(CACHE_LINE_SIZE - 1));
+        if (record == NULL) {
+            pthread_mutex_unlock(&registry->lock);
+            return NULL;
+        }
+
+        memset(record, 0, registry->size);
+        record->registry = registry;
+        if (registry->init != NULL)
+            registry->init(record);
+
+        record->next = registry->records;
+        registry->records = record;
+    }
+
+    record->owned = true;
+
+    pthread_mutex_unlock(&registry->lock);
+
+    pthread_setspecific(registry->key, record);
+
+    return record;
+}
+
+int gas_thread_create(pthread_t *thread, void *(*start)(void *), void *arg)
+{
+    sigset_t all, saved;
+    int result;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    result = pthread_create(thread, NULL, start, arg);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    return result;
+}
+
+/* MurmurHash64A, by Austin Appleby (public domain). */
+uint64_t gas_hash64(const void *data, size_t len)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ull;
+    const int r = 47;
+    const unsigned char *p = data;
+    uint64_t h = 0x5bd1e9955bd1e995ull ^ (len * m);
+    uint64_t k;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&k, p, sizeof(k));
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+    }
+
+    switch (len) {
+    case 7: h ^= (uint64_t)p[6] << 48;  /* Fall through. */
+    case 6: h ^= (uint64_t)p[5] << 40;  /* Fall through. */
+    case 5: h ^= (uint64_t)p[4] << 32;  /* Fall through. */
+    case 4: h ^= (uint64_t)p[3] << 24;  /* Fall through. */
+    case 3: h ^= (uint64_t)p[2] << 16;  /* Fall through. */
+    case 2: h ^= (uint64_t)p[1] << 8;   /* Fall through. */
+    case 1: h ^= (uint64_t)p[0];
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+}
+
+/* The intern pool is split in shards, picked by the top bits of the hash,
+   so threads parsing different files rarely wait on the same lock. Each
+   shard is an open addressing hash table with linear probing, kept at
+   most half full so probe sequences stay short. */
+#define INTERN_SHARD_BITS 4
+#define INTERN_SHARDS (1 << INTERN_SHARD_BITS)
+#define INTERN_SLOTS_MIN 64
+
+struct intern_slot_t {
+    const char *string;
+    uint32_t hash;
+    uint32_t len;
+};
+
+static struct intern_shard_t {
+    pthread_mutex_t lock;
+
+    struct intern_slot_t *slots;
+    size_t mask;
+    size_t count;
+
+    /* The interned strings themselves. */
+    arena_t arena;
+} intern_pool[INTERN_SHARDS] = {
+    [0 ... INTERN_SHARDS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+/* FNV-1a. */
+static uint32_t intern_hash(const char *string, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)string[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static struct intern_shard_t *intern_shard(uint32_t hash)
+{
+    return &intern_pool[hash >> (32 - INTERN_SHARD_BITS)];
+}
+
+static void intern_rehash(struct intern_shard_t *shard)
+{
+    struct intern_slot_t *old = shard->slots;
+    size_t oldsize = old ? shard->mask + 1 : 0;
+    size_t size = old ? oldsize * 2 : INTERN_SLOTS_MIN;
+    size_t i, j;
+
+    if (old == NULL)
+        arena_init(&shard->arena);
+
+    shard->slots = gas_malloc(size * sizeof(struct intern_slot_t));
+    memset(shard->slots, 0, size * sizeof(struct intern_slot_t));
+    shard->mask = size - 1;
+
+    for (i = 0; i < oldsize; i++) {
+        if (old[i].string == NULL)
+            continue;
+
+        for (j = old[i].hash & shard->mask; shard->slots[j].string != NULL;
+             j = (j + 1) & shard->mask)
+            ;
+        shard->slots[j] = old[i];
+    }
+
+    gas_free(old);
+}
+
+static struct intern_slot_t *intern_slot(struct intern_shard_t *shard,
+                                         const char *string, size_t len,
+                                         uint32_t hash)
+{
+    struct intern_slot_t *slot;
+    size_t i;
+
+    for (i = hash & shard->mask; ; i = (i + 1) & shard->mask) {
+        slot = &shard->slots[i];
+
+        if (slot->string == NULL
+            || (slot->hash == hash && slot->len == len
+                && memcmp(slot->string, string, len) == 0))
+            return slot;
+    }
+}
+
+const char *gas_intern_n(const char *string, size_t len)
+{
+    uint32_t hash = intern_hash(string, len);
+    struct intern_shard_t *shard = intern_shard(hash);
+    struct intern_slot_t *slot;
+    const char *result;
+
+    pthread_mutex_lock(&shard->lock);
+
+    if ((shard->count + 1) * 2 > shard->mask + 1)
+        intern_rehash(shard);
+
+    slot = intern_slot(shard, string, len, hash);
+    if (slot->string == NULL) {
+        slot->string = arena_strndup(&shard->arena, string, len);
+        slot->hash = hash;
+        slot->len = len;
+        shard->count++;
+    }
+
+    result = slot->string;
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return result;
+}
+
+const char *gas_intern_find(const char *string, size_t len)
+{
+    uint32_t hash = intern_hash(string, len);
+    struct intern_shard_t *shard = intern_shard(hash);
+    const char *result = NULL;
+
+    pthread_mutex_lock(&shard->lock);
+
+    if (shard->slots != NULL)
+        result = intern_slot(shard, string, len, hash)->string;
+
+    pthread_mutex_unlock(&shard->lock);
+
+    return result;
+}
+
+const char *gas_intern(const char *string)
+{
+    return gas_intern_n(string, strlen(string));
 }
 
 char *gas_strerror(int errnum, char *buf, size_t buflen)
@@ -0,0 +1,474 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "gasconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "common.h"
+#include "log.h"
+#include "allocstats.h"
+#include "metrics.h"
+#include "evloop.h"
+#include "control.h"
+
+/* Connections served at once; more are closed at once. */
+#define CONTROL_CLIENTS_MAX 8
+
+#define CONTROL_BACKLOG 16
+
+#define CONTROL_REQUEST_MAX 64
+
+/* Longer answers are cut. */
+#define CONTROL_REPLY_MAX (16 * 1024)
+
+/* Milliseconds a client has to send its request and read the answer
+   before it is closed, so that idle connections cannot hold every
+   slot. */
+#define CONTROL_TIMEOUT 5000
+
+struct control_client_t {
+    struct evloop_io_t io;
+    struct evloop_timer_t timer;
+    bool active;
+
+    char request[CONTROL_REQUEST_MAX];
+    size_t request_len;
+
+    /* The answer, allocated once for the slot, and how much of it was
+       sent; len is 0 until the request is complete. */
+    char *reply;
+    size_t reply_len;
+    size_t sent;
+};
+
+static struct {
+    evloop_t *loop;
+    struct evloop_io_t listen;
+    char *path;
+
+    struct control_client_t clients[CONTROL_CLIENTS_MAX];
+} control = { .listen.fd = -1 };
+
+static void control_printf(struct control_client_t *client,
+                           const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void control_printf(struct control_client_t *client,
+                           const char *format, ...)
+{
+    size_t room = CONTROL_REPLY_MAX - client->reply_len;
+    va_list args;
+    int n;
+
+    va_start(args, format);
+    n = vsnprintf(client->reply + client->reply_len, room, format, args);
+    va_end(args);
+
+    if (n < 0)
+        return;
+
+    client->reply_len += (size_t)n < room ? (size_t)n : room - 1;
+}
+
+/* The name of a percentile given in thousandths: p50, p99.9... */
+static const char *control_percentile(int i, char *buf, size_t size)
+{
+    int permille = metrics_percentiles[i];
+
+    if (permille % 10 == 0)
+        snprintf(buf, size, "p%d", permille / 10);
+    else
+        snprintf(buf, size, "p%d.%d", permille / 10, permille % 10);
+
+    return buf;
+}
+
+static void control_stats_text(struct control_client_t *client)
+{
+    struct metrics_t metrics;
+    struct alloc_stats_t stats;
+    const char *name;
+    char label[16];
+    int i, j;
+
+    metrics_get(&metrics);
+
+    for (i = 0; i < METRIC_COUNTER_MAX; i++)
+        control_printf(client, "%s %" PRIu64 "\n", metric_counter_name(i),
+                       metrics.counters[i]);
+
+    for (i = 0; i < METRIC_GAUGE_MAX; i++)
+        control_printf(client, "%s %" PRId64 "\n", metric_gauge_name(i),
+                       metrics.gauges[i]);
+
+    for (i = 0; i < METRIC_HISTOGRAM_MAX; i++) {
+        name = metric_histogram_name(i);
+        control_printf(client, "%s.count %" PRIu64 "\n%s.sum %" PRIu64
+                       "\n%s.max %" PRIu64 "\n",
+                       name, metrics.histograms[i].count,
+                       name, metrics.histograms[i].sum,
+                       name, metrics.histograms[i].max);
+
+        for (j = 0; j < METRICS_PERCENTILES; j++)
+            control_printf(client, "%s.%s %" PRIu64 "\n", name,
+                           control_percentile(j, label, sizeof(label)),
+                           metrics.histograms[i].percentiles[j]);
+    }
+
+    if (!alloc_stats_enabled())
+        return;
+
+    alloc_stats_get(&stats);
+
+    for (i = 0; i < GAS_ALLOC_TAG_MAX; i++) {
+        name = alloc_tag_name(i);
+        control_printf(client, "alloc.%s.allocs %" PRIu64 "\n"
+                       "alloc.%s.frees %" PRIu64 "\n"
+                       "alloc.%s.bytes %" PRIu64 "\n"
+                       "alloc.%s.live %" PRId64 "\n"
+                       "alloc.%s.peak %" PRId64 "\n",
+                       name, stats.tags[i].allocs, name, stats.tags[i].frees,
+                       name, stats.tags[i].bytes, name, stats.tags[i].live,
+                       name, stats.tags[i].peak);
+    }
+}
+
+static void control_stats_json(struct control_client_t *client)
+{
+    struct metrics_t metrics;
+    struct alloc_stats_t stats;
+    char label[16];
+    int i, j;
+
+    metrics_get(&metrics);
+
+    control_printf(client, "{\"counters\":{");
+    for (i = 0; i < METRIC_COUNTER_MAX; i++)
+        control_printf(client, "%s\"%s\":%" PRIu64, i > 0 ? "," : "",
+                       metric_counter_name(i), metrics.counters[i]);
+
+    control_printf(client, "},\"gauges\":{");
+    for (i = 0; i < METRIC_GAUGE_MAX; i++)
+        control_printf(client, "%s\"%s\":%" PRId64, i > 0 ? "," : "",
+                       metric_gauge_name(i), metrics.gauges[i]);
+
+    control_printf(client, "},\"histograms\":{");
+    for (i = 0; i < METRIC_HISTOGRAM_MAX; i++) {
+        control_printf(client, "%s\"%s\":{\"count\":%" PRIu64 ",\"sum\":%"
+                       PRIu64 ",\"max\":%" PRIu64, i > 0 ? "," : "",
+                       metric_histogram_name(i),
+                       metrics.histograms[i].count,
+                       metrics.histograms[i].sum,
+                       metrics.histograms[i].max);
+
+        for (j = 0; j < METRICS_PERCENTILES; j++)
+            control_printf(client, ",\"%s\":%" PRIu64,
+                           control_percentile(j, label, sizeof(label)),
+                           metrics.histograms[i].percentiles[j]);
+
+        control_printf(client, "}");
+    }
+    control_printf(client, "}");
+
+    if (alloc_stats_enabled()) {
+        alloc_stats_get(&stats);
+
+        control_printf(client, ",\"alloc\":{");
+        for (i = 0; i < GAS_ALLOC_TAG_MAX; i++)
+            control_printf(client, "%s\"%s\":{\"allocs\":%" PRIu64
+                           ",\"frees\":%" PRIu64 ",\"bytes\":%" PRIu64
+                           ",\"live\":%" PRId64 ",\"peak\":%" PRId64 "}",
+                           i > 0 ? "," : "", alloc_tag_name(i),
+                           stats.tags[i].allocs, stats.tags[i].frees,
+                           stats.tags[i].bytes, stats.tags[i].live,
+                           stats.tags[i].peak);
+        control_printf(client, "}");
+    }
+
+    control_printf(client, "}\n");
+}
+
+static void control_close(struct control_client_t *client)
+{
+    evloop_timer_set(&client->timer, 0, 0);
+    evloop_io_remove(control.loop, &client->io);
+    close(client->io.fd);
+    client->active = false;
+}
+
+static void control_timed_out(evloop_t *loop, struct evloop_timer_t *timer)
+{
+    struct control_client_t *client = timer->data;
+
+    (void)loop;
+
+    if (client->active)
+        control_close(client);
+}
+
+/* Send what is left of the answer; close once it is all sent. */
+static void control_send(struct control_client_t *client)
+{
+    ssize_t n;
+
+    while (client->sent < client->reply_len) {
+        n = send(client->io.fd, client->reply + client->sent,
+                 client->reply_len - client->sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN
+                && evloop_io_modify(control.loop, &client->io,
+                                    EPOLLOUT) == GAS_SUCCESS)
+                return;
+
+            break;
+        }
+
+        client->sent += (size_t)n;
+    }
+
+    control_close(client);
+}
+
+static void control_answer(struct control_client_t *client)
+{
+    char *request = client->request;
+    size_t len = client->request_len;
+
+    while (len > 0 && (request[len - 1] == '\n' || request[len - 1] == '\r'
+                       || request[len - 1] == ' '))
+        len--;
+    request[len] = '\0';
+
+    if (strcmp(request, "stats") == 0)
+        control_stats_text(client);
+    else if (strcmp(request, "stats json") == 0)
+        control_stats_json(client);
+    else
+        control_printf(client, "unknown request '%s'\n", request);
+
+    control_send(client);
+}
+
+static void control_client_event(evloop_t *loop, struct evloop_io_t *io,
+                                 uint32_t events)
+{
+    struct control_client_t *client = io->data;
+    size_t room;
+    ssize_t n;
+
+    (void)loop;
+
+    if (client->reply_len > 0) {
+        control_send(client);
+        return;
+    }
+
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) == 0)
+        return;
+
+    /* Room for the terminating null byte. */
+    room = CONTROL_REQUEST_MAX - 1 - client->request_len;
+    n = read(io->fd, client->request + client->request_len, room);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EINTR)
+            control_close(client);
+        return;
+    }
+
+    client->request_len += (size_t)n;
+
+    /* A request is one line, or what was sent before shutting down the
+       writing side. */
+    if (n == 0 || memchr(client->request + client->request_len - n, '\n',
+                         (size_t)n) != NULL) {
+        control_answer(client);
+        return;
+    }
+
+    if (client->request_len == CONTROL_REQUEST_MAX - 1) {
+        control_printf(client, "request too long\n");
+        control_send(client);
+    }
+}
+
+static void control_accept(evloop_t *loop, struct evloop_io_t *io,
+                           uint32_t events)
+{
+    struct control_client_t *client;
+    int fd, i;
+
+    (void)events;
+
+    for (;;) {
+        fd = accept(io->fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            if (errno != EAGAIN)
+                log_print(LOG_ERR, errno, "cannot accept control "
+                          "connection");
+            return;
+        }
+
+        if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0
+            || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+            log_print(LOG_ERR, errno, "cannot accept control connection");
+            close(fd);
+            continue;
+        }
+
+        for (i = 0; i < CONTROL_CLIENTS_MAX; i++) {
+            if (!control.clients[i].active)
+                break;
+        }
+
+        if (i == CONTROL_CLIENTS_MAX) {
+            log_print(LOG_WARNING, 0, "too many control connections");
+            close(fd);
+            continue;
+        }
+
+        client = &control.clients[i];
+        if (client->reply == NULL)
+            client->reply = gas_malloc(CONTROL_REPLY_MAX);
+
+        client->request_len = 0;
+        client->reply_len = 0;
+        client->sent = 0;
+
+        if (evloop_io_add(loop, &client->io, fd, EPOLLIN,
+                          control_client_event, client) < 0) {
+            close(fd);
+            continue;
+        }
+
+        evloop_timer_set(&client->timer, CONTROL_TIMEOUT, 0);
+        client->active = true;
+    }
+}
+
+/* Remove the timers of the first count clients. */
+static void control_remove_timers(evloop_t *loop, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        evloop_timer_remove(loop, &control.clients[i].timer);
+}
+
+int control_start(evloop_t *loop, const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd, i;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        log_print(LOG_ERR, ENAMETOOLONG, "cannot create control socket "
+                  "'%s'", path);
+        return -GAS_FAILURE;
+    }
+
+    /* Left by a previous run; anything else stays. */
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_print(LOG_ERR, errno, "cannot create control socket '%s'",
+                  path);
+        return -GAS_FAILURE;
+    }
+
+    /* Only the owner may connect. Until listen(), connections are
+       refused, whatever the mode the socket was created with. */
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || chmod(path, S_IRUSR | S_IWUSR) < 0
+        || listen(fd, CONTROL_BACKLOG) < 0) {
+        log_print(LOG_ERR, errno, "cannot listen on control socket '%s'",
+                  path);
+        close(fd);
+        return -GAS_FAILURE;
+    }
+
+    for (i = 0; i < CONTROL_CLIENTS_MAX; i++) {
+        if (evloop_timer_add(loop, &control.clients[i].timer,
+                             control_timed_out, &control.clients[i]) < 0)
+            break;
+    }
+
+    if (i < CONTROL_CLIENTS_MAX
+        || evloop_io_add(loop, &control.listen, fd, EPOLLIN, control_accept,
+                         NULL) < 0) {
+        control_remove_timers(loop, i);
+        close(fd);
+        unlink(path);
+        control.listen.fd = -1;
+        return -GAS_FAILURE;
+    }
+
+    control.loop = loop;
+    control.path = gas_strdup(path);
+
+    return GAS_SUCCESS;
+}
+
+void control_stop(void)
+{
+    int i;
+
+    if (control.listen.fd < 0)
+        return;
+
+    for (i = 0; i < CONTROL_CLIENTS_MAX; i++) {
+        if (control.clients[i].active)
+            control_close(&control.clients[i]);
+
+        gas_free(control.clients[i].reply);
+        control.clients[i].reply = NULL;
+    }
+
+    control_remove_timers(control.loop, CONTROL_CLIENTS_MAX);
+
+    evloop_io_remove(control.loop, &control.listen);
+    close(control.listen.fd);
+    control.listen.fd = -1;
+
+    unlink(control.path);
+    gas_free(control.path);
+    control.path = NULL;
+    control.loop = NULL;
+}
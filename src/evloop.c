@@ -0,0 +1,375 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "gasconfig.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "common.h"
+#include "log.h"
+#include "evloop.h"
+
+/* The events taken by one epoll_wait(). */
+#define EVLOOP_EVENTS 64
+
+/* The signals taken by one read() of the signal descriptor. */
+#define EVLOOP_SIGNALS 8
+
+struct evloop_handler_t {
+    evloop_signal_fn *callback;
+    void *data;
+};
+
+struct evloop_t {
+    int epfd;
+
+    /* Written to by evloop_stop(). */
+    struct evloop_io_t wake;
+    atomic_bool stopped;
+
+    /* The signals handled, on a signalfd created with the first one. */
+    struct evloop_io_t signal;
+    sigset_t sigset;
+    struct evloop_handler_t handlers[NSIG];
+
+    /* The events of the last epoll_wait(), and the next one to
+       dispatch. */
+    struct epoll_event events[EVLOOP_EVENTS];
+    int nevents;
+    int next;
+};
+
+static void evloop_woken(evloop_t *loop, struct evloop_io_t *io,
+                         uint32_t events)
+{
+    uint64_t count;
+
+    (void)loop;
+    (void)events;
+
+    /* Nothing to do but clear it: the loop checks whether it stopped
+       after each callback. */
+    if (read(io->fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        log_print(LOG_ERR, errno, "cannot read event loop wake descriptor");
+}
+
+evloop_t *evloop_create(void)
+{
+    evloop_t *loop;
+    int fd;
+
+    loop = gas_malloc(sizeof(*loop));
+    memset(loop, 0, sizeof(*loop));
+    loop->signal.fd = -1;
+    sigemptyset(&loop->sigset);
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd < 0) {
+        log_print(LOG_ERR, errno, "cannot create event loop");
+        gas_free(loop);
+        return NULL;
+    }
+
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0 || evloop_io_add(loop, &loop->wake, fd, EPOLLIN,
+                                evloop_woken, NULL) < 0) {
+        if (fd < 0)
+            log_print(LOG_ERR, errno, "cannot create event loop");
+        else
+            close(fd);
+
+        close(loop->epfd);
+        gas_free(loop);
+        return NULL;
+    }
+
+    return loop;
+}
+
+void evloop_free(evloop_t *loop)
+{
+    if (loop == NULL)
+        return;
+
+    if (loop->signal.fd >= 0) {
+        pthread_sigmask(SIG_UNBLOCK, &loop->sigset, NULL);
+        close(loop->signal.fd);
+    }
+
+    close(loop->wake.fd);
+    close(loop->epfd);
+    gas_free(loop);
+}
+
+int evloop_run(evloop_t *loop)
+{
+    struct epoll_event *event;
+    struct evloop_io_t *io;
+    int result = GAS_SUCCESS, n;
+
+    while (!atomic_load_explicit(&loop->stopped, memory_order_relaxed)) {
+        n = epoll_wait(loop->epfd, loop->events, EVLOOP_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            log_print(LOG_ERR, errno, "cannot wait for events");
+            result = -GAS_FAILURE;
+            break;
+        }
+
+        loop->nevents = n;
+        for (loop->next = 0; loop->next < loop->nevents;) {
+            event = &loop->events[loop->next++];
+
+            /* Removed by an earlier callback. */
+            io = event->data.ptr;
+            if (io == NULL)
+                continue;
+
+            io->callback(loop, io, event->events);
+
+            /* The events left are level-triggered: they are reported
+               again by the next run. */
+            if (atomic_load_explicit(&loop->stopped, memory_order_relaxed))
+                break;
+        }
+
+        loop->nevents = 0;
+    }
+
+    atomic_store_explicit(&loop->stopped, false, memory_order_relaxed);
+
+    return result;
+}
+
+void evloop_stop(evloop_t *loop)
+{
+    uint64_t one = 1;
+
+    atomic_store_explicit(&loop->stopped, true, memory_order_relaxed);
+
+    /* Only fails if the counter is about to overflow, when the loop is
+       bound to wake up anyway. */
+    if (write(loop->wake.fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        log_print(LOG_ERR, errno, "cannot wake event loop");
+}
+
+int evloop_io_add(evloop_t *loop, struct evloop_io_t *io, int fd,
+                  uint32_t events, evloop_io_fn *callback, void *data)
+{
+    struct epoll_event event;
+
+    io->fd = fd;
+    io->callback = callback;
+    io->data = data;
+
+    event.events = events;
+    event.data.ptr = io;
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        log_print(LOG_ERR, errno, "cannot watch descriptor %d", fd);
+        return -GAS_FAILURE;
+    }
+
+    return GAS_SUCCESS;
+}
+
+int evloop_io_modify(evloop_t *loop, struct evloop_io_t *io,
+                     uint32_t events)
+{
+    struct epoll_event event;
+
+    event.events = events;
+    event.data.ptr = io;
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, io->fd, &event) < 0) {
+        log_print(LOG_ERR, errno, "cannot watch descriptor %d", io->fd);
+        return -GAS_FAILURE;
+    }
+
+    return GAS_SUCCESS;
+}
+
+int evloop_io_remove(evloop_t *loop, struct evloop_io_t *io)
+{
+    int i;
+
+    for (i = loop->next; i < loop->nevents; i++) {
+        if (loop->events[i].data.ptr == io)
+            loop->events[i].data.ptr = NULL;
+    }
+
+    /* A closed descriptor is already gone from the epoll set. */
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_DEL, io->fd, NULL) < 0
+        && errno != EBADF && errno != ENOENT) {
+        log_print(LOG_ERR, errno, "cannot stop watching descriptor %d",
+                  io->fd);
+        return -GAS_FAILURE;
+    }
+
+    return GAS_SUCCESS;
+}
+
+static void evloop_timer_expired(evloop_t *loop, struct evloop_io_t *io,
+                                 uint32_t events)
+{
+    struct evloop_timer_t *timer = io->data;
+    uint64_t expirations;
+
+    (void)events;
+
+    /* Nothing to read if the timer was set again since it expired. */
+    if (read(io->fd, &expirations, sizeof(expirations)) < 0)
+        return;
+
+    timer->callback(loop, timer);
+}
+
+int evloop_timer_add(evloop_t *loop, struct evloop_timer_t *timer,
+                     evloop_timer_fn *callback, void *data)
+{
+    int fd;
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        log_print(LOG_ERR, errno, "cannot create timer");
+        return -GAS_FAILURE;
+    }
+
+    timer->callback = callback;
+    timer->data = data;
+
+    if (evloop_io_add(loop, &timer->io, fd, EPOLLIN, evloop_timer_expired,
+                      timer) < 0) {
+        close(fd);
+        return -GAS_FAILURE;
+    }
+
+    return GAS_SUCCESS;
+}
+
+void evloop_timer_remove(evloop_t *loop, struct evloop_timer_t *timer)
+{
+    evloop_io_remove(loop, &timer->io);
+    close(timer->io.fd);
+    timer->io.fd = -1;
+}
+
+static void evloop_timespec(struct timespec *ts, long ms)
+{
+    ts->tv_sec = ms / 1000;
+    ts->tv_nsec = ms % 1000 * 1000000;
+}
+
+int evloop_timer_set(struct evloop_timer_t *timer, long delay,
+                     long interval)
+{
+    struct itimerspec spec;
+
+    evloop_timespec(&spec.it_value, delay);
+    evloop_timespec(&spec.it_interval, delay > 0 ? interval : 0);
+
+    if (timerfd_settime(timer->io.fd, 0, &spec, NULL) < 0) {
+        log_print(LOG_ERR, errno, "cannot set timer");
+        return -GAS_FAILURE;
+    }
+
+    return GAS_SUCCESS;
+}
+
+static void evloop_signaled(evloop_t *loop, struct evloop_io_t *io,
+                            uint32_t events)
+{
+    struct signalfd_siginfo siginfo[EVLOOP_SIGNALS];
+    struct evloop_handler_t *handler;
+    ssize_t len;
+    size_t i;
+
+    (void)events;
+
+    do {
+        len = read(io->fd, siginfo, sizeof(siginfo));
+        if (len < 0) {
+            if (errno != EAGAIN)
+                log_print(LOG_ERR, errno, "cannot read signals");
+            return;
+        }
+
+        for (i = 0; i < (size_t)len / sizeof(siginfo[0]); i++) {
+            handler = &loop->handlers[siginfo[i].ssi_signo];
+            if (handler->callback != NULL)
+                handler->callback(loop, &siginfo[i], handler->data);
+        }
+    } while ((size_t)len == sizeof(siginfo));
+}
+
+int evloop_signal(evloop_t *loop, int signo, evloop_signal_fn *callback,
+                  void *data)
+{
+    sigset_t sigset;
+    int fd;
+
+    if (signo <= 0 || signo >= NSIG) {
+        log_print(LOG_ERR, EINVAL, "cannot handle signal %d", signo);
+        return -GAS_FAILURE;
+    }
+
+    sigemptyset(&sigset);
+    sigaddset(&sigset, signo);
+    sigaddset(&loop->sigset, signo);
+
+    loop->handlers[signo].callback = callback;
+    loop->handlers[signo].data = data;
+
+    /* Blocked before it is read from the descriptor, or it could still
+       be delivered the usual way in between. */
+    pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+    if (loop->signal.fd >= 0) {
+        if (signalfd(loop->signal.fd, &loop->sigset, 0) < 0) {
+            log_print(LOG_ERR, errno, "cannot handle signal %d", signo);
+            return -GAS_FAILURE;
+        }
+
+        return GAS_SUCCESS;
+    }
+
+    fd = signalfd(-1, &loop->sigset, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        log_print(LOG_ERR, errno, "cannot create signal descriptor");
+        return -GAS_FAILURE;
+    }
+
+    if (evloop_io_add(loop, &loop->signal, fd, EPOLLIN, evloop_signaled,
+                      NULL) < 0) {
+        close(fd);
+        return -GAS_FAILURE;
+    }
+
+    return GAS_SUCCESS;
+}
@@ -18,10 +18,22 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #include <getopt.h>
 #include <limits.h>
+#include <errno.h>
+#include <signal.h>
 
+#include "common.h"
+#include "allocstats.h"
 #include "log.h"
+#include "evloop.h"
+#include "workpool.h"
+#include "control.h"
+#include "trace.h"
+#include "profile.h"
+#include "cfgsnap.h"
 #include "cfgfile.h"
 
 #define PROGRAM_AUTHOR \
@@ -34,16 +46,35 @@ static const char *program_name = NULL;
 /* Configuration file pathname. */
 static const char *configfile = NULL;
 
+/* The log levels given on the command line, as a list for
+   log_set_levels(). They override those of the configuration. */
+static char *log_levels_arg = NULL;
+
+/* The file the trace spans are written to at exit, if any. */
+static const char *trace_file = NULL;
+
+/* Whether the startup profile is reported at exit, and how. */
+static bool profile_startup = false;
+static enum profile_format_t profile_format = PROFILE_FORMAT_TABLE;
+
 /* For long options that have no equivalent short option, use a
    non-character as a pseudo short option, starting with CHAR_MAX + 1. */
 enum {
-    HELP_OPTION = CHAR_MAX + 1,
+    NO_CONFIG_CACHE_OPTION = CHAR_MAX + 1,
+    LOG_LEVEL_OPTION,
+    TRACE_OPTION,
+    PROFILE_STARTUP_OPTION,
+    HELP_OPTION,
     VERSION_OPTION
 };
 
 static struct option const long_options[] = {
     {"config", required_argument, NULL, 'c'},
     {"debug", no_argument, NULL, 'd'},
+    {"log-level", required_argument, NULL, LOG_LEVEL_OPTION},
+    {"no-config-cache", no_argument, NULL, NO_CONFIG_CACHE_OPTION},
+    {"trace", required_argument, NULL, TRACE_OPTION},
+    {"profile-startup", optional_argument, NULL, PROFILE_STARTUP_OPTION},
     {"help", no_argument, NULL, HELP_OPTION},
     {"version", no_argument, NULL, VERSION_OPTION},
     {NULL, 0, NULL, 0}
@@ -58,10 +89,21 @@ static void usage(int status)
         printf("Usage: %s [OPTION]...\n", program_name);
 
         fputs("\n\
-  -c, --config=FILE  specify config file to use\n\
-  -d, --debug        enable debug mode\n\
-      --help     display this help and exit\n\
-      --version  output version information and exit\n", stdout);
+  -c, --config=FILE       specify config file to use\n\
+  -d, --debug             enable debug mode\n\
+      --log-level=LIST    set log levels: a comma separated list of LEVEL,\n\
+                          for all subsystems, and SUBSYSTEM=LEVEL items; the\n\
+                          subsystems are core, config and parser\n\
+      --no-config-cache   always parse the config file, do not use or write\n\
+                          its compiled cache\n\
+      --trace=FILE        write trace spans to FILE at exit, as Chrome\n\
+                          trace_event JSON\n\
+      --profile-startup[=FORMAT]\n\
+                          report the time, page faults and allocations of\n\
+                          each startup phase on stderr at exit; FORMAT is\n\
+                          table (the default) or json\n\
+      --help              display this help and exit\n\
+      --version           output version information and exit\n", stdout);
 
         fputc('\n', stdout);
 
@@ -90,10 +132,322 @@ There is NO WARRANTY, to the extent permitted by law.\n\
     exit(EXIT_SUCCESS);
 }
 
+/* Milliseconds between attempts to free replaced configuration
+   snapshots that threads were still reading. */
+#define RECLAIM_INTERVAL 1000
+
+/* The event loop of the main thread. */
+static evloop_t *event_loop = NULL;
+
+/* The descriptor of the configuration files watch, -1 if they are not
+   watched. */
+static struct evloop_io_t config_io;
+static int config_fd = -1;
+
+/* Changed configuration files are reloaded after a delay: editors and
+   package managers write several files, or a file several times, in a
+   row. */
+static struct evloop_timer_t reload_timer;
+
+static struct evloop_timer_t reclaim_timer;
+
+/* The workers of CPU-bound work, whose results come back to the
+   loop. */
+static workpool_t *workers = NULL;
+
+/* A reload parses the files on a worker, so that the loop keeps
+   serving; the loop publishes the result. Reloads asked for while one
+   runs are folded into a single one after it. */
+static struct work_t reload_work;
+static bool reloading = false;
+static bool reload_again = false;
+
+/* Add levels to those given on the command line and apply them now, so
+   that they hold while the configuration is read. */
+static void add_log_levels(const char *levels)
+{
+    size_t len = log_levels_arg != NULL ? strlen(log_levels_arg) : 0;
+
+    if (log_set_levels(levels) < 0) {
+        fprintf(stderr, "%s: invalid log levels '%s'\n", program_name,
+                levels);
+        usage(EXIT_FAILURE);
+    }
+
+    log_levels_arg = gas_realloc(log_levels_arg, len + strlen(levels) + 2);
+    if (len > 0)
+        log_levels_arg[len++] = ',';
+    strcpy(log_levels_arg + len, levels);
+}
+
+/* Apply the log settings that change on reloads: the levels of the
+   configuration, then those of the command line, and the limits. */
+static void set_log_config(void)
+{
+    const struct gas_config_t *config = config_get();
+    int i, level, rate, burst;
+    bool failed = false;
+    long window;
+
+    for (i = 0; i < LOG_SUBSYSTEM_MAX; i++) {
+        level = config->log.levels[i];
+        log_set_level(i, level >= 0 ? level : config->log.level);
+    }
+
+    if (log_levels_arg != NULL)
+        log_set_levels(log_levels_arg);
+
+    for (level = 0; level <= LOG_DEBUG; level++) {
+        rate = config->log.rates[level];
+        burst = config->log.bursts[level];
+        if (rate < 0 || burst < 0) {
+            rate = config->log.rate;
+            burst = config->log.burst;
+        }
+
+        if (log_set_rate_limit(level, rate, burst) < 0 && !failed) {
+            log_print(LOG_ERR, 0, "invalid log rate limit %d %d", rate,
+                      burst);
+            failed = true;
+        }
+
+        window = config->log.repeat_windows[level];
+        log_set_repeat_window(level, window >= 0
+                              ? window : config->log.repeat_window);
+    }
+}
+
+static void add_log_sinks(const struct gas_config_t *config)
+{
+    const char *ident = strrchr(program_name, '/');
+
+    ident = ident != NULL ? ident + 1 : program_name;
+
+    /* If none can be added, messages stay on stderr. */
+    if (config->log.to_stderr)
+        log_add_stderr(config->log.stderr_level);
+
+    if (config->log.file != NULL)
+        log_add_file(config->log.file, config->log.file_level);
+
+    if (config->log.to_syslog)
+        log_add_syslog(ident, config->log.syslog_level);
+}
+
+static void start_logging(void)
+{
+    const struct gas_config_t *config = config_get();
+
+    set_log_config();
+
+    if (config->log.binary_file == NULL
+        || log_start_binary(config->log.binary_file) < 0)
+        add_log_sinks(config);
+
+    if (config->log.async)
+        log_start_async(config->log.buffer_size,
+                        config->log.block_when_full
+                        ? LOG_OVERFLOW_BLOCK : LOG_OVERFLOW_DROP);
+}
+
+static void config_changed(evloop_t *loop, struct evloop_io_t *io,
+                           uint32_t events);
+
+/* Follow the configuration files watch, which a reload may start or
+   stop. */
+static void watch_config(void)
+{
+    int fd = config_watch_fd();
+
+    if (fd == config_fd)
+        return;
+
+    if (config_fd >= 0)
+        evloop_io_remove(event_loop, &config_io);
+
+    config_fd = -1;
+    if (fd >= 0
+        && evloop_io_add(event_loop, &config_io, fd, EPOLLIN,
+                         config_changed, NULL) == GAS_SUCCESS)
+        config_fd = fd;
+}
+
+/* Try to free the replaced snapshots until none is left. */
+static void reclaim(evloop_t *loop, struct evloop_timer_t *timer)
+{
+    (void)loop;
+
+    if (!cfgsnap_reclaim())
+        evloop_timer_set(timer, 0, 0);
+}
+
+static void reload(void);
+
+static void reload_parse(struct work_t *work)
+{
+    (void)work;
+
+    reload_config_parse();
+}
+
+static void reload_done(struct work_t *work)
+{
+    (void)work;
+
+    reloading = false;
+
+    reload_config_publish();
+    set_log_config();
+    watch_config();
+
+    if (cfgsnap_reclaim())
+        evloop_timer_set(&reclaim_timer, RECLAIM_INTERVAL, RECLAIM_INTERVAL);
+
+    if (reload_again) {
+        reload_again = false;
+        reload();
+    }
+}
+
+static void reload(void)
+{
+    evloop_timer_set(&reload_timer, 0, 0);
+
+    if (reloading) {
+        reload_again = true;
+        return;
+    }
+
+    reloading = true;
+    reload_work.run = reload_parse;
+    reload_work.done = reload_done;
+    workpool_submit(workers, &reload_work);
+}
+
+static void reload_timed_out(evloop_t *loop, struct evloop_timer_t *timer)
+{
+    (void)loop;
+    (void)timer;
+
+    reload();
+}
+
+static void config_changed(evloop_t *loop, struct evloop_io_t *io,
+                           uint32_t events)
+{
+    long delay = config_get()->reload.delay;
+
+    (void)loop;
+    (void)io;
+    (void)events;
+
+    if (!config_watch_changed())
+        return;
+
+    /* Each change restarts the delay. */
+    if (delay > 0)
+        evloop_timer_set(&reload_timer, delay, 0);
+    else
+        reload();
+}
+
+/* Log files were rotated, or the configuration changed. */
+static void hangup(evloop_t *loop, const struct signalfd_siginfo *siginfo,
+                   void *data)
+{
+    (void)loop;
+    (void)siginfo;
+    (void)data;
+
+    log_reopen();
+    reload();
+}
+
+static void terminate(evloop_t *loop, const struct signalfd_siginfo *siginfo,
+                      void *data)
+{
+    (void)data;
+
+    log_print(LOG_INFO, 0, "received signal %d, exiting",
+              (int)siginfo->ssi_signo);
+    evloop_stop(loop);
+}
+
+static void report_allocations(evloop_t *loop,
+                               const struct signalfd_siginfo *siginfo,
+                               void *data)
+{
+    (void)loop;
+    (void)siginfo;
+    (void)data;
+
+    alloc_stats_report();
+}
+
+/* Run until SIGTERM or SIGINT. The configuration is reloaded, and the
+   log files reopened, on SIGHUP; the configuration also when its files
+   change. SIGUSR1 logs the allocation statistics. */
+static void run(void)
+{
+    event_loop = evloop_create();
+    if (event_loop == NULL
+        || evloop_signal(event_loop, SIGHUP, hangup, NULL) < 0
+        || evloop_signal(event_loop, SIGTERM, terminate, NULL) < 0
+        || evloop_signal(event_loop, SIGINT, terminate, NULL) < 0
+        || evloop_signal(event_loop, SIGUSR1, report_allocations, NULL) < 0
+        || evloop_timer_add(event_loop, &reload_timer, reload_timed_out,
+                            NULL) < 0
+        || evloop_timer_add(event_loop, &reclaim_timer, reclaim, NULL) < 0)
+        exit(EXIT_FAILURE);
+
+    workers = workpool_create(config_get()->workers.threads,
+                              config_get()->workers.queue_size, event_loop);
+    if (workers == NULL)
+        exit(EXIT_FAILURE);
+
+    log_print(LOG_DEBUG, 0, "started %d worker threads",
+              workpool_size(workers));
+
+    /* The daemon runs without it. */
+    if (config_get()->control.socket != NULL)
+        control_start(event_loop, config_get()->control.socket);
+
+    watch_config();
+
+    /* Ready: the profile resumes for the teardown. */
+    if (profile_startup)
+        profile_stop();
+
+    evloop_run(event_loop);
+
+    if (profile_startup)
+        profile_start(PROFILE_TEARDOWN, NULL);
+
+    control_stop();
+
+    /* A reload still running is published, but not started again. */
+    reload_again = false;
+    workpool_free(workers);
+    workers = NULL;
+
+    if (config_fd >= 0)
+        evloop_io_remove(event_loop, &config_io);
+    config_fd = -1;
+
+    evloop_timer_remove(event_loop, &reclaim_timer);
+    evloop_timer_remove(event_loop, &reload_timer);
+    evloop_free(event_loop);
+    event_loop = NULL;
+}
+
 int main(int argc, char **argv)
 {
+    struct profile_sample_t start;
     int optc;
 
+    /* Before the options, which tell whether startup is profiled. */
+    profile_sample(&start);
+
     program_name = argv[0];
 
     while ((optc = getopt_long(argc, argv, "c:d", long_options, NULL))
@@ -104,7 +458,33 @@ int main(int argc, char **argv)
             break;
 
         case 'd':
-            log_set_default_level(LOG_DEBUG);
+            add_log_levels("debug");
+            break;
+
+        case LOG_LEVEL_OPTION:
+            add_log_levels(optarg);
+            break;
+
+        case NO_CONFIG_CACHE_OPTION:
+            read_config_set_cache(false);
+            break;
+
+        case TRACE_OPTION:
+            if (trace_start(0) == GAS_SUCCESS)
+                trace_file = optarg;
+            break;
+
+        case PROFILE_STARTUP_OPTION:
+            if (optarg == NULL || strcmp(optarg, "table") == 0) {
+                profile_format = PROFILE_FORMAT_TABLE;
+            } else if (strcmp(optarg, "json") == 0) {
+                profile_format = PROFILE_FORMAT_JSON;
+            } else {
+                fprintf(stderr, "%s: invalid profile format '%s'\n",
+                        program_name, optarg);
+                usage(EXIT_FAILURE);
+            }
+            profile_startup = true;
             break;
 
         case HELP_OPTION:
@@ -120,9 +500,34 @@ int main(int argc, char **argv)
         }
     }
 
+    if (profile_startup) {
+        profile_start(PROFILE_OPTIONS, &start);
+        profile_switch(PROFILE_OTHER);
+    }
+
     log_print(LOG_DEBUG, 0, "%s version %s", program_name, PACKAGE_VERSION);
 
     read_config(configfile);
 
+    start_logging();
+
+    run();
+
+    free_config();
+
+    log_report_suppressed();
+    log_stop_async();
+
+    /* Every other thread is gone. */
+    if (trace_file != NULL)
+        trace_write(trace_file);
+
+    if (profile_startup) {
+        profile_stop();
+        profile_report(stderr, profile_format);
+    }
+
+    gas_free(log_levels_arg);
+
     exit(EXIT_SUCCESS);
 }
@@ -14,13 +14,54 @@
 # You should have received a copy of the GNU General Public License
 # along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
-bin_PROGRAMS = src/gastoold
+bin_PROGRAMS = src/gastoold src/gastool-logdecode
 
 src_gastoold_CPPFLAGS = -I$(top_srcdir)/include
 
 src_gastoold_SOURCES =	\
   src/gastoold.c	\
   src/common.c		\
+  src/allocstats.c	\
+  src/metrics.c		\
+  src/trace.c		\
+  src/profile.c		\
   src/log.c		\
+  src/logfmt.c		\
+  src/evloop.c		\
+  src/workpool.c	\
+  src/control.c		\
   src/parser.c		\
+  src/scan.c		\
+  src/cfgcache.c	\
+  src/cfgquery.c	\
+  src/cfgfrozen.c	\
+  src/cfgwatch.c	\
+  src/cfgschema.c	\
+  src/cfgsnap.c		\
   src/cfgfile.c
+
+nodist_src_gastoold_SOURCES =	\
+  src/cfgschema-table.c
+
+# Compile the directive schema into its lookup table.
+src/cfgschema-table.c: $(srcdir)/src/cfgschema.tab $(srcdir)/src/cfgschema.awk
+	$(AM_V_GEN)rm -f $@-t && \
+	LC_ALL=C $(AWK) -f $(srcdir)/src/cfgschema.awk \
+	  $(srcdir)/src/cfgschema.tab > $@-t && \
+	mv -f $@-t $@
+
+EXTRA_DIST += src/cfgschema.tab src/cfgschema.awk
+BUILT_SOURCES += src/cfgschema-table.c
+CLEANFILES += src/cfgschema-table.c src/cfgschema-table.c-t
+
+# Decode binary logs.
+src_gastool_logdecode_CPPFLAGS = -I$(top_srcdir)/include
+
+src_gastool_logdecode_SOURCES =	\
+  src/logdecode.c		\
+  src/common.c			\
+  src/allocstats.c		\
+  src/metrics.c			\
+  src/trace.c			\
+  src/log.c			\
+  src/logfmt.c
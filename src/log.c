@@ -14,73 +14,1322 @@
    You should have received a copy of the GNU General Public License
    along with this program.  If not, see <https://www.gnu.org/licenses/>. */
 
+
 #include "gasconfig.h"
 
+#define GAS_ALLOC_TAG GAS_ALLOC_LOG
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "common.h"
+#include "logfmt.h"
 #include "log.h"
+#include "metrics.h"
+#include "trace.h"
+
+/* Longer messages are truncated, as are the strings of longer binary
+   records. */
+#define LOG_LINE_MAX 1024
+
+/* The output the writer thread collects for a stderr or file sink
+   before writing it. */
+#define LOG_SINK_BUFSIZE (64 * 1024)
+
+#define LOG_RING_SLOTS_MIN 16
+
+atomic_int log_levels[LOG_SUBSYSTEM_MAX] = {
+    [LOG_CORE] = LOG_INFO,
+    [LOG_CONFIG] = LOG_INFO,
+    [LOG_PARSER] = LOG_INFO
+};
+
+/* The limits of each level, see log_set_rate_limit() and
+   log_set_repeat_window(); the windows are in nanoseconds. */
+static atomic_uint log_rates[LOG_DEBUG + 1];
+static atomic_uint log_bursts[LOG_DEBUG + 1];
+static atomic_uint_least64_t log_repeat_windows[LOG_DEBUG + 1];
+
+/* The call sites that dropped messages; they are never removed. */
+static struct log_site_t *_Atomic log_listed_sites;
+
+static const char *const log_subsystem_names[LOG_SUBSYSTEM_MAX] = {
+    [LOG_CORE] = "core",
+    [LOG_CONFIG] = "config",
+    [LOG_PARSER] = "parser"
+};
+
+static const char *const log_level_short_names[] = {
+    [LOG_EMERG] = "emerg",
+    [LOG_ALERT] = "alert",
+    [LOG_CRIT] = "crit",
+    [LOG_ERR] = "err",
+    [LOG_WARNING] = "warning",
+    [LOG_NOTICE] = "notice",
+    [LOG_INFO] = "info",
+    [LOG_DEBUG] = "debug"
+};
+
+static const struct {
+    const char *name;
+    int level;
+} log_level_names[] = {
+    { "emerg", LOG_EMERG },
+    { "alert", LOG_ALERT },
+    { "crit", LOG_CRIT },
+    { "err", LOG_ERR },
+    { "error", LOG_ERR },
+    { "warning", LOG_WARNING },
+    { "warn", LOG_WARNING },
+    { "notice", LOG_NOTICE },
+    { "info", LOG_INFO },
+    { "debug", LOG_DEBUG }
+};
+
+/* Asynchronous mode. Messages are formatted by the threads that log
+   them, into the slots of a bounded multi-producer ring (Dmitry Vyukov's
+   queue): a producer claims a slot by advancing the enqueue position
+   with a compare and swap, fills it and publishes it through the slot
+   sequence number. A single writer thread takes the published records
+   in order and collects them for the sinks, which it writes to when
+   their buffer is full or the ring is empty. Neither
+   side takes a lock; the writer sleeps on an eventfd that producers only
+   signal when it is asleep. */
+
+struct log_slot_t {
+    /* Equal to the position of the slot when it is free for the
+       producer claiming that position, to the position plus one once the
+       record is published. */
+    atomic_size_t seq;
+
+    int level;
+    size_t len;
+    char data[LOG_LINE_MAX];
+};
+
+static struct log_ring_t {
+    struct log_slot_t *slots;
+    size_t mask;
+
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t enqueue_pos;
+
+    /* Only the writer thread and the crash handler read it. */
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t dequeue_pos;
+
+    _Alignas(CACHE_LINE_SIZE) atomic_bool writer_sleeping;
+    atomic_bool stopping;
+
+    /* Set by log_reopen() for the writer. */
+    atomic_bool reopen;
+    int wakefd;
+
+    /* Messages lost to a full ring with LOG_OVERFLOW_DROP. */
+    atomic_ulong dropped;
+
+    enum log_overflow_t overflow;
+    pthread_t writer;
+} ring;
+
+static atomic_bool log_async = false;
+
+enum log_sink_type_t {
+    /* stderr, a file or, in binary mode, the binary file. */
+    LOG_SINK_FD,
+    LOG_SINK_SYSLOG
+};
+
+struct log_sink_t {
+    enum log_sink_type_t type;
+
+    /* Messages above it are not written to the sink. */
+    int level;
+
+    /* Of a file sink, path is what log_reopen() opens. */
+    int fd;
+    char *path;
+
+    /* The output collected by the writer thread, in asynchronous mode.
+       Only the writer and the crash handler use it. */
+    char *buf;
+    size_t len;
+};
+
+/* The sinks never change once other threads log. */
+static struct log_sink_t log_sinks[LOG_SINKS_MAX] = {
+    { .type = LOG_SINK_FD, .level = LOG_DEBUG, .fd = STDERR_FILENO }
+};
+static int log_nsinks = 1;
+
+/* Whether the only sink is stderr, messages go to until one is added. */
+static bool log_default_sink = true;
+
+/* Binary mode. The ids are given under the lock, and a format record
+   is queued before its id is published: a message using an id is always
+   written after the format record defining it. */
+static atomic_bool log_binary = false;
+static pthread_mutex_t log_sites_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t log_next_id = 1;
+
+/* Messages whose format string cannot be stored in binary are formatted
+   and logged with this one. */
+static struct log_site_t log_text_site = { .format = "%s" };
+
+/* The messages dropped by the limits of a site are reported with these,
+   given the format string of the site. */
+static struct log_site_t log_suppressed_site = {
+    .format = "message \"%s\" suppressed %u times"
+};
+static struct log_site_t log_repeated_site = {
+    .format = "message \"%s\" repeated %u times"
+};
+
+/* The writer thread reports dropped messages with this one. It is given
+   its id when binary mode starts: the writer cannot queue records. */
+static struct log_site_t log_dropped_site = {
+    .format = "%lu log messages dropped"
+};
+
+/* Write a whole buffer, as the writer of a pipe may take less. */
+static void log_write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        buf += n;
+        len -= n;
+    }
+}
+
+/* Format a message, followed by a newline, into buf of LOG_LINE_MAX
+   bytes and return its length. */
+static size_t log_format(char *buf, int errnum, const char *format,
+                         va_list args)
+{
+    size_t len, max = LOG_LINE_MAX - 1;
+    int n;
+
+    n = vsnprintf(buf, max, format, args);
+    len = n < 0 ? 0 : (size_t)n < max ? (size_t)n : max - 1;
+
+    if (errnum && len < max - 1) {
+        char errbuf[ERRBUF_LEN_MAX];
+
+        gas_strerror(errnum, errbuf, sizeof(errbuf));
+        n = snprintf(buf + len, max - len, ": %s", errbuf);
+        len += n < 0 ? 0 : (size_t)n < max - len ? (size_t)n : max - len - 1;
+    }
+
+    buf[len++] = '\n';
+
+    return len;
+}
+
+static size_t log_formatf(char *buf, int errnum, const char *format, ...)
+{
+    va_list args;
+    size_t len;
+
+    va_start(args, format);
+    len = log_format(buf, errnum, format, args);
+    va_end(args);
+
+    return len;
+}
+
+/* Write a record of a message at level to the sinks that take it. Text
+   records end with a newline, which syslog does not want. */
+static void log_write(int level, const char *data, size_t len)
+{
+    struct log_sink_t *sink;
+    int i;
+
+    TRACE_SCOPE("log_write");
+
+    for (i = 0; i < log_nsinks; i++) {
+        sink = &log_sinks[i];
+        if (level > sink->level)
+            continue;
+
+        if (sink->type == LOG_SINK_SYSLOG)
+            syslog(level, "%.*s", (int)len - 1, data);
+        else
+            log_write_all(sink->fd, data, len);
+    }
+}
+
+static void log_sink_flush(struct log_sink_t *sink)
+{
+    log_write_all(sink->fd, sink->buf, sink->len);
+    sink->len = 0;
+}
+
+/* Like log_write(), but for the writer thread: records for stderr and
+   file sinks are only collected, until log_flush_sinks(). */
+static void log_collect(int level, const char *data, size_t len)
+{
+    struct log_sink_t *sink;
+    int i;
+
+    for (i = 0; i < log_nsinks; i++) {
+        sink = &log_sinks[i];
+        if (level > sink->level)
+            continue;
+
+        if (sink->type == LOG_SINK_SYSLOG) {
+            syslog(level, "%.*s", (int)len - 1, data);
+            continue;
+        }
+
+        if (sink->len + len > LOG_SINK_BUFSIZE)
+            log_sink_flush(sink);
+
+        memcpy(sink->buf + sink->len, data, len);
+        sink->len += len;
+    }
+}
+
+static void log_flush_sinks(void)
+{
+    int i;
+
+    for (i = 0; i < log_nsinks; i++) {
+        if (log_sinks[i].type == LOG_SINK_FD && log_sinks[i].len > 0)
+            log_sink_flush(&log_sinks[i]);
+    }
+}
+
+static int log_open_file(const char *path)
+{
+    return open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0640);
+}
+
+/* Open the files of the file sinks again, and put them in place of the
+   previous ones with dup2(): a thread writing to a sink at that moment
+   writes to one file or the other, and no record is lost. */
+static void log_reopen_files(void)
+{
+    char buf[LOG_LINE_MAX];
+    size_t len;
+    int i, fd;
+
+    for (i = 0; i < log_nsinks; i++) {
+        if (log_sinks[i].path == NULL)
+            continue;
+
+        fd = log_open_file(log_sinks[i].path);
+        if (fd < 0 || dup2(fd, log_sinks[i].fd) < 0) {
+            /* Not through the ring: the writer thread may be the
+               caller. */
+            len = log_formatf(buf, errno, "cannot reopen log file '%s'",
+                              log_sinks[i].path);
+            log_write(LOG_ERR, buf, len);
+        }
+
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+static void log_wake_writer(void)
+{
+    /* Pairs with the fence in log_writer(): either the writer sees the
+       published record, or this thread sees it asleep. */
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&ring.writer_sleeping, memory_order_relaxed))
+        eventfd_write(ring.wakefd, 1);
+}
+
+/* Claim a free slot; return NULL if the ring is full. */
+static struct log_slot_t *log_ring_claim(size_t *pos)
+{
+    struct log_slot_t *slot;
+    size_t seq;
+    intptr_t diff;
+
+    *pos = atomic_load_explicit(&ring.enqueue_pos, memory_order_relaxed);
+
+    for (;;) {
+        slot = &ring.slots[*pos & ring.mask];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)*pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring.enqueue_pos, pos,
+                                                      *pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                return slot;
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            *pos = atomic_load_explicit(&ring.enqueue_pos,
+                                        memory_order_relaxed);
+        }
+    }
+}
+
+/* Claim a slot for a record. When the ring is full the record is
+   dropped, and NULL returned, unless the overflow policy or must says
+   to wait for room. */
+static struct log_slot_t *log_ring_reserve(size_t *pos, bool must)
+{
+    static const struct timespec pause = { 0, 1000000 };
+    struct log_slot_t *slot;
+    int spins = 0;
+
+    while ((slot = log_ring_claim(pos)) == NULL) {
+        if (!must && ring.overflow == LOG_OVERFLOW_DROP) {
+            atomic_fetch_add_explicit(&ring.dropped, 1,
+                                      memory_order_relaxed);
+            return NULL;
+        }
+
+        /* Wait for the writer to make room. */
+        log_wake_writer();
+        if (spins++ < 16)
+            sched_yield();
+        else
+            nanosleep(&pause, NULL);
+    }
+
+    return slot;
+}
+
+static void log_ring_publish(struct log_slot_t *slot, size_t pos)
+{
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    log_wake_writer();
+}
+
+/* Return false if the message was dropped. */
+static bool log_print_async(int level, int errnum, const char *format,
+                            va_list args)
+{
+    struct log_slot_t *slot;
+    size_t pos;
+
+    slot = log_ring_reserve(&pos, false);
+    if (slot == NULL)
+        return false;
+
+    slot->level = level;
+    slot->len = log_format(slot->data, errnum, format, args);
+    log_ring_publish(slot, pos);
+
+    return true;
+}
+
+/* Write a record, or queue it in asynchronous mode. Return false if it
+   was dropped. */
+static bool log_emit(const char *record, size_t len, int level, bool must)
+{
+    struct log_slot_t *slot;
+    size_t pos;
+
+    if (!atomic_load_explicit(&log_async, memory_order_acquire)) {
+        log_write(level, record, len);
+        return true;
+    }
+
+    slot = log_ring_reserve(&pos, must);
+    if (slot == NULL)
+        return false;
+
+    memcpy(slot->data, record, len);
+    slot->level = level;
+    slot->len = len;
+    log_ring_publish(slot, pos);
+
+    return true;
+}
+
+/* Give a call site its id, and write the format record defining it. */
+static uint32_t log_site_register(struct log_site_t *site)
+{
+    char buf[LOG_LINE_MAX];
+    struct logfmt_format_t record;
+    size_t len;
+    uint32_t id;
+
+    pthread_mutex_lock(&log_sites_lock);
+
+    id = atomic_load_explicit(&site->id, memory_order_relaxed);
+    if (id == 0) {
+        len = strlen(site->format) + 1;
+
+        site->nargs = logfmt_arg_kinds(site->format, site->kinds);
+        if (sizeof(record) + len > sizeof(buf))
+            site->nargs = -1;
+
+        id = log_next_id++;
+
+        if (site->nargs >= 0) {
+            record.header.size = sizeof(record) + len;
+            record.header.id = LOGFMT_FORMAT_ID;
+            record.format_id = id;
+            memcpy(buf, &record, sizeof(record));
+            memcpy(buf + sizeof(record), site->format, len);
+
+            /* Never dropped: it would make its messages unreadable. */
+            log_emit(buf, record.header.size, LOG_EMERG, true);
+        }
+
+        atomic_store_explicit(&site->id, id, memory_order_release);
+    }
+
+    pthread_mutex_unlock(&log_sites_lock);
+
+    return id;
+}
+
+static uint32_t log_site_id(struct log_site_t *site)
+{
+    uint32_t id = atomic_load_explicit(&site->id, memory_order_acquire);
+
+    return id != 0 ? id : log_site_register(site);
+}
+
+#define LOG_PUT(buf, len, value)                        \
+    do {                                                \
+        memcpy((buf) + (len), &(value), sizeof(value)); \
+        (len) += sizeof(value);                         \
+    } while (0)
+
+/* Encode a message record of site into buf, of LOG_LINE_MAX bytes, and
+   return its size. Strings are cut to make the record fit. */
+static size_t log_encode(char *buf, struct log_site_t *site,
+                         enum log_subsystem_t subsystem, int level,
+                         int errnum, va_list args)
+{
+    struct logfmt_message_t msg;
+    struct timespec now;
+    size_t len = sizeof(msg), n, room;
+    const char *string;
+    uint32_t n32;
+    int64_t i64;
+    double d;
+    int i, v;
+
+    for (i = 0; i < site->nargs; i++) {
+        switch (site->kinds[i]) {
+        case LOGFMT_ARG_INT:
+            v = va_arg(args, int);
+            LOG_PUT(buf, len, v);
+            break;
+        case LOGFMT_ARG_LONG:
+            i64 = va_arg(args, long);
+            LOG_PUT(buf, len, i64);
+            break;
+        case LOGFMT_ARG_LLONG:
+            i64 = va_arg(args, long long);
+            LOG_PUT(buf, len, i64);
+            break;
+        case LOGFMT_ARG_SIZE:
+            i64 = va_arg(args, size_t);
+            LOG_PUT(buf, len, i64);
+            break;
+        case LOGFMT_ARG_INTMAX:
+            i64 = va_arg(args, intmax_t);
+            LOG_PUT(buf, len, i64);
+            break;
+        case LOGFMT_ARG_PTRDIFF:
+            i64 = va_arg(args, ptrdiff_t);
+            LOG_PUT(buf, len, i64);
+            break;
+        case LOGFMT_ARG_DOUBLE:
+            d = va_arg(args, double);
+            LOG_PUT(buf, len, d);
+            break;
+        case LOGFMT_ARG_POINTER:
+            i64 = (intptr_t)va_arg(args, void *);
+            LOG_PUT(buf, len, i64);
+            break;
+        case LOGFMT_ARG_STRING:
+            string = va_arg(args, const char *);
+            if (string == NULL)
+                string = "(null)";
+
+            /* Leave room for the other arguments, 8 bytes at most. */
+            room = LOG_LINE_MAX - len - sizeof(n32)
+                   - 8 * (site->nargs - i - 1);
+            n = strnlen(string, room);
+            n32 = n;
+            LOG_PUT(buf, len, n32);
+            memcpy(buf + len, string, n);
+            len += n;
+            break;
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    msg.header.size = len;
+    msg.header.id = atomic_load_explicit(&site->id, memory_order_relaxed);
+    msg.time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    msg.level = level;
+    msg.subsystem = subsystem;
+    msg.reserved = 0;
+    msg.errnum = errnum;
+    memcpy(buf, &msg, sizeof(msg));
+
+    return len;
+}
+
+static size_t log_encodef(char *buf, struct log_site_t *site,
+                          enum log_subsystem_t subsystem, int level,
+                          int errnum, ...)
+{
+    va_list args;
+    size_t len;
+
+    va_start(args, errnum);
+    len = log_encode(buf, site, subsystem, level, errnum, args);
+    va_end(args);
+
+    return len;
+}
+
+/* Encode a message record into buf, of LOG_LINE_MAX bytes, and return
+   its size. */
+static size_t log_encode_message(char *buf, struct log_site_t *site,
+                                 enum log_subsystem_t subsystem, int level,
+                                 int errnum, const char *format,
+                                 va_list args)
+{
+    char text[LOG_LINE_MAX];
+
+    log_site_id(site);
+
+    if (site->nargs >= 0)
+        return log_encode(buf, site, subsystem, level, errnum, args);
+
+    vsnprintf(text, sizeof(text), format, args);
+    return log_encodef(buf, &log_text_site, subsystem, level, errnum, text);
+}
+
+static void log_report_dropped(void)
+{
+    char buf[LOG_LINE_MAX];
+    unsigned long dropped;
+    int n;
+
+    dropped = atomic_exchange_explicit(&ring.dropped, 0,
+                                       memory_order_relaxed);
+    if (dropped == 0)
+        return;
+
+    if (atomic_load(&log_binary)) {
+        n = log_encodef(buf, &log_dropped_site, LOG_CORE, LOG_WARNING, 0,
+                        dropped);
+    } else {
+        n = snprintf(buf, sizeof(buf), "%lu log messages dropped\n",
+                     dropped);
+    }
+
+    log_write(LOG_WARNING, buf, n);
+}
+
+/* Take the published records, free their slots and write them to the
+   sinks. Return the number of records taken. */
+static size_t log_ring_drain(void)
+{
+    struct log_slot_t *slot;
+    size_t pos, total = 0;
+
+    TRACE_SCOPE("log_ring_drain");
+
+    pos = atomic_load_explicit(&ring.dequeue_pos, memory_order_relaxed);
+
+    for (;; pos++) {
+        slot = &ring.slots[pos & ring.mask];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1)
+            break;
+
+        log_collect(slot->level, slot->data, slot->len);
+
+        atomic_store_explicit(&slot->seq, pos + ring.mask + 1,
+                              memory_order_release);
+        atomic_store_explicit(&ring.dequeue_pos, pos + 1,
+                              memory_order_relaxed);
+        total++;
+    }
+
+    log_flush_sinks();
+
+    return total;
+}
+
+static bool log_ring_empty(void)
+{
+    size_t pos = atomic_load_explicit(&ring.dequeue_pos,
+                                      memory_order_relaxed);
+
+    return atomic_load_explicit(&ring.slots[pos & ring.mask].seq,
+                                memory_order_acquire) != pos + 1;
+}
+
+static void *log_writer(void *arg)
+{
+    eventfd_t value;
+
+    (void)arg;
+
+    for (;;) {
+        if (log_ring_drain() > 0) {
+            log_report_dropped();
+            continue;
+        }
+
+        /* Every record queued before the request goes to the previous
+           files. */
+        if (atomic_exchange(&ring.reopen, false)) {
+            log_reopen_files();
+            continue;
+        }
+
+        if (atomic_load(&ring.stopping))
+            break;
+
+        atomic_store(&ring.writer_sleeping, true);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if (log_ring_empty() && !atomic_load(&ring.stopping)
+            && !atomic_load(&ring.reopen))
+            eventfd_read(ring.wakefd, &value);
+
+        atomic_store(&ring.writer_sleeping, false);
+    }
+
+    log_report_dropped();
+
+    return NULL;
+}
+
+/* On a fatal signal, write what the writer thread has not written yet
+   and let the signal take its default action. Records the writer was
+   writing at that moment may come out twice. syslog() cannot be called
+   here: syslog sinks lose the pending records. */
+static void log_crash_handler(int signum)
+{
+    struct log_sink_t *sink;
+    struct log_slot_t *slot;
+    size_t pos;
+    int i;
+
+    for (i = 0; i < log_nsinks; i++) {
+        if (log_sinks[i].type == LOG_SINK_FD)
+            log_write_all(log_sinks[i].fd, log_sinks[i].buf,
+                          log_sinks[i].len);
+    }
+
+    pos = atomic_load_explicit(&ring.dequeue_pos, memory_order_relaxed);
+
+    for (;; pos++) {
+        slot = &ring.slots[pos & ring.mask];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire)
+            != pos + 1)
+            break;
+
+        for (i = 0; i < log_nsinks; i++) {
+            sink = &log_sinks[i];
+            if (sink->type == LOG_SINK_FD && slot->level <= sink->level)
+                log_write_all(sink->fd, slot->data, slot->len);
+        }
+    }
+
+    raise(signum);
+}
 
-/* Default log level. */
-static int default_log_level = LOG_INFO;
+static void log_crash_handlers(void)
+{
+    static const int signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+    struct sigaction action;
+    size_t i;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = log_crash_handler;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+
+    for (i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+        sigaction(signals[i], &action, NULL);
+}
+
+int log_start_async(size_t bufsize, enum log_overflow_t overflow)
+{
+    size_t nslots = LOG_RING_SLOTS_MIN, i;
+    int result, j;
+
+    if (atomic_load(&log_async))
+        return GAS_SUCCESS;
+
+    while (nslots * 2 * sizeof(struct log_slot_t) <= bufsize)
+        nslots *= 2;
+
+    ring.wakefd = eventfd(0, EFD_CLOEXEC);
+    if (ring.wakefd < 0) {
+        log_print(LOG_ERR, errno, "cannot create log writer event");
+        return -GAS_FAILURE;
+    }
+
+    ring.slots = gas_aligned_alloc(64, nslots * sizeof(*ring.slots));
+    ring.mask = nslots - 1;
+    for (i = 0; i < nslots; i++)
+        atomic_init(&ring.slots[i].seq, i);
+
+    atomic_init(&ring.enqueue_pos, 0);
+    atomic_init(&ring.dequeue_pos, 0);
+    atomic_init(&ring.writer_sleeping, false);
+    atomic_init(&ring.stopping, false);
+    atomic_init(&ring.reopen, false);
+    atomic_init(&ring.dropped, 0);
+    ring.overflow = overflow;
+
+    for (j = 0; j < log_nsinks; j++) {
+        if (log_sinks[j].type == LOG_SINK_FD && log_sinks[j].buf == NULL)
+            log_sinks[j].buf = gas_malloc(LOG_SINK_BUFSIZE);
+    }
+
+    result = gas_thread_create(&ring.writer, log_writer, NULL);
+    if (result != 0) {
+        log_print(LOG_ERR, result, "cannot start log writer thread");
+        close(ring.wakefd);
+        gas_free(ring.slots);
+        return -GAS_FAILURE;
+    }
+
+    log_crash_handlers();
+    atexit(log_stop_async);
+
+    atomic_store(&log_async, true);
+
+    return GAS_SUCCESS;
+}
+
+int log_start_binary(const char *path)
+{
+    int fd;
+
+    if (atomic_load(&log_async) || atomic_load(&log_binary)
+        || !log_default_sink) {
+        errno = EBUSY;
+        return -GAS_FAILURE;
+    }
+
+    fd = log_open_file(path);
+    if (fd < 0) {
+        log_print(LOG_ERR, errno, "cannot open log file '%s'", path);
+        return -GAS_FAILURE;
+    }
+
+    log_write_all(fd, LOGFMT_MAGIC, LOGFMT_MAGIC_LEN);
+
+    log_sinks[0].fd = fd;
+    log_default_sink = false;
+
+    log_site_id(&log_text_site);
+    log_site_id(&log_suppressed_site);
+    log_site_id(&log_repeated_site);
+    log_site_id(&log_dropped_site);
 
-static void log_write(int level, const char *message)
+    atomic_store(&log_binary, true);
+
+    return GAS_SUCCESS;
+}
+
+static int log_add_sink(const struct log_sink_t *sink)
 {
-    if (level > default_log_level)
+    if (atomic_load(&log_async) || atomic_load(&log_binary)) {
+        errno = EBUSY;
+        return -GAS_FAILURE;
+    }
+
+    if (log_default_sink) {
+        log_nsinks = 0;
+        log_default_sink = false;
+    } else if (log_nsinks == LOG_SINKS_MAX) {
+        errno = ENOSPC;
+        return -GAS_FAILURE;
+    }
+
+    log_sinks[log_nsinks++] = *sink;
+
+    return GAS_SUCCESS;
+}
+
+static bool log_level_valid(int level)
+{
+    if (0 > level || level > LOG_DEBUG) {
+        errno = EINVAL;
+        return false;
+    }
+
+    return true;
+}
+
+int log_add_stderr(int level)
+{
+    struct log_sink_t sink = {
+        .type = LOG_SINK_FD,
+        .level = level,
+        .fd = STDERR_FILENO
+    };
+
+    if (!log_level_valid(level))
+        return -GAS_FAILURE;
+
+    return log_add_sink(&sink);
+}
+
+int log_add_file(const char *path, int level)
+{
+    struct log_sink_t sink = {
+        .type = LOG_SINK_FD,
+        .level = level
+    };
+
+    if (!log_level_valid(level))
+        return -GAS_FAILURE;
+
+    sink.fd = log_open_file(path);
+    if (sink.fd < 0) {
+        log_print(LOG_ERR, errno, "cannot open log file '%s'", path);
+        return -GAS_FAILURE;
+    }
+
+    sink.path = gas_strdup(path);
+
+    if (log_add_sink(&sink) < 0) {
+        close(sink.fd);
+        gas_free(sink.path);
+        return -GAS_FAILURE;
+    }
+
+    return GAS_SUCCESS;
+}
+
+int log_add_syslog(const char *ident, int level)
+{
+    struct log_sink_t sink = {
+        .type = LOG_SINK_SYSLOG,
+        .level = level,
+        .fd = -1
+    };
+
+    if (!log_level_valid(level))
+        return -GAS_FAILURE;
+
+    if (log_add_sink(&sink) < 0)
+        return -GAS_FAILURE;
+
+    openlog(ident, LOG_PID | LOG_NDELAY, LOG_DAEMON);
+
+    return GAS_SUCCESS;
+}
+
+void log_reopen(void)
+{
+    if (atomic_load(&log_async)) {
+        atomic_store(&ring.reopen, true);
+        eventfd_write(ring.wakefd, 1);
+    } else {
+        log_reopen_files();
+    }
+}
+
+void log_stop_async(void)
+{
+    if (!atomic_exchange(&log_async, false))
         return;
 
-    /* Write only to stderr for now. */
-    fprintf(stderr, "%s\n", message);
+    atomic_store(&ring.stopping, true);
+    eventfd_write(ring.wakefd, 1);
+    pthread_join(ring.writer, NULL);
+
+    /* Records published after the writer saw the flag. */
+    log_ring_drain();
+    log_report_dropped();
 
-    fflush(stderr);
+    /* The ring stays: a thread still logging may hold a slot. */
 }
 
-static void log_print_internal(int level, int errnum, const char *format,
-                               va_list args)
+static uint64_t log_clock(void)
 {
-    char *logbuf;
-    size_t size;
-    FILE *stream;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
 
-    stream = open_memstream(&logbuf, &size);
-    if (stream == NULL)
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* List a site for log_report_suppressed(), the first time it drops a
+   message. */
+static void log_site_list(struct log_site_t *site,
+                          enum log_subsystem_t subsystem, int level)
+{
+    if (atomic_load_explicit(&site->listed, memory_order_relaxed)
+        || atomic_exchange(&site->listed, true))
         return;
 
-    vfprintf(stream, format, args);
+    site->subsystem = subsystem;
+    site->level = level;
 
-    if (errnum) {
-        char errbuf[ERRBUF_LEN_MAX];
+    site->next = atomic_load_explicit(&log_listed_sites,
+                                      memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&log_listed_sites,
+                                                  &site->next, site,
+                                                  memory_order_release,
+                                                  memory_order_relaxed))
+        ;
+}
 
-        gas_strerror(errnum, errbuf, sizeof(errbuf));
-        fprintf(stream, ": %s", errbuf);
+/* The token bucket of a site, kept as the time its next message is due
+   (the generic cell rate algorithm): a message is let through if it
+   comes no more than burst - 1 intervals early, and moves the due time
+   one interval on. A dropped message costs a clock read and an atomic
+   increment. */
+static bool log_rate_allow(struct log_site_t *site,
+                           enum log_subsystem_t subsystem, int level)
+{
+    unsigned int rate = atomic_load_explicit(&log_rates[level],
+                                             memory_order_relaxed);
+    uint64_t now, due, next, interval, tolerance;
+
+    if (rate == 0)
+        return true;
+
+    interval = 1000000000 / rate;
+    tolerance = interval * (atomic_load_explicit(&log_bursts[level],
+                                                 memory_order_relaxed) - 1);
+
+    now = log_clock();
+    due = atomic_load_explicit(&site->due, memory_order_relaxed);
+
+    do {
+        if (due > now + tolerance) {
+            atomic_fetch_add_explicit(&site->suppressed, 1,
+                                      memory_order_relaxed);
+            log_site_list(site, subsystem, level);
+            return false;
+        }
+
+        next = (due > now ? due : now) + interval;
+    } while (!atomic_compare_exchange_weak_explicit(&site->due, &due, next,
+                                                    memory_order_relaxed,
+                                                    memory_order_relaxed));
+
+    return true;
+}
+
+/* Return whether a message of a site, its record of len bytes without
+   the time, is the same as the last one the site wrote less than window
+   nanoseconds before; count it if so. Threads logging different
+   messages at the same site at once may miss a repeat. */
+static bool log_repeated(struct log_site_t *site,
+                         enum log_subsystem_t subsystem, int level,
+                         int errnum, const char *record, size_t len,
+                         uint64_t window)
+{
+    uint64_t hash = gas_hash64(record, len) ^ (uint64_t)errnum;
+    uint64_t now = log_clock();
+
+    if (hash == atomic_load_explicit(&site->last_hash, memory_order_relaxed)
+        && now - atomic_load_explicit(&site->last_time,
+                                      memory_order_relaxed) < window) {
+        atomic_fetch_add_explicit(&site->repeats, 1, memory_order_relaxed);
+        log_site_list(site, subsystem, level);
+        return true;
     }
 
-    fclose(stream);
+    atomic_store_explicit(&site->last_hash, hash, memory_order_relaxed);
+    atomic_store_explicit(&site->last_time, now, memory_order_relaxed);
+
+    return false;
+}
+
+static void log_note(struct log_site_t *note, enum log_subsystem_t subsystem,
+                     int level, const char *format, unsigned int count)
+{
+    char buf[LOG_LINE_MAX];
+    size_t len;
+
+    if (atomic_load_explicit(&log_binary, memory_order_acquire))
+        len = log_encodef(buf, note, subsystem, level, 0, format, count);
+    else
+        len = log_formatf(buf, 0, note->format, format, count);
+
+    log_emit(buf, len, level, false);
+}
+
+/* Log the messages a site dropped since its last one. */
+static void log_report_site(struct log_site_t *site,
+                            enum log_subsystem_t subsystem, int level)
+{
+    unsigned int count;
 
-    log_write(level, logbuf);
+    if (!atomic_load_explicit(&site->listed, memory_order_relaxed))
+        return;
 
-    free(logbuf);
+    count = atomic_exchange_explicit(&site->suppressed, 0,
+                                     memory_order_relaxed);
+    if (count > 0)
+        log_note(&log_suppressed_site, subsystem, level, site->format,
+                 count);
+
+    count = atomic_exchange_explicit(&site->repeats, 0, memory_order_relaxed);
+    if (count > 0)
+        log_note(&log_repeated_site, subsystem, level, site->format, count);
 }
 
-void log_print(int level, int errnum, const char *format, ...)
+void log_report_suppressed(void)
 {
+    struct log_site_t *site;
+
+    for (site = atomic_load_explicit(&log_listed_sites, memory_order_acquire);
+         site != NULL; site = site->next)
+        log_report_site(site, site->subsystem, site->level);
+}
+
+void log_message(struct log_site_t *site, enum log_subsystem_t subsystem,
+                 int level, int errnum, const char *format, ...)
+{
+    char buf[LOG_LINE_MAX];
     va_list args;
+    uint64_t window;
+    size_t len, skip = 0;
+    bool written;
+
+    TRACE_SCOPE("log_message");
+
+    if (!log_rate_allow(site, subsystem, level)) {
+        metrics_add(METRIC_LOG_DROPPED + level, 1);
+        return;
+    }
+
+    window = atomic_load_explicit(&log_repeat_windows[level],
+                                  memory_order_relaxed);
 
     va_start(args, format);
-    log_print_internal(level, errnum, format, args);
+
+    if (atomic_load_explicit(&log_binary, memory_order_acquire)) {
+        len = log_encode_message(buf, site, subsystem, level, errnum, format,
+                                 args);
+        skip = sizeof(struct logfmt_message_t);
+    } else if (window == 0
+               && atomic_load_explicit(&log_async, memory_order_acquire)) {
+        /* Formatted right into the ring. */
+        log_report_site(site, subsystem, level);
+        written = log_print_async(level, errnum, format, args);
+        va_end(args);
+
+        metrics_add((written ? METRIC_LOG_WRITTEN : METRIC_LOG_DROPPED)
+                    + level, 1);
+        return;
+    } else {
+        len = log_format(buf, errnum, format, args);
+    }
+
     va_end(args);
+
+    if (window > 0 && log_repeated(site, subsystem, level, errnum,
+                                   buf + skip, len - skip, window)) {
+        metrics_add(METRIC_LOG_DROPPED + level, 1);
+        return;
+    }
+
+    log_report_site(site, subsystem, level);
+
+    /* In synchronous mode, one write per message and sink: lines of
+       different threads do not mix. */
+    written = log_emit(buf, len, level, false);
+
+    metrics_add((written ? METRIC_LOG_WRITTEN : METRIC_LOG_DROPPED) + level,
+                1);
 }
 
 int log_set_default_level(int level)
 {
+    int i;
+
     if (0 > level || level > LOG_PRIMASK) {
         errno = EINVAL;
         return -GAS_FAILURE;
     }
 
-    default_log_level = level;
+    for (i = 0; i < LOG_SUBSYSTEM_MAX; i++)
+        atomic_store_explicit(&log_levels[i], level, memory_order_relaxed);
+
+    return GAS_SUCCESS;
+}
+
+int log_set_level(enum log_subsystem_t subsystem, int level)
+{
+    if (0 > level || level > LOG_PRIMASK
+        || subsystem < 0 || subsystem >= LOG_SUBSYSTEM_MAX) {
+        errno = EINVAL;
+        return -GAS_FAILURE;
+    }
+
+    atomic_store_explicit(&log_levels[subsystem], level,
+                          memory_order_relaxed);
+    return GAS_SUCCESS;
+}
+
+int log_set_rate_limit(int level, int rate, int burst)
+{
+    if (!log_level_valid(level))
+        return -GAS_FAILURE;
+
+    if (rate < 0 || burst < 0) {
+        errno = EINVAL;
+        return -GAS_FAILURE;
+    }
+
+    atomic_store_explicit(&log_bursts[level], burst > 0 ? burst : 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&log_rates[level], rate, memory_order_relaxed);
+
+    return GAS_SUCCESS;
+}
+
+int log_set_repeat_window(int level, long window)
+{
+    if (!log_level_valid(level))
+        return -GAS_FAILURE;
+
+    if (window < 0) {
+        errno = EINVAL;
+        return -GAS_FAILURE;
+    }
+
+    atomic_store_explicit(&log_repeat_windows[level],
+                          (uint64_t)window * 1000000, memory_order_relaxed);
+
+    return GAS_SUCCESS;
+}
+
+int log_level_find(const char *name)
+{
+    size_t i;
+
+    if (name[0] >= '0' && name[0] <= '7' && name[1] == '\0')
+        return name[0] - '0';
+
+    for (i = 0; i < sizeof(log_level_names) / sizeof(log_level_names[0]);
+         i++) {
+        if (strcasecmp(name, log_level_names[i].name) == 0)
+            return log_level_names[i].level;
+    }
+
+    return -1;
+}
+
+const char *log_level_name(int level)
+{
+    if (level < 0 || level > LOG_DEBUG)
+        return "?";
+
+    return log_level_short_names[level];
+}
+
+const char *log_subsystem_name(int subsystem)
+{
+    if (subsystem < 0 || subsystem >= LOG_SUBSYSTEM_MAX)
+        return "?";
+
+    return log_subsystem_names[subsystem];
+}
+
+int log_subsystem_find(const char *name)
+{
+    int i;
+
+    for (i = 0; i < LOG_SUBSYSTEM_MAX; i++) {
+        if (strcasecmp(name, log_subsystem_names[i]) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+/* Parse one item of a level list into *subsystem, -1 for all, and
+   *level. The item is modified. */
+static int log_parse_level_item(char *item, int *subsystem, int *level)
+{
+    char *eq = strchr(item, '=');
+
+    *subsystem = -1;
+    if (eq != NULL) {
+        *eq = '\0';
+        *subsystem = log_subsystem_find(item);
+        if (*subsystem < 0)
+            return -GAS_FAILURE;
+        item = eq + 1;
+    }
+
+    *level = log_level_find(item);
+    return *level < 0 ? -GAS_FAILURE : GAS_SUCCESS;
+}
+
+int log_set_levels(const char *spec)
+{
+    int levels[LOG_SUBSYSTEM_MAX], subsystem, level, i;
+    char *copy, *item, *save;
+    int result = GAS_SUCCESS;
+
+    for (i = 0; i < LOG_SUBSYSTEM_MAX; i++)
+        levels[i] = atomic_load_explicit(&log_levels[i],
+                                         memory_order_relaxed);
+
+    copy = gas_strdup(spec);
+
+    for (item = strtok_r(copy, ",", &save); item != NULL;
+         item = strtok_r(NULL, ",", &save)) {
+        if (log_parse_level_item(item, &subsystem, &level) < 0) {
+            result = -GAS_FAILURE;
+            break;
+        }
+
+        for (i = 0; i < LOG_SUBSYSTEM_MAX; i++) {
+            if (subsystem < 0 || subsystem == i)
+                levels[i] = level;
+        }
+    }
+
+    gas_free(copy);
+
+    if (result < 0) {
+        errno = EINVAL;
+        return result;
+    }
+
+    for (i = 0; i < LOG_SUBSYSTEM_MAX; i++)
+        atomic_store_explicit(&log_levels[i], levels[i],
+                              memory_order_relaxed);
+
     return GAS_SUCCESS;
 }
@@ -0,0 +1,433 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+
+#include "gasconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+
+#include "common.h"
+#include "log.h"
+#include "logfmt.h"
+
+#define PROGRAM_AUTHOR \
+    "Guilherme de A. Suckevicz"
+
+/* String containing name the program is called with.
+   To be initialized by main(). */
+static const char *program_name = NULL;
+
+enum {
+    HELP_OPTION = CHAR_MAX + 1,
+    VERSION_OPTION
+};
+
+static struct option const long_options[] = {
+    {"help", no_argument, NULL, HELP_OPTION},
+    {"version", no_argument, NULL, VERSION_OPTION},
+    {NULL, 0, NULL, 0}
+};
+
+/* The format strings of the current stream, by id. */
+static char **formats = NULL;
+static size_t nformats = 0;
+
+/* Ids are given in order, and only the formats too long to be written
+   skip theirs: an id this far past the known ones is corrupt. */
+#define FORMAT_ID_SKIP_MAX 4096
+
+static void usage(int status)
+{
+    if (status != EXIT_SUCCESS) {
+        fprintf(stderr, "Try '%s --help' for more information.\n",
+                program_name);
+    } else {
+        printf("Usage: %s [OPTION]... [FILE]...\n", program_name);
+
+        fputs("\
+Write the messages of binary gastoold log FILEs as text.\n\
+\n\
+With no FILE, or when FILE is -, read standard input.\n\
+\n\
+      --help     display this help and exit\n\
+      --version  output version information and exit\n", stdout);
+
+        fputc('\n', stdout);
+
+        printf("Report bugs to: <%s>.\n", PACKAGE_BUGREPORT);
+        printf("%s home page: <%s>.\n", PACKAGE_NAME, PACKAGE_URL);
+    }
+
+    exit(status);
+}
+
+static void print_version(void)
+{
+    printf("%s %s\n", program_name, PACKAGE_VERSION);
+
+    printf("\
+License GPLv3+: GNU GPL version 3 or later <%s>.\n\
+This is free software: you are free to change and redistribute it.\n\
+There is NO WARRANTY, to the extent permitted by law.\n\
+",
+           "https://gnu.org/licenses/gpl.html");
+
+    fputc('\n', stdout);
+
+    printf("Written by %s.\n", PROGRAM_AUTHOR);
+
+    exit(EXIT_SUCCESS);
+}
+
+static void reset_formats(void)
+{
+    size_t i;
+
+    for (i = 0; i < nformats; i++)
+        gas_free(formats[i]);
+
+    gas_free(formats);
+    formats = NULL;
+    nformats = 0;
+}
+
+static void set_format(uint32_t id, const char *format)
+{
+    size_t count = (size_t)id + 1;
+
+    if (count > nformats) {
+        formats = gas_realloc(formats, count * sizeof(*formats));
+        memset(formats + nformats, 0,
+               (count - nformats) * sizeof(*formats));
+        nformats = count;
+    }
+
+    gas_free(formats[id]);
+    formats[id] = gas_strdup(format);
+}
+
+/* The arguments of a message record being decoded. */
+struct decode_t {
+    const char *p;
+    const char *end;
+    bool truncated;
+};
+
+static bool take(struct decode_t *d, void *value, size_t size)
+{
+    if ((size_t)(d->end - d->p) < size) {
+        d->truncated = true;
+        return false;
+    }
+
+    memcpy(value, d->p, size);
+    d->p += size;
+    return true;
+}
+
+static int print_text(const char *s, size_t len, void *arg)
+{
+    (void)arg;
+
+    fwrite(s, 1, len, stdout);
+    return 0;
+}
+
+#define PRINT_CONV(spec, nstars, stars, value)                          \
+    do {                                                                \
+        if ((nstars) == 0)                                              \
+            printf((spec), (value));                                    \
+        else if ((nstars) == 1)                                         \
+            printf((spec), (stars)[0], (value));                        \
+        else                                                            \
+            printf((spec), (stars)[0], (stars)[1], (value));            \
+    } while (0)
+
+/* Print one conversion with its stored arguments. The specification is
+   rebuilt with the length modifier of the stored type. */
+static int print_conv(const struct logfmt_conv_t *conv, void *arg)
+{
+    struct decode_t *d = arg;
+    char spec[64], *string;
+    size_t len = conv->len - 1;
+    enum logfmt_arg_t kind = conv->args[conv->nargs - 1];
+    int stars[2], nstars = conv->nargs - 1, i, v;
+    int64_t i64;
+    uint32_t n;
+    double dbl;
+
+    for (i = 0; i < nstars; i++) {
+        if (!take(d, &stars[i], sizeof(stars[i])))
+            return -1;
+    }
+
+    while (len > 0 && strchr("hlzjtL", conv->spec[len - 1]) != NULL)
+        len--;
+    if (len > sizeof(spec) - 4)
+        return -1;
+    memcpy(spec, conv->spec, len);
+
+    switch (kind) {
+    case LOGFMT_ARG_INT:
+        /* Keep hh and h: they change the output. */
+        memcpy(spec + len, conv->spec + len, conv->len - len);
+        spec[conv->len] = '\0';
+        if (!take(d, &v, sizeof(v)))
+            return -1;
+        PRINT_CONV(spec, nstars, stars, v);
+        break;
+
+    case LOGFMT_ARG_LONG:
+    case LOGFMT_ARG_LLONG:
+    case LOGFMT_ARG_SIZE:
+    case LOGFMT_ARG_INTMAX:
+    case LOGFMT_ARG_PTRDIFF:
+        spec[len] = 'l';
+        spec[len + 1] = 'l';
+        spec[len + 2] = conv->spec[conv->len - 1];
+        spec[len + 3] = '\0';
+        if (!take(d, &i64, sizeof(i64)))
+            return -1;
+        PRINT_CONV(spec, nstars, stars, (long long)i64);
+        break;
+
+    case LOGFMT_ARG_DOUBLE:
+        spec[len] = conv->spec[conv->len - 1];
+        spec[len + 1] = '\0';
+        if (!take(d, &dbl, sizeof(dbl)))
+            return -1;
+        PRINT_CONV(spec, nstars, stars, dbl);
+        break;
+
+    case LOGFMT_ARG_POINTER:
+        spec[len] = 'p';
+        spec[len + 1] = '\0';
+        if (!take(d, &i64, sizeof(i64)))
+            return -1;
+        PRINT_CONV(spec, nstars, stars, (void *)(intptr_t)i64);
+        break;
+
+    case LOGFMT_ARG_STRING:
+        spec[len] = 's';
+        spec[len + 1] = '\0';
+        if (!take(d, &n, sizeof(n)) || (size_t)(d->end - d->p) < n) {
+            d->truncated = true;
+            return -1;
+        }
+        string = gas_malloc(n + 1);
+        memcpy(string, d->p, n);
+        string[n] = '\0';
+        d->p += n;
+        PRINT_CONV(spec, nstars, stars, string);
+        gas_free(string);
+        break;
+    }
+
+    return 0;
+}
+
+static void print_message(const struct logfmt_message_t *msg,
+                          const char *args, const char *end)
+{
+    struct decode_t d = { args, end, false };
+    char date[32], errbuf[ERRBUF_LEN_MAX];
+    const char *format = NULL;
+    time_t seconds = msg->time / 1000000000;
+    struct tm tm;
+
+    localtime_r(&seconds, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+
+    printf("%s.%06u %s %s: ", date,
+           (unsigned int)(msg->time % 1000000000 / 1000),
+           log_level_name(msg->level), log_subsystem_name(msg->subsystem));
+
+    if (msg->header.id < nformats)
+        format = formats[msg->header.id];
+
+    if (format == NULL)
+        printf("(message with unknown format %u)", msg->header.id);
+    else if (logfmt_parse(format, print_conv, print_text, &d) < 0
+             || d.truncated)
+        printf(" (bad arguments)");
+
+    if (msg->errnum)
+        printf(": %s", gas_strerror(msg->errnum, errbuf, sizeof(errbuf)));
+
+    putchar('\n');
+}
+
+/* Read a whole stream; a log is written by one process at a time, so
+   records may refer to format records anywhere before them. */
+static char *read_stream(FILE *stream, size_t *size)
+{
+    size_t alloc = 64 * 1024, n;
+    char *buf = gas_malloc(alloc);
+
+    *size = 0;
+    while ((n = fread(buf + *size, 1, alloc - *size, stream)) > 0) {
+        *size += n;
+        if (*size == alloc) {
+            alloc *= 2;
+            buf = gas_realloc(buf, alloc);
+        }
+    }
+
+    return buf;
+}
+
+static int decode(const char *filename, const char *buf, size_t size)
+{
+    struct logfmt_record_t header;
+    struct logfmt_format_t fmt;
+    struct logfmt_message_t msg;
+    size_t pos = 0;
+
+    while (pos < size) {
+        if (size - pos >= LOGFMT_MAGIC_LEN
+            && memcmp(buf + pos, LOGFMT_MAGIC, LOGFMT_MAGIC_LEN) == 0) {
+            reset_formats();
+            pos += LOGFMT_MAGIC_LEN;
+            continue;
+        }
+
+        if (size - pos < sizeof(header))
+            goto decode_truncated;
+
+        memcpy(&header, buf + pos, sizeof(header));
+        if (header.size > size - pos)
+            goto decode_truncated;
+
+        if (header.id == LOGFMT_FORMAT_ID) {
+            if (header.size <= sizeof(fmt)
+                || buf[pos + header.size - 1] != '\0')
+                goto decode_corrupt;
+
+            memcpy(&fmt, buf + pos, sizeof(fmt));
+            if (fmt.format_id == LOGFMT_FORMAT_ID
+                || fmt.format_id > nformats + FORMAT_ID_SKIP_MAX)
+                goto decode_corrupt;
+
+            set_format(fmt.format_id, buf + pos + sizeof(fmt));
+        } else {
+            if (header.size < sizeof(msg))
+                goto decode_corrupt;
+
+            memcpy(&msg, buf + pos, sizeof(msg));
+            print_message(&msg, buf + pos + sizeof(msg),
+                          buf + pos + header.size);
+        }
+
+        pos += header.size;
+    }
+
+    return GAS_SUCCESS;
+
+decode_truncated:
+    /* A process killed while writing. */
+    fprintf(stderr, "%s: %s: truncated record at offset %zu\n",
+            program_name, filename, pos);
+    return -GAS_FAILURE;
+
+decode_corrupt:
+    fprintf(stderr, "%s: %s: corrupt record at offset %zu\n",
+            program_name, filename, pos);
+    return -GAS_FAILURE;
+}
+
+static int decode_file(const char *filename)
+{
+    FILE *stream;
+    char *buf;
+    size_t size;
+    int result;
+
+    if (strcmp(filename, "-") == 0) {
+        stream = stdin;
+        filename = "standard input";
+    } else {
+        stream = fopen(filename, "rb");
+        if (stream == NULL) {
+            fprintf(stderr, "%s: %s: %s\n", program_name, filename,
+                    strerror(errno));
+            return -GAS_FAILURE;
+        }
+    }
+
+    buf = read_stream(stream, &size);
+    if (ferror(stream)) {
+        fprintf(stderr, "%s: %s: %s\n", program_name, filename,
+                strerror(errno));
+        result = -GAS_FAILURE;
+    } else if (size < LOGFMT_MAGIC_LEN
+               || memcmp(buf, LOGFMT_MAGIC, LOGFMT_MAGIC_LEN) != 0) {
+        fprintf(stderr, "%s: %s: not a binary gastoold log\n",
+                program_name, filename);
+        result = -GAS_FAILURE;
+    } else {
+        result = decode(filename, buf, size);
+    }
+
+    gas_free(buf);
+    reset_formats();
+    if (stream != stdin)
+        fclose(stream);
+
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    int optc, status = EXIT_SUCCESS;
+
+    program_name = argv[0];
+
+    while ((optc = getopt_long(argc, argv, "", long_options, NULL))
+           != -1) {
+        switch (optc) {
+        case HELP_OPTION:
+            usage(EXIT_SUCCESS);
+            break;
+        case VERSION_OPTION:
+            print_version();
+            break;
+
+        default:
+            usage(EXIT_FAILURE);
+            break;
+        }
+    }
+
+    if (optind == argc) {
+        if (decode_file("-") < 0)
+            status = EXIT_FAILURE;
+    }
+
+    for (; optind < argc; optind++) {
+        if (decode_file(argv[optind]) < 0)
+            status = EXIT_FAILURE;
+    }
+
+    exit(status);
+}
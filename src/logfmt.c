@@ -0,0 +1,205 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+
+#include "gasconfig.h"
+
+#include <string.h>
+
+#include "logfmt.h"
+
+#define DIGITS "0123456789"
+
+enum logfmt_length_t {
+    LENGTH_NONE,
+    LENGTH_HH,
+    LENGTH_H,
+    LENGTH_L,
+    LENGTH_LL,
+    LENGTH_Z,
+    LENGTH_J,
+    LENGTH_T,
+    LENGTH_LONG_DOUBLE
+};
+
+static const char *logfmt_length(const char *p, enum logfmt_length_t *length)
+{
+    switch (*p) {
+    case 'h':
+        if (p[1] == 'h') {
+            *length = LENGTH_HH;
+            return p + 2;
+        }
+        *length = LENGTH_H;
+        return p + 1;
+    case 'l':
+        if (p[1] == 'l') {
+            *length = LENGTH_LL;
+            return p + 2;
+        }
+        *length = LENGTH_L;
+        return p + 1;
+    case 'z':
+        *length = LENGTH_Z;
+        return p + 1;
+    case 'j':
+        *length = LENGTH_J;
+        return p + 1;
+    case 't':
+        *length = LENGTH_T;
+        return p + 1;
+    case 'L':
+        *length = LENGTH_LONG_DOUBLE;
+        return p + 1;
+    default:
+        *length = LENGTH_NONE;
+        return p;
+    }
+}
+
+/* The kind of the value of conversion c with a length modifier; return
+   -1 if it cannot be stored. */
+static int logfmt_value(char c, enum logfmt_length_t length)
+{
+    static const enum logfmt_arg_t integers[] = {
+        [LENGTH_NONE] = LOGFMT_ARG_INT,
+        [LENGTH_HH] = LOGFMT_ARG_INT,
+        [LENGTH_H] = LOGFMT_ARG_INT,
+        [LENGTH_L] = LOGFMT_ARG_LONG,
+        [LENGTH_LL] = LOGFMT_ARG_LLONG,
+        [LENGTH_Z] = LOGFMT_ARG_SIZE,
+        [LENGTH_J] = LOGFMT_ARG_INTMAX,
+        [LENGTH_T] = LOGFMT_ARG_PTRDIFF
+    };
+
+    switch (c) {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+        if (length == LENGTH_LONG_DOUBLE)
+            return -1;
+        return integers[length];
+
+    case 'e': case 'E': case 'f': case 'F':
+    case 'g': case 'G': case 'a': case 'A':
+        if (length != LENGTH_NONE && length != LENGTH_L)
+            return -1;
+        return LOGFMT_ARG_DOUBLE;
+
+    case 'c':
+        return length == LENGTH_NONE ? LOGFMT_ARG_INT : -1;
+    case 's':
+        return length == LENGTH_NONE ? LOGFMT_ARG_STRING : -1;
+    case 'p':
+        return length == LENGTH_NONE ? LOGFMT_ARG_POINTER : -1;
+
+    default:
+        return -1;
+    }
+}
+
+int logfmt_parse(const char *format,
+                 int (*conv)(const struct logfmt_conv_t *conv, void *arg),
+                 int (*text)(const char *s, size_t len, void *arg),
+                 void *arg)
+{
+    struct logfmt_conv_t c;
+    enum logfmt_length_t length;
+    const char *p = format, *start;
+    int nargs = 0, value;
+
+    while (*p != '\0') {
+        start = p;
+        p += strcspn(p, "%");
+        if (p > start && text != NULL && text(start, p - start, arg) < 0)
+            return -1;
+
+        if (*p == '\0')
+            break;
+
+        if (p[1] == '%') {
+            if (text != NULL && text("%", 1, arg) < 0)
+                return -1;
+            p += 2;
+            continue;
+        }
+
+        c.spec = p++;
+        c.nargs = 0;
+
+        p += strspn(p, "-+ #0'");
+
+        if (*p == '*') {
+            c.args[c.nargs++] = LOGFMT_ARG_INT;
+            p++;
+        } else {
+            p += strspn(p, DIGITS);
+
+            /* Positional arguments. */
+            if (*p == '$')
+                return -1;
+        }
+
+        if (*p == '.') {
+            p++;
+            if (*p == '*') {
+                c.args[c.nargs++] = LOGFMT_ARG_INT;
+                p++;
+            } else {
+                p += strspn(p, DIGITS);
+            }
+        }
+
+        p = logfmt_length(p, &length);
+
+        value = logfmt_value(*p, length);
+        if (value < 0)
+            return -1;
+        c.args[c.nargs++] = value;
+
+        c.len = ++p - c.spec;
+        nargs += c.nargs;
+
+        if (conv != NULL && conv(&c, arg) < 0)
+            return -1;
+    }
+
+    return nargs;
+}
+
+struct logfmt_kinds_t {
+    unsigned char *kinds;
+    int count;
+};
+
+static int logfmt_add_kinds(const struct logfmt_conv_t *conv, void *arg)
+{
+    struct logfmt_kinds_t *k = arg;
+    int i;
+
+    if (k->count + conv->nargs > LOGFMT_ARGS_MAX)
+        return -1;
+
+    for (i = 0; i < conv->nargs; i++)
+        k->kinds[k->count++] = conv->args[i];
+
+    return 0;
+}
+
+int logfmt_arg_kinds(const char *format, unsigned char *kinds)
+{
+    struct logfmt_kinds_t k = { kinds, 0 };
+
+    return logfmt_parse(format, logfmt_add_kinds, NULL, &k);
+}
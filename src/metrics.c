@@ -0,0 +1,289 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "gasconfig.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "metrics.h"
+
+/* Histogram buckets: values below METRICS_SUB each have one, larger
+   ones share one per METRICS_PRECISION_BITS significant bits. */
+#define METRICS_SUB (1u << METRICS_PRECISION_BITS)
+#define METRICS_HALF (METRICS_SUB / 2)
+#define METRICS_BUCKETS                                                 \
+    ((METRICS_VALUE_BITS - METRICS_PRECISION_BITS) * METRICS_HALF       \
+     + METRICS_SUB)
+
+#define METRICS_VALUE_MAX ((UINT64_C(1) << METRICS_VALUE_BITS) - 1)
+
+#define METRIC_LEVEL_NAMES(prefix)                                      \
+    prefix ".emerg", prefix ".alert", prefix ".crit", prefix ".err",    \
+    prefix ".warning", prefix ".notice", prefix ".info", prefix ".debug"
+
+static const char *const metric_counter_names[METRIC_COUNTER_MAX] = {
+    [METRIC_CONFIG_LOADS] = "config.loads",
+    [METRIC_CONFIG_ERRORS] = "config.errors",
+    [METRIC_LOG_WRITTEN] = METRIC_LEVEL_NAMES("log.written"),
+    [METRIC_LOG_DROPPED] = METRIC_LEVEL_NAMES("log.dropped")
+};
+
+static const char *const metric_gauge_names[METRIC_GAUGE_MAX] = {
+    [METRIC_CONFIG_DIRECTIVES] = "config.directives"
+};
+
+static const char *const metric_histogram_names[METRIC_HISTOGRAM_MAX] = {
+    [METRIC_CONFIG_PARSE_TIME] = "config.parse_time",
+    [METRIC_CONFIG_LOAD_TIME] = "config.load_time"
+};
+
+const int metrics_percentiles[METRICS_PERCENTILES] = { 500, 900, 990, 999 };
+
+/* The counts of a thread, which only the thread writes; other threads
+   only read them, to merge them. */
+struct metrics_thread_t {
+    struct gas_thread_record_t record;
+
+    _Alignas(CACHE_LINE_SIZE) atomic_uint_least64_t
+        counters[METRIC_COUNTER_MAX];
+
+    struct {
+        _Alignas(CACHE_LINE_SIZE) atomic_uint_least64_t count;
+        atomic_uint_least64_t sum;
+        atomic_uint_least64_t max;
+        atomic_uint_least64_t buckets[METRICS_BUCKETS];
+    } histograms[METRIC_HISTOGRAM_MAX];
+};
+
+static void metrics_thread_release(struct gas_thread_record_t *record);
+
+/* The records of the threads that counted. Reused records keep their
+   counts. */
+static struct gas_thread_registry_t metrics_threads =
+    GAS_THREAD_REGISTRY_INIT(struct metrics_thread_t, NULL,
+                             metrics_thread_release);
+
+static _Thread_local struct metrics_thread_t *metrics_thread = NULL;
+
+static atomic_int_least64_t metrics_gauges[METRIC_GAUGE_MAX];
+
+static void metrics_thread_release(struct gas_thread_record_t *record)
+{
+    (void)record;
+
+    metrics_thread = NULL;
+}
+
+/* The record of the thread; NULL if memory is exhausted, and nothing is
+   counted. */
+static inline struct metrics_thread_t *metrics_self(void)
+{
+    if (metrics_thread == NULL)
+        metrics_thread = gas_thread_record_take(&metrics_threads);
+
+    return metrics_thread;
+}
+
+void metrics_add(enum metric_counter_t counter, uint64_t n)
+{
+    struct metrics_thread_t *thread = metrics_self();
+
+    if (thread != NULL)
+        GAS_THREAD_ADD(thread->counters[counter], n);
+}
+
+void metrics_set(enum metric_gauge_t gauge, int64_t value)
+{
+    atomic_store_explicit(&metrics_gauges[gauge], value,
+                          memory_order_relaxed);
+}
+
+/* The bucket of a value: its METRICS_PRECISION_BITS high bits, after
+   the number of bits dropped. */
+static unsigned int metrics_bucket(uint64_t value)
+{
+    unsigned int shift;
+
+    if (value < METRICS_SUB)
+        return (unsigned int)value;
+
+    shift = 64 - __builtin_clzll(value) - METRICS_PRECISION_BITS;
+
+    return shift * METRICS_HALF + (unsigned int)(value >> shift);
+}
+
+/* The largest value of a bucket. */
+static uint64_t metrics_bucket_value(unsigned int bucket)
+{
+    unsigned int shift;
+    uint64_t top;
+
+    if (bucket < METRICS_SUB)
+        return bucket;
+
+    shift = bucket / METRICS_HALF - 1;
+    top = bucket % METRICS_HALF + METRICS_HALF;
+
+    return ((top + 1) << shift) - 1;
+}
+
+void metrics_record(enum metric_histogram_t histogram, uint64_t value)
+{
+    struct metrics_thread_t *thread = metrics_self();
+
+    if (thread == NULL)
+        return;
+
+    if (value > METRICS_VALUE_MAX)
+        value = METRICS_VALUE_MAX;
+
+    GAS_THREAD_ADD(thread->histograms[histogram].count, 1);
+    GAS_THREAD_ADD(thread->histograms[histogram].sum, value);
+    GAS_THREAD_ADD(thread->histograms[histogram]
+                   .buckets[metrics_bucket(value)], 1);
+
+    if (value > atomic_load_explicit(&thread->histograms[histogram].max,
+                                     memory_order_relaxed))
+        atomic_store_explicit(&thread->histograms[histogram].max, value,
+                              memory_order_relaxed);
+}
+
+uint64_t metrics_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* The percentiles of merged buckets; a bucket stands for its largest
+   value, at most the largest value seen. */
+static void metrics_percentiles_get(const uint64_t *buckets,
+                                    uint64_t count, uint64_t max,
+                                    uint64_t *percentiles)
+{
+    uint64_t rank, seen = 0;
+    unsigned int bucket = 0;
+    int i;
+
+    for (i = 0; i < METRICS_PERCENTILES; i++) {
+        rank = (count * (uint64_t)metrics_percentiles[i] + 999) / 1000;
+        if (rank == 0)
+            rank = 1;
+
+        while (bucket < METRICS_BUCKETS && seen + buckets[bucket] < rank)
+            seen += buckets[bucket++];
+
+        percentiles[i] = bucket < METRICS_BUCKETS
+                         && metrics_bucket_value(bucket) < max
+                         ? metrics_bucket_value(bucket) : max;
+    }
+}
+
+void metrics_get(struct metrics_t *metrics)
+{
+    struct gas_thread_record_t *record;
+    struct metrics_thread_t *thread;
+    uint64_t *buckets, max;
+    unsigned int j;
+    int i;
+
+    memset(metrics, 0, sizeof(*metrics));
+
+    buckets = gas_malloc(METRIC_HISTOGRAM_MAX * METRICS_BUCKETS
+                         * sizeof(*buckets));
+    memset(buckets, 0, METRIC_HISTOGRAM_MAX * METRICS_BUCKETS
+           * sizeof(*buckets));
+
+    pthread_mutex_lock(&metrics_threads.lock);
+
+    for (record = metrics_threads.records; record != NULL;
+         record = record->next) {
+        thread = (struct metrics_thread_t *)record;
+
+        for (i = 0; i < METRIC_COUNTER_MAX; i++)
+            metrics->counters[i] +=
+                atomic_load_explicit(&thread->counters[i],
+                                     memory_order_relaxed);
+
+        for (i = 0; i < METRIC_HISTOGRAM_MAX; i++) {
+            metrics->histograms[i].count +=
+                atomic_load_explicit(&thread->histograms[i].count,
+                                     memory_order_relaxed);
+            metrics->histograms[i].sum +=
+                atomic_load_explicit(&thread->histograms[i].sum,
+                                     memory_order_relaxed);
+
+            max = atomic_load_explicit(&thread->histograms[i].max,
+                                       memory_order_relaxed);
+            if (max > metrics->histograms[i].max)
+                metrics->histograms[i].max = max;
+
+            for (j = 0; j < METRICS_BUCKETS; j++)
+                buckets[i * METRICS_BUCKETS + j] +=
+                    atomic_load_explicit(&thread->histograms[i].buckets[j],
+                                         memory_order_relaxed);
+        }
+    }
+
+    pthread_mutex_unlock(&metrics_threads.lock);
+
+    for (i = 0; i < METRIC_GAUGE_MAX; i++)
+        metrics->gauges[i] = atomic_load_explicit(&metrics_gauges[i],
+                                                  memory_order_relaxed);
+
+    for (i = 0; i < METRIC_HISTOGRAM_MAX; i++) {
+        if (metrics->histograms[i].count > 0)
+            metrics_percentiles_get(buckets + i * METRICS_BUCKETS,
+                                    metrics->histograms[i].count,
+                                    metrics->histograms[i].max,
+                                    metrics->histograms[i].percentiles);
+    }
+
+    gas_free(buckets);
+}
+
+const char *metric_counter_name(int counter)
+{
+    if (counter < 0 || counter >= METRIC_COUNTER_MAX)
+        return "?";
+
+    return metric_counter_names[counter];
+}
+
+const char *metric_gauge_name(int gauge)
+{
+    if (gauge < 0 || gauge >= METRIC_GAUGE_MAX)
+        return "?";
+
+    return metric_gauge_names[gauge];
+}
+
+const char *metric_histogram_name(int histogram)
+{
+    if (histogram < 0 || histogram >= METRIC_HISTOGRAM_MAX)
+        return "?";
+
+    return metric_histogram_names[histogram];
+}
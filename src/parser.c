@@ -16,41 +16,176 @@
 
 #include "gasconfig.h"
 
+#define LOG_SUBSYSTEM LOG_PARSER
+#define GAS_ALLOC_TAG GAS_ALLOC_PARSER
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include "common.h"
 #include "log.h"
+#include "trace.h"
+#include "profile.h"
 #include "cfgtree.h"
 #include "parser.h"
+#include "scan.h"
 
 /* For debugging: define GASTOOL_DEBUG_PARSER to trace every line read
    from the configuration files. */
 
-static int open_config_file(const char *filename, FILE **stream)
+/* Maximum nesting of Include directives. Include loops are found
+   before, by the identity of the files. */
+#define INCLUDE_DEPTH_MAX 16
+
+/* Maximum number of threads parsing included files. */
+#define PARSE_THREADS_MAX 64
+
+/* Initial size of the buffer of the streaming parser. It grows to hold
+   the longest line. */
+#define STREAM_BUFSIZE (64 * 1024)
+
+/* An Include directive. When the tree is assembled, the files it names
+   are linked in its place. */
+struct conf_include_t {
+    directive_t *directive;
+
+    /* The file the directive is in. */
+    struct conf_unit_t *unit;
+
+    /* Where the directive is linked from in its file: right after the
+       Include directive prev, or else from *link, which is &unit->root
+       for the first top level directive. Assembling the tree only writes
+       these links, it never follows them, so a file can be linked again
+       into a new tree on reload. */
+    const struct conf_include_t *prev;
+    directive_t **link;
+
+    /* The files it names: count units from index first of the tree being
+       built. */
+    size_t first;
+    size_t count;
+
+    /* Where its last file ends, once the tree is assembled. */
+    directive_t **endlink;
+
+    struct conf_include_t *next;
+};
+
+/* A configuration file and the directives parsed from it. Each file is
+   parsed into its own arena, so files can be parsed concurrently, and a
+   file that did not change is kept as it is on reload. */
+struct conf_unit_t {
+    /* The file to parse, and the unit whose Include directive named it
+       in the tree being built, NULL for the main file. */
+    const char *filename;
+    int depth;
+    struct conf_unit_t *includer;
+
+    /* The device and inode of the file when it was added, to find
+       Include loops; 0 if it could not be stat'ed. */
+    dev_t dev;
+    ino_t ino;
+
+    /* The parse result. */
+    int result;
+    arena_t arena;
+    struct conf_file_t *file;
+    directive_t *root;
+
+    /* The top level directives, Include directives included, and the
+       parent they are linked under. */
+    directive_t **toplevel;
+    size_t ntoplevel;
+    directive_t *parent;
+
+    /* The Include directives found in the file, in file order. */
+    struct conf_include_t *includes;
+    struct conf_include_t *includes_last;
+
+    /* On reload: the unit of the previous tree for the same file, if the
+       file was modified. When its contents turn out to be the same, the
+       old unit is kept instead of this one. */
+    struct conf_unit_t *old;
+    bool unchanged;
+
+    /* Whether the unit is new to the tree being built, and whether a unit
+       of the previous tree was claimed by it. */
+    bool fresh;
+    bool taken;
+
+    /* The next unit of the tree, in read order. */
+    struct conf_unit_t *next;
+};
+
+/* Units waiting for a parser thread. */
+struct parse_pool_t {
+    struct conf_unit_t **units;
+    size_t count;
+
+    /* The next unit to parse. */
+    atomic_size_t next;
+};
+
+/* A tree being built, reusing the units of the previous tree. */
+struct parse_build_t {
+    /* All units, in read order. */
+    struct conf_unit_t **units;
+    size_t count;
+    size_t alloc;
+
+    /* The directories Include patterns were expanded in. */
+    arena_t arena;
+    struct conf_file_t *dirs;
+    struct conf_file_t **dirs_tail;
+
+    /* The units of the previous tree, hashed by file name. */
+    struct conf_unit_t **old;
+    size_t oldmask;
+
+    /* Whether any file was parsed, as opposed to reused. */
+    bool parsed;
+};
+
+/* The interned name of the Include directive. */
+static const char *include_directive;
+
+/* Units come and go with every reload: they are taken from a pool. */
+static gas_pool_t *unit_pool;
+static pthread_once_t unit_pool_once = PTHREAD_ONCE_INIT;
+
+static void unit_pool_create(void)
 {
-    FILE *result;
-    int status, saved_errno;
-    struct stat statbuf;
+    unit_pool = gas_pool_create(struct conf_unit_t);
+}
 
-    result = fopen(filename, "r");
-    if (result == NULL) {
+/* Open a configuration file, which must be a regular file. */
+static int open_config_fd(const char *filename, struct stat *statbuf)
+{
+    int fd, saved_errno;
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         log_print(LOG_ERR, errno, "cannot open configuration file '%s'",
                   filename);
         return -GAS_FAILURE;
     }
 
-    status = stat(filename, &statbuf);
-    if (status < 0) {
+    if (fstat(fd, statbuf) < 0) {
         saved_errno = errno;
 
-        fclose(result);
+        close(fd);
 
         errno = saved_errno;
         log_print(LOG_ERR, errno, "cannot stat configuration file '%s'",
@@ -58,36 +193,106 @@ static int open_config_file(const char *filename, FILE **stream)
         return -GAS_FAILURE;
     }
 
-    if (!S_ISREG(statbuf.st_mode)) {
-        fclose(result);
+    if (!S_ISREG(statbuf->st_mode)) {
+        close(fd);
 
         log_print(LOG_ERR, 0, "access to file '%s' denied: not a regular file",
                   filename);
         return -GAS_FAILURE;
     }
 
-    *stream = result;
+    return fd;
+}
+
+static int open_config_file(arena_t *arena, const char *filename,
+                            struct conf_file_t **file)
+{
+    struct conf_file_t *result;
+    int fd, saved_errno;
+    struct stat statbuf;
+    long pagesize;
+    size_t length;
+    char *data;
+
+    TRACE_SCOPE("open_config_file");
+
+    fd = open_config_fd(filename, &statbuf);
+    if (fd < 0)
+        return -GAS_FAILURE;
+
+    /* Reserve one byte more than the file size, rounded up to whole pages,
+       and map the file over the start of it. The extra byte is always
+       zero, so the last line is terminated even without a newline. */
+    pagesize = sysconf(_SC_PAGESIZE);
+    length = ((size_t)statbuf.st_size + pagesize) & ~((size_t)pagesize - 1);
+
+    data = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        goto open_map_failed;
+
+    if (statbuf.st_size > 0
+        && mmap(data, statbuf.st_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        saved_errno = errno;
+        munmap(data, length);
+        errno = saved_errno;
+        goto open_map_failed;
+    }
+
+    close(fd);
+
+    /* The file is read front to back. */
+    madvise(data, length, MADV_SEQUENTIAL);
+
+    result = arena_alloc(arena, sizeof(struct conf_file_t));
+    result->filename = gas_intern(filename);
+    result->directory = false;
+    result->mtime = statbuf.st_mtim;
+    result->size = statbuf.st_size;
+    result->hash = gas_hash64(data, statbuf.st_size);
+    result->data = data;
+    result->length = length;
+    result->next = NULL;
+
+    *file = result;
 
     return GAS_SUCCESS;
+
+open_map_failed:
+    saved_errno = errno;
+
+    close(fd);
+
+    errno = saved_errno;
+    log_print(LOG_ERR, errno, "cannot read configuration file '%s'",
+              filename);
+    return -GAS_FAILURE;
+}
+
+static void close_config_file(struct conf_file_t *file)
+{
+    if (file->data != NULL)
+        munmap(file->data, file->length);
 }
 
-static int read_config_line(char **buf, size_t *bufsize, FILE *fp)
+static int read_config_line(char **cursor, const char *end, char **line)
 {
-    char *linep, *cp;
-    ssize_t len;
+    char *linep = *cursor, *eol;
+    size_t len;
 
-    if (feof(fp))
+    if (linep >= end)
         return 0;
 
-    len = getdelim(buf, bufsize, '\n', fp);
-    if (len < 0)
-        return -errno;
+    eol = memchr(linep, '\n', end - linep);
+    if (eol == NULL)
+        eol = (char *)end;
 
-    linep = *buf;
+    *cursor = eol + 1;
+    len = eol - linep;
 
     /* Strip trailing newline characters. */
-    while (len > 0
-           && (linep[len - 1] == '\n' || linep[len - 1] == '\r'))
+    while (len > 0 && linep[len - 1] == '\r')
         len--;
     linep[len] = '\0';
 
@@ -97,38 +302,37 @@ static int read_config_line(char **buf, size_t *bufsize, FILE *fp)
     linep[len] = '\0';
 
     /* Strip leading whitespace. */
-    for (cp = linep; isblank((unsigned char)*cp); cp++)
-        len--;
-    memmove(linep, cp, len);
-    linep[len] = '\0';
+    while (isblank((unsigned char)*linep))
+        linep++;
+
+    *line = linep;
 
     return 1;
 }
 
-static char *parse_config_substring(const char *string, size_t length,
-                                    char quote)
+/* Remove the escape backslashes of a token in place. This is only called
+   for tokens that actually contain a backslash. */
+static void parse_config_unescape(char *string, char quote)
 {
-    char *result = gas_malloc(length + 1);
-    char *resp = result;
-    size_t i;
+    char *resp = string;
 
-    for (i = 0; i < length; i++) {
-        if (string[i] == '\\' && (string[i + 1] == '\\'
-                                  || (quote && string[i + 1] == quote)))
-            *resp++ = string[++i];
-        else
-            *resp++ = string[i];
+    for (; *string; string++) {
+        if (string[0] == '\\' && (string[1] == '\\'
+                                  || (quote && string[1] == quote)))
+            string++;
+        *resp++ = *string;
     }
 
     *resp = '\0';
-
-    return result;
 }
 
+/* Split the next token off *line. The token is terminated in place and
+   *retval points into the line buffer. */
 static int parse_config_string(char **line, char **retval)
 {
-    char *string = *line, *strend, *result;
+    char *string = *line, *strend;
     char quote;
+    bool escaped = false;
 
     *retval = NULL;
 
@@ -142,36 +346,41 @@ static int parse_config_string(char **line, char **retval)
 
     quote = *string;
     if (quote == '"' || quote == '\'') {
-        strend = string + 1;
+        string++;
+        strend = string;
 
-        while (*strend && *strend != quote) {
-            if (*strend == '\\' && strend[1]
-                && (strend[1] == '\\' || strend[1] == quote))
+        for (;;) {
+            strend = scan_quoted(strend, quote);
+            if (*strend != '\\')
+                break;
+
+            if (strend[1] == '\\' || strend[1] == quote) {
+                escaped = true;
                 strend += 2;
-            else
+            } else {
                 strend++;
+            }
         }
 
         /* Unclosed quote. */
         if (*strend != quote)
             return -GAS_FAILURE;
         /* Empty string. */
-        if (strend - string <= 1)
+        if (strend == string)
             return -GAS_FAILURE;
-
-        result = parse_config_substring(string + 1, strend - string - 1,
-                                        quote);
-        strend++;
     } else {
-        strend = string;
+        quote = 0;
+        strend = scan_word(string, &escaped);
+    }
 
-        while (*strend && !isblank((unsigned char)*strend))
-            strend++;
+    /* Terminate the token, unless it ends the line. */
+    if (*strend)
+        *strend++ = '\0';
 
-        result = parse_config_substring(string, strend - string, 0);
-    }
+    if (escaped)
+        parse_config_unescape(string, quote);
 
-    *retval = result;
+    *retval = string;
 
     while (isblank((unsigned char)*strend))
         strend++;
@@ -180,53 +389,27 @@ static int parse_config_string(char **line, char **retval)
     return 1;
 }
 
-static void parse_insert_argv(char ***argv, int *argc, char *string)
-{
-    *argv = gas_realloc(*argv, (*argc + 1) * sizeof(**argv));
-    (*argv)[*argc] = string;
-    (*argc)++;
-}
-
-static void parse_free_argv(char **argv)
-{
-    if (argv) {
-        size_t i;
-
-        for (i = 0; argv[i] != NULL; i++)
-            free(argv[i]);
-
-        free(argv);
-    }
-}
-
 #define ARGV_MAX 16
 
-static int parse_config_splitline(char **line, int *argc, char ***argv)
+static int parse_config_splitline(char **line, int *argc, char **argv)
 {
     char *string;
     int result;
 
     *argc = 0;
-    *argv = NULL;
 
     do {
         result = parse_config_string(line, &string);
         if (result <= 0)
             break;
 
-        parse_insert_argv(argv, argc, string);
+        argv[(*argc)++] = string;
     } while (*argc < ARGV_MAX);
 
     /* Too many arguments. */
     if (*argc == ARGV_MAX)
         result = -GAS_FAILURE;
 
-    /* Insert NULL in the last position. */
-    parse_insert_argv(argv, argc, NULL);
-
-    /* Decrement argc, so argv[argc] is NULL. */
-    (*argc)--;
-
     return result;
 }
 
@@ -258,19 +441,75 @@ static directive_t *parse_add_node(directive_t **parent, directive_t *current,
     return newdir;
 }
 
-static int parse_config_line(const char *filename, char *line, int linenum,
-                             directive_t **current, directive_t **curr_parent)
+/* The state of the streaming parser in one file. */
+struct conf_parser_t {
+    const struct conf_handler_t *handler;
+
+    /* The file being parsed (interned) and the current line. */
+    const char *filename;
+    int linenum;
+
+    /* The names of the open blocks (interned), innermost last. */
+    const char **blocks;
+    size_t depth;
+    size_t blocksize;
+
+    /* The include nesting level when Include directives are followed,
+       or -1 when they are passed to the handler like other directives. */
+    int include_depth;
+
+    /* When they are followed: the parser of the file whose Include
+       directive named this one, and the device and inode of the file,
+       to find Include loops. */
+    const struct conf_parser_t *includer;
+    dev_t dev;
+    ino_t ino;
+
+    /* Set when a handler failed, rather than the syntax. */
+    bool aborted;
+};
+
+static void parse_parser_init(struct conf_parser_t *parser,
+                              const struct conf_handler_t *handler,
+                              const char *filename, int include_depth)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->handler = handler;
+    parser->filename = filename;
+    parser->include_depth = include_depth;
+}
+
+static int parse_handler_result(struct conf_parser_t *parser, int result)
+{
+    if (result < 0) {
+        parser->aborted = true;
+        return -GAS_FAILURE;
+    }
+
+    return GAS_SUCCESS;
+}
+
+static int parse_stream_include(struct conf_parser_t *parser,
+                                const char *arg);
+
+static int parse_config_line(struct conf_parser_t *parser, char *line)
 {
-    char *linep = line, *cmdname, **argv;
+    const struct conf_handler_t *handler = parser->handler;
+    char *linep = line, *cmdname, *argv[ARGV_MAX];
+    const char *name;
     int result, argc;
-    directive_t *newdir;
+#ifdef GASTOOL_DEBUG_PARSER
+    int i;
+#endif
+
+    TRACE_SCOPE("parse_config_line");
 
     /* Skip comments and empty lines. */
     if (*line == '#' || *line == '\0')
         return GAS_SUCCESS;
 
 #ifdef GASTOOL_DEBUG_PARSER
-    log_print(LOG_DEBUG, 0, "%d:'%s'", linenum, line);
+    log_print(LOG_DEBUG, 0, "%d:'%s'", parser->linenum, line);
 #endif
 
     /* Open/close block syntax check. Remove the close block character now
@@ -283,7 +522,7 @@ static int parse_config_line(const char *filename, char *line, int linenum,
     }
 
 #ifdef GASTOOL_DEBUG_PARSER
-    log_print(LOG_DEBUG, 0, "%d:'%s'", linenum, line);
+    log_print(LOG_DEBUG, 0, "%d:'%s'", parser->linenum, line);
 #endif
 
     /* Get first token. This will be the directive name. */
@@ -296,155 +535,1065 @@ static int parse_config_line(const char *filename, char *line, int linenum,
 #endif
 
     /* Get all tokens. This will be the directive arguments. */
-    result = parse_config_splitline(&line, &argc, &argv);
+    result = parse_config_splitline(&line, &argc, argv);
     if (result < 0)
-        goto parse_free_memory;
+        return result;
 
 #ifdef GASTOOL_DEBUG_PARSER
-    int i;
-
     log_print(LOG_DEBUG, 0, "argc=%d", argc);
     for (i = 0; i < argc; i++)
         log_print(LOG_DEBUG, 0, "argv[%d]='%s'", i, argv[i]);
 #endif
 
-    /* Build the directive and insert it into the tree. Note: close block
-       entries are not added and their memory must be freed. */
-    result = GAS_SUCCESS;
+    profile_lap(PROFILE_BUILD);
 
+    /* Close the innermost block, which must have the same name. */
     if (linep[0] == '<' && linep[1] == '/') {
-        if (argc != 0) {
-            result = -GAS_FAILURE;
-            goto parse_free_memory;
-        }
+        if (argc != 0)
+            return -GAS_FAILURE;
 
-        if (*curr_parent == NULL) {
-            result = -GAS_FAILURE;
-            goto parse_free_memory;
+        if (parser->depth == 0)
+            return -GAS_FAILURE;
+
+        /* Turn "</Name" into "<Name" in place: both names are then
+           interned and can be compared by pointer. */
+        cmdname[1] = '<';
+        name = gas_intern(cmdname + 1);
+        if (name != parser->blocks[parser->depth - 1])
+            return -GAS_FAILURE;
+
+        parser->depth--;
+
+        if (handler->on_block_close == NULL)
+            return GAS_SUCCESS;
+
+        return parse_handler_result(parser,
+                                    handler->on_block_close(
+                                        handler->arg, name, parser->filename,
+                                        parser->linenum));
+    }
+
+    name = gas_intern(cmdname);
+
+    if (linep[0] == '<') {
+        if (parser->depth == parser->blocksize) {
+            parser->blocksize = parser->blocksize ? parser->blocksize * 2 : 16;
+            parser->blocks = gas_realloc(parser->blocks, parser->blocksize
+                                         * sizeof(*parser->blocks));
         }
+        parser->blocks[parser->depth++] = name;
+
+        if (handler->on_block_open == NULL)
+            return GAS_SUCCESS;
+
+        return parse_handler_result(parser,
+                                    handler->on_block_open(
+                                        handler->arg, name, argc,
+                                        (const char *const *)argv,
+                                        parser->filename, parser->linenum));
+    }
+
+    /* Include directives take exactly one file name or pattern. */
+    if (name == include_directive) {
+        if (argc != 1)
+            return -GAS_FAILURE;
+
+        if (parser->include_depth >= 0)
+            return parse_stream_include(parser, argv[0]);
+    }
 
-        if (strcmp(cmdname + 2, (*curr_parent)->directive + 1) != 0) {
+    if (handler->on_directive == NULL)
+        return GAS_SUCCESS;
+
+    return parse_handler_result(parser,
+                                handler->on_directive(
+                                    handler->arg, name, argc,
+                                    (const char *const *)argv,
+                                    parser->filename, parser->linenum));
+}
+
+/* Parse the lines from data to end. */
+static int parse_config_data(struct conf_parser_t *parser, char *data,
+                             const char *end)
+{
+    char *cursor = data, *line;
+    int phase = profile_switch(PROFILE_READ), result = GAS_SUCCESS;
+
+    while (read_config_line(&cursor, end, &line) > 0) {
+        /* Increment line number. */
+        parser->linenum++;
+
+        profile_lap(PROFILE_TOKENIZE);
+
+        if (parse_config_line(parser, line) < 0) {
+            if (!parser->aborted)
+                log_print(LOG_ERR, 0, "syntax error in file '%s' at line %d",
+                          parser->filename, parser->linenum);
             result = -GAS_FAILURE;
-            goto parse_free_memory;
+            break;
         }
 
-        *current = *curr_parent;
-        *curr_parent = (*current)->parent;
+        profile_lap(PROFILE_READ);
+    }
+
+    profile_switch(phase);
+
+    return result;
+}
 
-        goto parse_free_memory;
+/* End the file: blocks still open are closed at its last line, as they
+   always have been accepted. */
+static int parse_config_end(struct conf_parser_t *parser)
+{
+    const struct conf_handler_t *handler = parser->handler;
+    int result = GAS_SUCCESS;
+
+    while (parser->depth > 0 && result >= 0) {
+        parser->depth--;
+
+        if (handler->on_block_close != NULL)
+            result = parse_handler_result(parser,
+                                          handler->on_block_close(
+                                              handler->arg,
+                                              parser->blocks[parser->depth],
+                                              parser->filename,
+                                              parser->linenum));
     }
 
-    newdir = gas_malloc(sizeof(directive_t));
+    return result;
+}
+
+static void parse_parser_free(struct conf_parser_t *parser)
+{
+    gas_free(parser->blocks);
+}
+
+/* The tree builder: a handler that adds the directives of a unit to its
+   tree. The strings it is given point into the mapped file, so long
+   arguments are not copied. */
+struct parse_tree_t {
+    struct conf_unit_t *unit;
+
+    directive_t *current;
+    directive_t *parent;
+};
+
+static directive_t *parse_tree_node(struct parse_tree_t *tree,
+                                    const char *name, int argc,
+                                    const char *const *argv, int linenum)
+{
+    struct conf_unit_t *unit = tree->unit;
+    directive_t *newdir;
+    int i;
+
+    newdir = arena_alloc(&unit->arena, sizeof(directive_t));
     memset(newdir, 0, sizeof(directive_t));
 
-    newdir->directive = cmdname;
+    newdir->directive = name;
     newdir->argc = argc;
-    newdir->argv = argv;
-    newdir->filename = gas_strdup(filename);
+    newdir->argv = arena_alloc(&unit->arena, (argc + 1) * sizeof(char *));
+    for (i = 0; i < argc; i++)
+        newdir->argv[i] = argv[i];
+    newdir->argv[argc] = NULL;
+    newdir->filename = unit->file->filename;
     newdir->linenum = linenum;
 
-    if (linep[0] == '<')
-        *current = parse_add_node(curr_parent, *current, newdir, true);
-    else
-        *current = parse_add_node(curr_parent, *current, newdir, false);
+    return newdir;
+}
 
-    goto parse_line_return;
+static void parse_tree_add(struct parse_tree_t *tree, directive_t *newdir,
+                           bool child)
+{
+    if (tree->unit->root == NULL)
+        tree->unit->root = newdir;
 
-parse_free_memory:
-    free(cmdname);
-    parse_free_argv(argv);
+    tree->current = parse_add_node(&tree->parent, tree->current, newdir,
+                                   child);
+}
 
-parse_line_return:
-    return result;
+static int parse_tree_block_open(void *arg, const char *name, int argc,
+                                 const char *const *argv,
+                                 const char *filename, int linenum)
+{
+    struct parse_tree_t *tree = arg;
+
+    (void)filename;
+
+    parse_tree_add(tree, parse_tree_node(tree, name, argc, argv, linenum),
+                   true);
+
+    return GAS_SUCCESS;
 }
 
-void free_conf_tree(directive_t *current)
+static int parse_tree_directive(void *arg, const char *name, int argc,
+                                const char *const *argv,
+                                const char *filename, int linenum)
 {
-    int i;
+    struct parse_tree_t *tree = arg;
+    struct conf_unit_t *unit = tree->unit;
+    directive_t *newdir;
+
+    (void)filename;
+
+    newdir = parse_tree_node(tree, name, argc, argv, linenum);
+
+    /* The files an Include directive names are linked in its place. */
+    if (name == include_directive) {
+        struct conf_include_t *include, *last = unit->includes_last;
+
+        include = arena_alloc(&unit->arena, sizeof(*include));
+        memset(include, 0, sizeof(*include));
+        include->directive = newdir;
+        include->unit = unit;
+
+        if (tree->current != NULL && last != NULL
+            && last->directive == tree->current)
+            include->prev = last;
+        else if (tree->current != NULL)
+            include->link = &tree->current->next;
+        else if (tree->parent != NULL)
+            include->link = &tree->parent->child;
+        else
+            include->link = &unit->root;
+
+        if (last != NULL)
+            last->next = include;
+        else
+            unit->includes = include;
+        unit->includes_last = include;
+    }
 
-    if (current == NULL)
+    parse_tree_add(tree, newdir, false);
+
+    return GAS_SUCCESS;
+}
+
+static int parse_tree_block_close(void *arg, const char *name,
+                                  const char *filename, int linenum)
+{
+    struct parse_tree_t *tree = arg;
+
+    (void)name;
+    (void)filename;
+    (void)linenum;
+
+    tree->current = tree->parent;
+    tree->parent = tree->current->parent;
+
+    return GAS_SUCCESS;
+}
+
+static void free_unit(struct conf_unit_t *unit)
+{
+    if (unit->file != NULL)
+        close_config_file(unit->file);
+
+    arena_free(&unit->arena);
+    gas_pool_free(unit_pool, unit);
+}
+
+void free_conf_tree(conftree_t *conftree)
+{
+    struct conf_file_t *file;
+    struct conf_unit_t *unit, *next;
+    void *units[32];
+    size_t count = 0;
+
+    TRACE_SCOPE("free_conf_tree");
+
+    /* The files of the units are in the list, and so are their
+       mappings. */
+    for (file = conftree->files; file != NULL; file = file->next)
+        close_config_file(file);
+
+    for (unit = conftree->units; unit != NULL; unit = next) {
+        next = unit->next;
+
+        arena_free(&unit->arena);
+
+        units[count++] = unit;
+        if (count == sizeof(units) / sizeof(units[0])) {
+            gas_pool_free_bulk(unit_pool, units, count);
+            count = 0;
+        }
+    }
+
+    if (count > 0)
+        gas_pool_free_bulk(unit_pool, units, count);
+
+    if (conftree->image != NULL)
+        munmap(conftree->image, conftree->imagesize);
+
+    arena_free(&conftree->arena);
+
+    conftree->root = NULL;
+    conftree->files = NULL;
+    conftree->units = NULL;
+    conftree->image = NULL;
+}
+
+static int parse_config_file(struct conf_unit_t *unit)
+{
+    struct conf_file_t *file = unit->file;
+    struct parse_tree_t tree = { unit, NULL, NULL };
+    const struct conf_handler_t handler = {
+        parse_tree_block_open,
+        parse_tree_directive,
+        parse_tree_block_close,
+        &tree
+    };
+    struct conf_parser_t parser;
+    int result;
+
+    TRACE_SCOPE("parse_config_file");
+
+    parse_parser_init(&parser, &handler, file->filename, -1);
+
+    result = parse_config_data(&parser, file->data, file->data + file->size);
+    if (result >= 0)
+        result = parse_config_end(&parser);
+
+    parse_parser_free(&parser);
+
+    if (result < 0) {
+        unit->root = NULL;
+        return -GAS_FAILURE;
+    }
+
+    return GAS_SUCCESS;
+}
+
+/* The work of parse_unit(), in the open phase until the file is
+   parsed. */
+static void parse_unit_file(struct conf_unit_t *unit)
+{
+    directive_t *dir;
+    size_t i = 0;
+
+    unit->result = open_config_file(&unit->arena, unit->filename,
+                                    &unit->file);
+    if (unit->result < 0)
         return;
 
-    free(current->directive);
+    /* Only the modification time changed: keep the old unit. */
+    if (unit->old != NULL && unit->old->file->size == unit->file->size
+        && unit->old->file->hash == unit->file->hash) {
+        unit->unchanged = true;
+        return;
+    }
 
-    for (i = 0; i < current->argc; i++)
-        free(current->argv[i]);
-    free(current->argv);
+    profile_switch(PROFILE_BUILD);
 
-    free(current->filename);
+    unit->result = parse_config_file(unit);
+    if (unit->result < 0)
+        return;
 
-    if (current->child)
-        free_conf_tree(current->child);
-    if (current->next)
-        free_conf_tree(current->next);
+    /* Remember the top level directives while the file is still linked
+       as it was read. */
+    for (dir = unit->root; dir != NULL; dir = dir->next)
+        unit->ntoplevel++;
 
-    free(current);
+    unit->toplevel = arena_alloc(&unit->arena,
+                                 unit->ntoplevel * sizeof(*unit->toplevel));
+    for (dir = unit->root; dir != NULL; dir = dir->next)
+        unit->toplevel[i++] = dir;
 }
 
-static int parse_config_file(const char *filename, FILE *fp,
-                             directive_t **conftree)
+/* Open and parse one file into its unit. Called on the parser threads. */
+static void parse_unit(struct conf_unit_t *unit)
 {
-    char *line = NULL;
-    size_t linesize = 0;
-    int linenum = 0;
-    directive_t *current = *conftree;
-    directive_t *curr_parent = NULL;
-    int result_read = 0, result_parser = 0;
+    int phase = profile_switch(PROFILE_OPEN);
 
-    while ((result_read = read_config_line(&line, &linesize, fp)) > 0) {
-        /* Increment line number. */
-        linenum++;
+    parse_unit_file(unit);
+
+    profile_switch(phase);
+}
+
+static void *parse_worker(void *arg)
+{
+    struct parse_pool_t *pool = arg;
+    size_t i;
+
+    while ((i = atomic_fetch_add(&pool->next, 1)) < pool->count)
+        parse_unit(pool->units[i]);
+
+    return NULL;
+}
 
-        /* Parse the configuration line and insert the node into the tree. */
-        result_parser = parse_config_line(filename, line, linenum, &current,
-                                          &curr_parent);
-        if (result_parser < 0)
+/* Parse units concurrently. Workers take the next unparsed unit until
+   there are none left; the calling thread works too. */
+static void parse_units(struct conf_unit_t **units, size_t count)
+{
+    struct parse_pool_t pool;
+    pthread_t threads[PARSE_THREADS_MAX];
+    long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t nthreads, started = 0, i;
+
+    pool.units = units;
+    pool.count = count;
+    atomic_init(&pool.next, 0);
+
+    nthreads = nprocs > 1 ? (size_t)nprocs : 1;
+    if (nthreads > count)
+        nthreads = count;
+    if (nthreads > PARSE_THREADS_MAX)
+        nthreads = PARSE_THREADS_MAX;
+
+    /* If a thread cannot be created, the others take its share. */
+    for (i = 1; i < nthreads; i++) {
+        if (gas_thread_create(&threads[started], parse_worker, &pool) != 0)
             break;
+        started++;
+    }
+
+    parse_worker(&pool);
+
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+}
+
+static size_t parse_old_slot(const struct parse_build_t *build,
+                             const char *filename)
+{
+    return gas_hash64(&filename, sizeof(filename)) & build->oldmask;
+}
+
+static void parse_build_init(struct parse_build_t *build,
+                             struct conf_unit_t *old)
+{
+    struct conf_unit_t *unit;
+    size_t count = 0, size = 16, i;
+
+    memset(build, 0, sizeof(*build));
+    arena_init(&build->arena);
+    build->dirs_tail = &build->dirs;
+
+    for (unit = old; unit != NULL; unit = unit->next)
+        count++;
+
+    if (count == 0)
+        return;
+
+    while (size < count * 2)
+        size *= 2;
 
-        /* Update conftree reference. */
-        if (*conftree == NULL && current != NULL)
-            *conftree = current;
+    build->old = gas_malloc(size * sizeof(*build->old));
+    memset(build->old, 0, size * sizeof(*build->old));
+    build->oldmask = size - 1;
 
-        if (*conftree == NULL && curr_parent != NULL)
-            *conftree = curr_parent;
+    for (unit = old; unit != NULL; unit = unit->next) {
+        for (i = parse_old_slot(build, unit->filename);
+             build->old[i] != NULL; i = (i + 1) & build->oldmask)
+            ;
+
+        build->old[i] = unit;
     }
+}
+
+/* Find a unit of the previous tree for filename that is not reused yet.
+   A file included twice has a unit for each time. */
+static struct conf_unit_t *parse_find_old(const struct parse_build_t *build,
+                                          const char *filename)
+{
+    struct conf_unit_t *unit;
+    size_t i;
 
-    free(line);
+    if (build->old == NULL)
+        return NULL;
 
-    if (result_read < 0) {
-        log_print(LOG_ERR, result_read, "error reading '%s' at line %d",
-                  filename, linenum);
+    for (i = parse_old_slot(build, filename);
+         (unit = build->old[i]) != NULL; i = (i + 1) & build->oldmask) {
+        if (unit->filename == filename && !unit->taken)
+            return unit;
     }
 
-    if (result_parser < 0) {
-        log_print(LOG_ERR, 0, "syntax error in file '%s' at line %d",
-                  filename, linenum);
+    return NULL;
+}
+
+/* Add the unit of a file to the tree being built. A file of the previous
+   tree whose size and modification time did not change is reused as is;
+   any other file is parsed. */
+static void parse_add_unit(struct parse_build_t *build, const char *filename,
+                           struct conf_unit_t *includer,
+                           const struct stat *statbuf)
+{
+    struct conf_unit_t *unit = NULL, *old;
+
+    old = parse_find_old(build, filename);
+    if (old != NULL) {
+        old->taken = true;
+
+        if (statbuf != NULL
+            && (size_t)statbuf->st_size == old->file->size
+            && statbuf->st_mtim.tv_sec == old->file->mtime.tv_sec
+            && statbuf->st_mtim.tv_nsec == old->file->mtime.tv_nsec)
+            unit = old;
     }
 
-    if (result_read < 0 || result_parser < 0) {
-        free_conf_tree(*conftree);
-        *conftree = NULL;
+    if (unit == NULL) {
+        pthread_once(&unit_pool_once, unit_pool_create);
+        unit = gas_pool_alloc(unit_pool);
+        memset(unit, 0, sizeof(*unit));
+        unit->filename = filename;
+        unit->old = old;
+        unit->fresh = true;
+        arena_init(&unit->arena);
     }
 
-    return (result_read < 0 || result_parser < 0) ? -GAS_FAILURE : GAS_SUCCESS;
+    unit->depth = includer != NULL ? includer->depth + 1 : 0;
+    unit->includer = includer;
+    unit->dev = statbuf != NULL ? statbuf->st_dev : 0;
+    unit->ino = statbuf != NULL ? statbuf->st_ino : 0;
+
+    if (build->count == build->alloc) {
+        build->alloc = build->alloc ? build->alloc * 2 : 16;
+        build->units = gas_realloc(build->units,
+                                   build->alloc * sizeof(*build->units));
+    }
+
+    build->units[build->count++] = unit;
+}
+
+/* Record the directory a pattern is expanded in as a file of the tree,
+   so that adding a file that matches the pattern can be noticed. */
+static void parse_include_directory(struct parse_build_t *build,
+                                    const char *pattern)
+{
+    const char *wildcard = strpbrk(pattern, "*?["), *slash;
+    struct conf_file_t *file;
+    struct stat statbuf;
+    char *dir;
+
+    for (slash = wildcard; slash > pattern && *slash != '/'; slash--)
+        ;
+
+    if (*slash == '/')
+        dir = arena_strndup(&build->arena, pattern, slash - pattern + 1);
+    else
+        dir = arena_strdup(&build->arena, ".");
+
+    if (stat(dir, &statbuf) < 0 || !S_ISDIR(statbuf.st_mode))
+        return;
+
+    file = arena_alloc(&build->arena, sizeof(*file));
+    memset(file, 0, sizeof(*file));
+    file->filename = gas_intern(dir);
+    file->directory = true;
+    file->mtime = statbuf.st_mtim;
+
+    *build->dirs_tail = file;
+    build->dirs_tail = &file->next;
 }
 
-int read_config_file(const char *filename, directive_t **conftree)
+/* Expand the file name or pattern arg of an Include directive, relative
+   to the directory of the file it is in, into globbuf. *path is set to
+   the full pattern; release both with parse_include_globfree(). */
+static int parse_include_glob(struct parse_build_t *build,
+                              const char *filename, int linenum,
+                              const char *arg, char **path, glob_t *globbuf)
 {
+    const char *slash;
+    size_t dirlen = 0;
     int result;
-    FILE *fp;
 
-    result = open_config_file(filename, &fp);
-    if (result < 0)
+    slash = strrchr(filename, '/');
+    if (arg[0] != '/' && slash != NULL)
+        dirlen = slash - filename + 1;
+
+    *path = gas_malloc(dirlen + strlen(arg) + 1);
+    memcpy(*path, filename, dirlen);
+    strcpy(*path + dirlen, arg);
+
+    /* A plain file name must exist; a pattern may match nothing. */
+    if (strpbrk(arg, "*?[") == NULL) {
+        globbuf->gl_pathc = 1;
+        globbuf->gl_pathv = path;
+        return GAS_SUCCESS;
+    }
+
+    if (build != NULL)
+        parse_include_directory(build, *path);
+
+    result = glob(*path, GLOB_ERR, NULL, globbuf);
+    if (result == GLOB_NOMATCH) {
+        globbuf->gl_pathc = 0;
+    } else if (result != 0) {
+        log_print(LOG_ERR, result == GLOB_ABORTED ? errno : 0,
+                  "cannot expand Include pattern '%s' in file '%s' "
+                  "at line %d", *path, filename, linenum);
+        gas_free(*path);
         return -GAS_FAILURE;
+    }
 
-    /* Parse the configuration file and build the tree. */
-    result = parse_config_file(filename, fp, conftree);
+    return GAS_SUCCESS;
+}
 
-    fclose(fp);
+static void parse_include_globfree(char **path, glob_t *globbuf)
+{
+    if (globbuf->gl_pathv != path && globbuf->gl_pathc > 0)
+        globfree(globbuf);
+    gas_free(*path);
+}
 
-    if (result < 0)
+/* Whether the file of statbuf is that of unit or of a unit including
+   it. */
+static bool parse_unit_loop(const struct conf_unit_t *unit,
+                            const struct stat *statbuf)
+{
+    for (; unit != NULL; unit = unit->includer) {
+        if (unit->dev == statbuf->st_dev && unit->ino == statbuf->st_ino)
+            return true;
+    }
+
+    return false;
+}
+
+/* Expand the file name or pattern of an Include directive into units. */
+static int parse_include_units(struct parse_build_t *build,
+                               struct conf_include_t *include)
+{
+    const directive_t *dir = include->directive;
+    struct stat statbuf;
+    char *path;
+    glob_t globbuf;
+    size_t i;
+    int result = GAS_SUCCESS;
+
+    if (include->unit->depth >= INCLUDE_DEPTH_MAX) {
+        log_print(LOG_ERR, 0, "Include nested too deeply in file '%s' "
+                  "at line %d", dir->filename, dir->linenum);
+        return -GAS_FAILURE;
+    }
+
+    if (parse_include_glob(build, dir->filename, dir->linenum, dir->argv[0],
+                           &path, &globbuf) < 0)
+        return -GAS_FAILURE;
+
+    include->first = build->count;
+    include->count = globbuf.gl_pathc;
+
+    /* A file that cannot be stat'ed fails when it is opened. */
+    for (i = 0; i < globbuf.gl_pathc; i++) {
+        if (stat(globbuf.gl_pathv[i], &statbuf) < 0) {
+            parse_add_unit(build, gas_intern(globbuf.gl_pathv[i]),
+                           include->unit, NULL);
+            continue;
+        }
+
+        if (parse_unit_loop(include->unit, &statbuf)) {
+            log_print(LOG_ERR, 0, "Include loop in file '%s' at line %d: "
+                      "'%s' is already being included", dir->filename,
+                      dir->linenum, globbuf.gl_pathv[i]);
+            result = -GAS_FAILURE;
+            break;
+        }
+
+        parse_add_unit(build, gas_intern(globbuf.gl_pathv[i]),
+                       include->unit, &statbuf);
+    }
+
+    parse_include_globfree(&path, &globbuf);
+
+    return result;
+}
+
+/* Collect the units of the configuration file and, one include level at a
+   time, of the files it includes. The files of a level that need parsing
+   are parsed concurrently. */
+static int parse_build_units(struct parse_build_t *build,
+                             const char *filename)
+{
+    struct conf_unit_t **pending = NULL;
+    struct conf_include_t *include;
+    struct stat statbuf;
+    size_t start = 0, end, npending, i;
+    int result = GAS_SUCCESS;
+
+    include_directive = gas_intern("Include");
+
+    parse_add_unit(build, gas_intern(filename), NULL,
+                   stat(filename, &statbuf) == 0 ? &statbuf : NULL);
+
+    while (start < build->count) {
+        end = build->count;
+
+        pending = gas_realloc(pending, (end - start) * sizeof(*pending));
+        npending = 0;
+
+        for (i = start; i < end; i++) {
+            if (build->units[i]->file == NULL)
+                pending[npending++] = build->units[i];
+        }
+
+        parse_units(pending, npending);
+
+        for (i = start; i < end; i++) {
+            struct conf_unit_t *unit = build->units[i];
+
+            if (!unit->fresh)
+                continue;
+
+            if (unit->unchanged) {
+                unit->old->file->mtime = unit->file->mtime;
+                unit->old->depth = unit->depth;
+                unit->old->includer = unit->includer;
+                unit->old->dev = unit->dev;
+                unit->old->ino = unit->ino;
+                build->units[i] = unit->old;
+                free_unit(unit);
+            } else if (unit->result < 0) {
+                result = -GAS_FAILURE;
+            } else {
+                build->parsed = true;
+            }
+        }
+
+        if (result < 0)
+            break;
+
+        for (i = start; i < end && result >= 0; i++) {
+            for (include = build->units[i]->includes;
+                 include != NULL && result >= 0; include = include->next)
+                result = parse_include_units(build, include);
+        }
+
+        if (result < 0)
+            break;
+
+        start = end;
+    }
+
+    gas_free(pending);
+
+    return result;
+}
+
+/* Link the directives of a unit at *link, under parent, with the files of
+   its Include directives in their place, and return the link after its
+   last directive. Only the links into the unit are written, so units
+   reused from the previous tree are linked in the same way: the cost
+   depends on the number of files, not on their size. */
+static directive_t **parse_link_unit(struct conf_unit_t **units,
+                                     struct conf_unit_t *unit,
+                                     directive_t **link, directive_t *parent)
+{
+    struct conf_include_t *include;
+    directive_t **end, **at, *tail;
+    size_t i;
+
+    if (unit->ntoplevel == 0)
+        return link;
+
+    if (unit->parent != parent) {
+        for (i = 0; i < unit->ntoplevel; i++)
+            unit->toplevel[i]->parent = parent;
+        unit->parent = parent;
+    }
+
+    tail = unit->toplevel[unit->ntoplevel - 1];
+
+    *link = unit->root;
+    end = &tail->next;
+
+    for (include = unit->includes; include != NULL; include = include->next) {
+        if (include->prev != NULL)
+            at = include->prev->endlink;
+        else if (include->link == &unit->root)
+            at = link;
+        else
+            at = include->link;
+
+        for (i = 0; i < include->count; i++)
+            at = parse_link_unit(units, units[include->first + i], at,
+                                 include->directive->parent);
+
+        *at = include->directive->next;
+        include->endlink = at;
+
+        if (include->directive == tail)
+            end = at;
+    }
+
+    return end;
+}
+
+/* Give up a build: free the units it parsed and leave the previous tree
+   as it was. */
+static void parse_build_abort(struct parse_build_t *build)
+{
+    size_t i;
+
+    for (i = 0; i < build->count; i++) {
+        if (build->units[i]->fresh)
+            free_unit(build->units[i]);
+    }
+
+    for (i = 0; i <= build->oldmask && build->old != NULL; i++) {
+        if (build->old[i] != NULL)
+            build->old[i]->taken = false;
+    }
+
+    gas_free(build->units);
+    gas_free(build->old);
+    arena_free(&build->arena);
+}
+
+/* Assemble the tree from the units of the build and hand them over to
+   it. Units of the previous tree that were not reused are freed. */
+static void parse_build_commit(struct parse_build_t *build,
+                               conftree_t *conftree)
+{
+    struct conf_file_t **files_tail = &conftree->files;
+    struct conf_unit_t **units_tail = &conftree->units, *unit;
+    directive_t **end;
+    int phase = profile_switch(PROFILE_BUILD);
+    size_t i;
+
+    /* Claimed units may have been replaced by new ones: only the units
+       in the build are kept. */
+    for (i = 0; i <= build->oldmask && build->old != NULL; i++) {
+        if (build->old[i] != NULL)
+            build->old[i]->taken = false;
+    }
+
+    for (i = 0; i < build->count; i++)
+        build->units[i]->taken = true;
+
+    for (i = 0; i <= build->oldmask && build->old != NULL; i++) {
+        unit = build->old[i];
+
+        if (unit != NULL && !unit->taken)
+            free_unit(unit);
+    }
+
+    if (conftree->image != NULL)
+        munmap(conftree->image, conftree->imagesize);
+    arena_free(&conftree->arena);
+
+    conftree->image = NULL;
+    conftree->imagesize = 0;
+    conftree->arena = build->arena;
+
+    for (i = 0; i < build->count; i++) {
+        unit = build->units[i];
+        unit->fresh = false;
+        unit->taken = false;
+        unit->old = NULL;
+
+        *units_tail = unit;
+        units_tail = &unit->next;
+
+        *files_tail = unit->file;
+        files_tail = &unit->file->next;
+    }
+
+    *units_tail = NULL;
+    *files_tail = build->dirs;
+
+    conftree->root = NULL;
+    end = parse_link_unit(build->units, build->units[0], &conftree->root,
+                          NULL);
+    *end = NULL;
+
+    gas_free(build->units);
+    gas_free(build->old);
+
+    profile_switch(phase);
+}
+
+int read_config_file(const char *filename, conftree_t *conftree)
+{
+    struct parse_build_t build;
+
+    conftree->root = NULL;
+    conftree->files = NULL;
+    conftree->units = NULL;
+    conftree->image = NULL;
+    conftree->imagesize = 0;
+    arena_init(&conftree->arena);
+
+    parse_build_init(&build, NULL);
+
+    if (parse_build_units(&build, filename) < 0) {
+        parse_build_abort(&build);
         return -GAS_FAILURE;
+    }
+
+    parse_build_commit(&build, conftree);
 
     return GAS_SUCCESS;
 }
+
+int reload_config_file(conftree_t *conftree, bool *changed)
+{
+    struct parse_build_t build;
+    struct conf_unit_t *unit;
+    size_t count = 0;
+
+    *changed = false;
+
+    for (unit = conftree->units; unit != NULL; unit = unit->next)
+        count++;
+
+    parse_build_init(&build, conftree->units);
+
+    if (parse_build_units(&build, conftree->files->filename) < 0) {
+        parse_build_abort(&build);
+        return -GAS_FAILURE;
+    }
+
+    /* Every file was reused, in the same order: the tree is the same. */
+    if (!build.parsed && build.count == count) {
+        parse_build_abort(&build);
+        return GAS_SUCCESS;
+    }
+
+    parse_build_commit(&build, conftree);
+    *changed = true;
+
+    return GAS_SUCCESS;
+}
+
+static int parse_stream_file(const char *filename,
+                             const struct conf_handler_t *handler,
+                             const struct conf_parser_t *includer)
+{
+    struct conf_parser_t parser;
+    struct stat statbuf;
+    size_t size = STREAM_BUFSIZE, len = 0, done;
+    ssize_t nread;
+    char *buf;
+    int fd, result = GAS_SUCCESS;
+
+    fd = open_config_fd(filename, &statbuf);
+    if (fd < 0)
+        return -GAS_FAILURE;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    /* One byte more for the '\0' after a last line without newline. */
+    buf = gas_malloc(size + 1);
+
+    parse_parser_init(&parser, handler, gas_intern(filename),
+                      includer != NULL ? includer->include_depth + 1 : 0);
+    parser.includer = includer;
+    parser.dev = statbuf.st_dev;
+    parser.ino = statbuf.st_ino;
+
+    for (;;) {
+        nread = read(fd, buf + len, size - len);
+        if (nread < 0) {
+            if (errno == EINTR)
+                continue;
+
+            log_print(LOG_ERR, errno, "cannot read configuration file '%s'",
+                      filename);
+            result = -GAS_FAILURE;
+            break;
+        }
+
+        if (nread == 0) {
+            buf[len] = '\0';
+            result = parse_config_data(&parser, buf, buf + len);
+            break;
+        }
+
+        len += nread;
+
+        /* Parse the complete lines and keep the rest for the next read;
+           a line longer than the buffer makes it grow. */
+        for (done = len; done > 0 && buf[done - 1] != '\n'; done--)
+            ;
+
+        if (done == 0) {
+            if (len == size) {
+                size *= 2;
+                buf = gas_realloc(buf, size + 1);
+            }
+            continue;
+        }
+
+        result = parse_config_data(&parser, buf, buf + done);
+        if (result < 0)
+            break;
+
+        memmove(buf, buf + done, len - done);
+        len -= done;
+    }
+
+    if (result >= 0)
+        result = parse_config_end(&parser);
+
+    parse_parser_free(&parser);
+    gas_free(buf);
+    close(fd);
+
+    return result;
+}
+
+/* Whether the file of statbuf is that of parser or of a parser
+   including it. */
+static bool parse_stream_loop(const struct conf_parser_t *parser,
+                              const struct stat *statbuf)
+{
+    for (; parser != NULL; parser = parser->includer) {
+        if (parser->dev == statbuf->st_dev && parser->ino == statbuf->st_ino)
+            return true;
+    }
+
+    return false;
+}
+
+/* Follow an Include directive: parse the files it names in its place. */
+static int parse_stream_include(struct conf_parser_t *parser,
+                                const char *arg)
+{
+    struct stat statbuf;
+    char *path;
+    glob_t globbuf;
+    size_t i;
+    int result = GAS_SUCCESS;
+
+    /* Errors are logged here, not as syntax errors. */
+    parser->aborted = true;
+
+    if (parser->include_depth >= INCLUDE_DEPTH_MAX) {
+        log_print(LOG_ERR, 0, "Include nested too deeply in file '%s' "
+                  "at line %d", parser->filename, parser->linenum);
+        return -GAS_FAILURE;
+    }
+
+    if (parse_include_glob(NULL, parser->filename, parser->linenum, arg,
+                           &path, &globbuf) < 0)
+        return -GAS_FAILURE;
+
+    /* A file that cannot be stat'ed fails when it is opened. */
+    for (i = 0; i < globbuf.gl_pathc && result >= 0; i++) {
+        if (stat(globbuf.gl_pathv[i], &statbuf) == 0
+            && parse_stream_loop(parser, &statbuf)) {
+            log_print(LOG_ERR, 0, "Include loop in file '%s' at line %d: "
+                      "'%s' is already being included", parser->filename,
+                      parser->linenum, globbuf.gl_pathv[i]);
+            result = -GAS_FAILURE;
+            break;
+        }
+
+        result = parse_stream_file(globbuf.gl_pathv[i], parser->handler,
+                                   parser);
+    }
+
+    parse_include_globfree(&path, &globbuf);
+
+    if (result >= 0)
+        parser->aborted = false;
+
+    return result;
+}
+
+int parse_config_stream(const char *filename,
+                        const struct conf_handler_t *handler)
+{
+    include_directive = gas_intern("Include");
+
+    return parse_stream_file(filename, handler, NULL);
+}
@@ -0,0 +1,351 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+/* RUSAGE_THREAD is a GNU extension. */
+#define _GNU_SOURCE
+
+#include "gasconfig.h"
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "common.h"
+#include "profile.h"
+
+static const char *const profile_phase_names[PROFILE_PHASE_MAX] = {
+    [PROFILE_OPTIONS] = "options",
+    [PROFILE_OPEN] = "open",
+    [PROFILE_READ] = "read",
+    [PROFILE_TOKENIZE] = "tokenize",
+    [PROFILE_BUILD] = "build",
+    [PROFILE_CACHE] = "cache",
+    [PROFILE_VALIDATE] = "validate",
+    [PROFILE_TEARDOWN] = "teardown",
+    [PROFILE_OTHER] = "other"
+};
+
+/* The phase of a thread and what it used in each phase since it last
+   left them all. Only the thread reads and writes it. */
+struct profile_thread_t {
+    int phase;
+
+    /* The full sample of the last switch, and the phase it switched
+       to, which the CPU time and page faults since are charged to. */
+    struct profile_sample_t since;
+    int since_phase;
+
+    /* The wall time and allocation count of the last switch or lap. */
+    struct profile_sample_t lap;
+
+    struct profile_stats_t phases[PROFILE_PHASE_MAX];
+};
+
+atomic_bool profile_on = false;
+
+static _Thread_local struct profile_thread_t profile_thread = {
+    .phase = PROFILE_NONE,
+    .since_phase = PROFILE_NONE
+};
+
+/* The totals of the threads that left their phases, and the times of
+   the first start and stop. */
+static struct profile_stats_t profile_phases[PROFILE_PHASE_MAX];
+static uint64_t profile_origin = 0;
+static uint64_t profile_ready = 0;
+static bool profile_started = false;
+static bool profile_stopped = false;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t profile_clock(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void profile_sample(struct profile_sample_t *sample)
+{
+    struct rusage usage;
+
+    sample->wall = profile_clock(CLOCK_MONOTONIC);
+    sample->cpu = profile_clock(CLOCK_THREAD_CPUTIME_ID);
+
+    if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+        sample->minor_faults = (uint64_t)usage.ru_minflt;
+        sample->major_faults = (uint64_t)usage.ru_majflt;
+    } else {
+        sample->minor_faults = 0;
+        sample->major_faults = 0;
+    }
+
+    sample->allocs = gas_alloc_count;
+}
+
+static void profile_sum(struct profile_stats_t *total,
+                        const struct profile_stats_t *stats)
+{
+    total->entries += stats->entries;
+    total->used.wall += stats->used.wall;
+    total->used.cpu += stats->used.cpu;
+    total->used.minor_faults += stats->used.minor_faults;
+    total->used.major_faults += stats->used.major_faults;
+    total->used.allocs += stats->used.allocs;
+}
+
+/* Charge the phase of the thread the wall time and allocations since
+   the last lap. */
+static void profile_charge_lap(struct profile_thread_t *thread,
+                               const struct profile_sample_t *now)
+{
+    struct profile_sample_t *used;
+
+    if (thread->phase != PROFILE_NONE) {
+        used = &thread->phases[thread->phase].used;
+        used->wall += now->wall - thread->lap.wall;
+        used->allocs += now->allocs - thread->lap.allocs;
+    }
+
+    thread->lap = *now;
+}
+
+/* Charge the thread up to now, and start a new full sample. */
+static void profile_charge(struct profile_thread_t *thread,
+                           const struct profile_sample_t *now)
+{
+    struct profile_sample_t *used;
+
+    profile_charge_lap(thread, now);
+
+    if (thread->since_phase != PROFILE_NONE) {
+        used = &thread->phases[thread->since_phase].used;
+        used->cpu += now->cpu - thread->since.cpu;
+        used->minor_faults += now->minor_faults - thread->since.minor_faults;
+        used->major_faults += now->major_faults - thread->since.major_faults;
+    }
+
+    thread->since = *now;
+}
+
+/* Add what the thread used to the totals, once it left its phases. */
+static void profile_flush(struct profile_thread_t *thread)
+{
+    int i;
+
+    pthread_mutex_lock(&profile_lock);
+
+    for (i = 0; i < PROFILE_PHASE_MAX; i++)
+        profile_sum(&profile_phases[i], &thread->phases[i]);
+
+    pthread_mutex_unlock(&profile_lock);
+
+    memset(thread->phases, 0, sizeof(thread->phases));
+}
+
+int profile_switch_slow(int phase)
+{
+    struct profile_thread_t *thread = &profile_thread;
+    struct profile_sample_t now;
+    int previous = thread->phase;
+
+    if (phase == previous)
+        return previous;
+
+    profile_sample(&now);
+    profile_charge(thread, &now);
+
+    thread->phase = phase;
+    thread->since_phase = phase;
+
+    if (phase != PROFILE_NONE)
+        thread->phases[phase].entries++;
+    else
+        profile_flush(thread);
+
+    return previous;
+}
+
+int profile_lap_slow(int phase)
+{
+    struct profile_thread_t *thread = &profile_thread;
+    struct profile_sample_t now;
+    int previous = thread->phase;
+
+    if (phase == previous)
+        return previous;
+
+    /* Entering or leaving the profile takes a full sample. */
+    if (previous == PROFILE_NONE || phase == PROFILE_NONE)
+        return profile_switch_slow(phase);
+
+    now.wall = profile_clock(CLOCK_MONOTONIC);
+    now.allocs = gas_alloc_count;
+    profile_charge_lap(thread, &now);
+
+    thread->phase = phase;
+    thread->phases[phase].entries++;
+
+    return previous;
+}
+
+void profile_start(int phase, const struct profile_sample_t *since)
+{
+    struct profile_thread_t *thread = &profile_thread;
+
+    if (since != NULL)
+        thread->since = *since;
+    else
+        profile_sample(&thread->since);
+
+    thread->lap = thread->since;
+    thread->phase = phase;
+    thread->since_phase = phase;
+    thread->phases[phase].entries++;
+
+    pthread_mutex_lock(&profile_lock);
+    if (!profile_started) {
+        profile_origin = thread->since.wall;
+        profile_started = true;
+    }
+    pthread_mutex_unlock(&profile_lock);
+
+    atomic_store_explicit(&profile_on, true, memory_order_relaxed);
+}
+
+void profile_stop(void)
+{
+    struct profile_thread_t *thread = &profile_thread;
+    struct profile_sample_t now;
+
+    atomic_store_explicit(&profile_on, false, memory_order_relaxed);
+
+    profile_sample(&now);
+    profile_charge(thread, &now);
+    thread->phase = PROFILE_NONE;
+    thread->since_phase = PROFILE_NONE;
+    profile_flush(thread);
+
+    pthread_mutex_lock(&profile_lock);
+    if (profile_started && !profile_stopped) {
+        profile_ready = now.wall - profile_origin;
+        profile_stopped = true;
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+void profile_get(struct profile_stats_t stats[PROFILE_PHASE_MAX],
+                 uint64_t *ready)
+{
+    pthread_mutex_lock(&profile_lock);
+    memcpy(stats, profile_phases, sizeof(profile_phases));
+    *ready = profile_ready;
+    pthread_mutex_unlock(&profile_lock);
+}
+
+const char *profile_phase_name(int phase)
+{
+    if (phase < 0 || phase >= PROFILE_PHASE_MAX)
+        return "?";
+
+    return profile_phase_names[phase];
+}
+
+/* Write nanoseconds as milliseconds. */
+static void profile_write_ms(FILE *stream, uint64_t ns)
+{
+    fprintf(stream, " %8" PRIu64 ".%03u", ns / 1000000,
+            (unsigned int)(ns / 1000 % 1000));
+}
+
+static void profile_write_row(FILE *stream, const char *name,
+                              const struct profile_stats_t *stats)
+{
+    fprintf(stream, "%-10s %8" PRIu64, name, stats->entries);
+    profile_write_ms(stream, stats->used.wall);
+    profile_write_ms(stream, stats->used.cpu);
+    fprintf(stream, " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+            stats->used.minor_faults, stats->used.major_faults,
+            stats->used.allocs);
+}
+
+static void profile_write_table(FILE *stream,
+                                const struct profile_stats_t *stats,
+                                uint64_t ready)
+{
+    struct profile_stats_t total;
+    int i;
+
+    memset(&total, 0, sizeof(total));
+
+    fputs("startup profile: ready after", stream);
+    profile_write_ms(stream, ready);
+    fputs(" ms; times are summed over threads\n", stream);
+
+    fprintf(stream, "%-10s %8s %12s %12s %8s %8s %8s\n", "phase",
+            "entries", "wall ms", "cpu ms", "minflt", "majflt", "allocs");
+
+    for (i = 0; i < PROFILE_PHASE_MAX; i++) {
+        profile_write_row(stream, profile_phase_names[i], &stats[i]);
+        profile_sum(&total, &stats[i]);
+    }
+
+    profile_write_row(stream, "total", &total);
+}
+
+static void profile_write_json(FILE *stream,
+                               const struct profile_stats_t *stats,
+                               uint64_t ready)
+{
+    int i;
+
+    fprintf(stream, "{\"ready_ns\":%" PRIu64 ",\"phases\":{", ready);
+
+    for (i = 0; i < PROFILE_PHASE_MAX; i++) {
+        fprintf(stream, "%s\"%s\":{\"entries\":%" PRIu64
+                ",\"wall_ns\":%" PRIu64 ",\"cpu_ns\":%" PRIu64
+                ",\"minor_faults\":%" PRIu64 ",\"major_faults\":%" PRIu64
+                ",\"allocs\":%" PRIu64 "}", i > 0 ? "," : "",
+                profile_phase_names[i], stats[i].entries,
+                stats[i].used.wall, stats[i].used.cpu,
+                stats[i].used.minor_faults, stats[i].used.major_faults,
+                stats[i].used.allocs);
+    }
+
+    fputs("}}\n", stream);
+}
+
+void profile_report(FILE *stream, enum profile_format_t format)
+{
+    struct profile_stats_t stats[PROFILE_PHASE_MAX];
+    uint64_t ready;
+
+    profile_get(stats, &ready);
+
+    if (format == PROFILE_FORMAT_JSON)
+        profile_write_json(stream, stats, ready);
+    else
+        profile_write_table(stream, stats, ready);
+
+    fflush(stream);
+}
@@ -0,0 +1,214 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "gasconfig.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scan.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+# define SCAN_X86 1
+# include <immintrin.h>
+#endif
+
+/* The vector scanners read whole aligned blocks, possibly past the end
+   of the string: tell AddressSanitizer this is fine. */
+#if defined(__has_attribute)
+# if __has_attribute(no_sanitize_address)
+#  define SCAN_NO_SANITIZE __attribute__((no_sanitize_address))
+# endif
+#endif
+#ifndef SCAN_NO_SANITIZE
+# define SCAN_NO_SANITIZE
+#endif
+
+static char *scan_word_scalar(const char *s, bool *escaped)
+{
+    for (; *s && *s != ' ' && *s != '\t'; s++) {
+        if (*s == '\\')
+            *escaped = true;
+    }
+
+    return (char *)s;
+}
+
+static char *scan_quoted_scalar(const char *s, char quote)
+{
+    while (*s && *s != quote && *s != '\\')
+        s++;
+
+    return (char *)s;
+}
+
+#ifdef SCAN_X86
+
+/* Both vector versions work the same way: load the aligned block that
+   holds s, ignore the bytes before s, and compute a bit mask of the
+   bytes that stop the scan. Token boundaries are the lowest set bits. */
+
+SCAN_NO_SANITIZE
+static char *scan_word_sse2(const char *s, bool *escaped)
+{
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i zero = _mm_setzero_si128();
+    const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+    uint32_t valid = ~0U << (s - p), stop, escape;
+    __m128i v;
+
+    for (;;) {
+        v = _mm_load_si128((const __m128i *)p);
+
+        stop = _mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space),
+                                      _mm_cmpeq_epi8(v, tab)),
+                         _mm_cmpeq_epi8(v, zero))) & valid;
+        escape = _mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)) & valid;
+
+        if (stop != 0) {
+            if (escape & ((stop & -stop) - 1))
+                *escaped = true;
+            return (char *)p + __builtin_ctz(stop);
+        }
+
+        if (escape != 0)
+            *escaped = true;
+
+        valid = ~0U;
+        p += 16;
+    }
+}
+
+SCAN_NO_SANITIZE
+static char *scan_quoted_sse2(const char *s, char quote)
+{
+    const __m128i q = _mm_set1_epi8(quote);
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i zero = _mm_setzero_si128();
+    const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+    uint32_t valid = ~0U << (s - p), stop;
+    __m128i v;
+
+    for (;;) {
+        v = _mm_load_si128((const __m128i *)p);
+
+        stop = _mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, q),
+                                      _mm_cmpeq_epi8(v, backslash)),
+                         _mm_cmpeq_epi8(v, zero))) & valid;
+
+        if (stop != 0)
+            return (char *)p + __builtin_ctz(stop);
+
+        valid = ~0U;
+        p += 16;
+    }
+}
+
+SCAN_NO_SANITIZE __attribute__((target("avx2")))
+static char *scan_word_avx2(const char *s, bool *escaped)
+{
+    const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i zero = _mm256_setzero_si256();
+    const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)31);
+    uint32_t valid = ~0U << (s - p), stop, escape;
+    __m256i v;
+
+    for (;;) {
+        v = _mm256_load_si256((const __m256i *)p);
+
+        stop = (uint32_t)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                                            _mm256_cmpeq_epi8(v, tab)),
+                            _mm256_cmpeq_epi8(v, zero))) & valid;
+        escape = (uint32_t)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(v, backslash)) & valid;
+
+        if (stop != 0) {
+            if (escape & ((stop & -stop) - 1))
+                *escaped = true;
+            return (char *)p + __builtin_ctz(stop);
+        }
+
+        if (escape != 0)
+            *escaped = true;
+
+        valid = ~0U;
+        p += 32;
+    }
+}
+
+SCAN_NO_SANITIZE __attribute__((target("avx2")))
+static char *scan_quoted_avx2(const char *s, char quote)
+{
+    const __m256i q = _mm256_set1_epi8(quote);
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i zero = _mm256_setzero_si256();
+    const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)31);
+    uint32_t valid = ~0U << (s - p), stop;
+    __m256i v;
+
+    for (;;) {
+        v = _mm256_load_si256((const __m256i *)p);
+
+        stop = (uint32_t)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, q),
+                                            _mm256_cmpeq_epi8(v, backslash)),
+                            _mm256_cmpeq_epi8(v, zero))) & valid;
+
+        if (stop != 0)
+            return (char *)p + __builtin_ctz(stop);
+
+        valid = ~0U;
+        p += 32;
+    }
+}
+
+#endif  /* SCAN_X86 */
+
+static char *(*scan_word_impl)(const char *, bool *) = scan_word_scalar;
+static char *(*scan_quoted_impl)(const char *, char) = scan_quoted_scalar;
+
+/* Pick the widest scanners the processor supports, before any parser
+   thread runs. */
+__attribute__((constructor))
+static void scan_init(void)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        scan_word_impl = scan_word_avx2;
+        scan_quoted_impl = scan_quoted_avx2;
+    } else {
+        scan_word_impl = scan_word_sse2;
+        scan_quoted_impl = scan_quoted_sse2;
+    }
+#endif
+}
+
+char *scan_word(const char *s, bool *escaped)
+{
+    return scan_word_impl(s, escaped);
+}
+
+char *scan_quoted(const char *s, char quote)
+{
+    return scan_quoted_impl(s, quote);
+}
@@ -0,0 +1,213 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "gasconfig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "log.h"
+#include "trace.h"
+
+#ifdef GAS_TRACE
+
+struct trace_event_t {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+};
+
+/* The spans of a thread, the oldest overwritten when the ring is full.
+   Only the thread writes them. */
+struct trace_thread_t {
+    struct gas_thread_record_t record;
+
+    struct trace_event_t *events;
+
+    /* The spans recorded in all. */
+    size_t count;
+
+    /* The number of the thread in the trace. A record whose thread
+       exited is reused by a later one, which keeps the number: their
+       spans do not overlap. */
+    unsigned int tid;
+};
+
+atomic_bool trace_on = false;
+
+/* The size of the rings, a power of two, and when tracing started. */
+static size_t trace_events;
+static uint64_t trace_epoch;
+
+static void trace_thread_init(struct gas_thread_record_t *record);
+static void trace_thread_release(struct gas_thread_record_t *record);
+
+/* The records of the threads that recorded spans, and how many there
+   are, under the lock of the registry. */
+static struct gas_thread_registry_t trace_threads =
+    GAS_THREAD_REGISTRY_INIT(struct trace_thread_t, trace_thread_init,
+                             trace_thread_release);
+static unsigned int trace_nthreads = 0;
+
+static _Thread_local struct trace_thread_t *trace_thread = NULL;
+
+static void trace_thread_init(struct gas_thread_record_t *record)
+{
+    struct trace_thread_t *thread = (struct trace_thread_t *)record;
+
+    thread->events = gas_malloc(trace_events * sizeof(*thread->events));
+    thread->tid = ++trace_nthreads;
+}
+
+static void trace_thread_release(struct gas_thread_record_t *record)
+{
+    (void)record;
+
+    trace_thread = NULL;
+}
+
+void trace_record(const char *name, uint64_t start)
+{
+    struct trace_thread_t *thread = trace_thread;
+    struct trace_event_t *event;
+
+    if (thread == NULL) {
+        thread = trace_thread = gas_thread_record_take(&trace_threads);
+        if (thread == NULL)
+            return;
+    }
+
+    event = &thread->events[thread->count++ & (trace_events - 1)];
+    event->name = name;
+    event->start = start;
+    event->end = trace_clock();
+}
+
+int trace_start(size_t events)
+{
+    if (atomic_load(&trace_on))
+        return GAS_SUCCESS;
+
+    if (events == 0)
+        events = TRACE_EVENTS_DEFAULT;
+
+    for (trace_events = 1; trace_events < events; trace_events *= 2)
+        ;
+
+    trace_epoch = trace_clock();
+
+    /* The calling thread comes first in the trace. */
+    trace_thread = gas_thread_record_take(&trace_threads);
+
+    atomic_store(&trace_on, true);
+
+    return GAS_SUCCESS;
+}
+
+/* Write a time in nanoseconds as microseconds, the unit of the
+   format. */
+static void trace_write_time(FILE *stream, uint64_t ns)
+{
+    fprintf(stream, "%" PRIu64 ".%03u", ns / 1000, (unsigned int)(ns % 1000));
+}
+
+int trace_write(const char *path)
+{
+    const struct gas_thread_record_t *record;
+    const struct trace_thread_t *thread;
+    const struct trace_event_t *event;
+    const char *separator = "";
+    size_t i, first;
+    FILE *stream;
+    long pid = (long)getpid();
+
+    stream = fopen(path, "w");
+    if (stream == NULL) {
+        log_print(LOG_ERR, errno, "cannot write trace file '%s'", path);
+        return -GAS_FAILURE;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", stream);
+
+    pthread_mutex_lock(&trace_threads.lock);
+
+    for (record = trace_threads.records; record != NULL;
+         record = record->next) {
+        thread = (const struct trace_thread_t *)record;
+
+        fprintf(stream, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+                "\"pid\":%ld,\"tid\":%u,\"args\":{\"name\":\"",
+                separator, pid, thread->tid);
+        if (thread->tid == 1)
+            fputs("main\"}}", stream);
+        else
+            fprintf(stream, "thread %u\"}}", thread->tid);
+        separator = ",";
+
+        first = thread->count > trace_events
+                ? thread->count - trace_events : 0;
+        for (i = first; i < thread->count; i++) {
+            event = &thread->events[i & (trace_events - 1)];
+
+            fprintf(stream, ",\n{\"name\":\"%s\",\"cat\":\"gastool\","
+                    "\"ph\":\"X\",\"pid\":%ld,\"tid\":%u,\"ts\":",
+                    event->name, pid, thread->tid);
+            trace_write_time(stream, event->start - trace_epoch);
+            fputs(",\"dur\":", stream);
+            trace_write_time(stream, event->end - event->start);
+            fputc('}', stream);
+        }
+    }
+
+    pthread_mutex_unlock(&trace_threads.lock);
+
+    fputs("\n]}\n", stream);
+
+    if (ferror(stream) | (fclose(stream) != 0)) {
+        log_print(LOG_ERR, errno, "cannot write trace file '%s'", path);
+        return -GAS_FAILURE;
+    }
+
+    return GAS_SUCCESS;
+}
+
+#else  /* !GAS_TRACE */
+
+int trace_start(size_t events)
+{
+    (void)events;
+
+    log_print(LOG_WARNING, 0, "tracing is not compiled in");
+    return -GAS_FAILURE;
+}
+
+int trace_write(const char *path)
+{
+    (void)path;
+
+    return -GAS_FAILURE;
+}
+
+#endif  /* !GAS_TRACE */
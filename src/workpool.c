@@ -0,0 +1,527 @@
+/* Copyright (C) 2020 Guilherme de Almeida Suckevicz.
+   This file is part of Gastool.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>. */
+
+#include "gasconfig.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "common.h"
+#include "log.h"
+#include "evloop.h"
+#include "workpool.h"
+
+/* The largest deque. */
+#define WORKPOOL_QUEUE_MAX (1 << 24)
+
+/* A Chase-Lev deque, as in "Correct and Efficient Work-Stealing for
+   Weak Memory Models" (Lê et al., 2013), of fixed size. The owner
+   pushes and takes at the bottom, thieves steal at the top. */
+struct workpool_deque_t {
+    _Alignas(CACHE_LINE_SIZE) atomic_int_least64_t top;
+    _Alignas(CACHE_LINE_SIZE) atomic_int_least64_t bottom;
+    _Atomic(struct work_t *) *slots;
+    int_least64_t mask;
+};
+
+struct workpool_worker_t {
+    struct workpool_deque_t deque;
+
+    /* Work submitted from other threads, most recent first. Anyone may
+       take the whole list. */
+    _Alignas(CACHE_LINE_SIZE) _Atomic(struct work_t *) inbox;
+
+    /* Work taken from an inbox that did not fit in the deque, oldest
+       first. Only the worker uses it. */
+    struct work_t *local;
+
+    /* The state of the random number generator of the worker, to pick
+       victims. */
+    uint32_t random;
+
+    workpool_t *pool;
+    pthread_t thread;
+};
+
+struct workpool_t {
+    struct workpool_worker_t *workers;
+    int nworkers;
+
+    /* The worker that gets the next work submitted from outside. */
+    atomic_uint next;
+
+    /* Idle workers sleep until the epoch changes: it is incremented
+       after work is queued, and they are only woken if some sleep. */
+    _Alignas(CACHE_LINE_SIZE) atomic_uint epoch;
+    atomic_int sleepers;
+    atomic_bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    /* Finished work whose done callback runs on the loop, most recent
+       first, and the eventfd that tells the loop about it. */
+    evloop_t *loop;
+    _Alignas(CACHE_LINE_SIZE) _Atomic(struct work_t *) completed;
+    struct evloop_io_t completion;
+};
+
+/* The worker the calling thread is, if any. */
+static _Thread_local struct workpool_worker_t *self = NULL;
+
+static bool deque_push(struct workpool_deque_t *deque, struct work_t *work)
+{
+    int_least64_t bottom, top;
+
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top > deque->mask)
+        return false;
+
+    atomic_store_explicit(&deque->slots[bottom & deque->mask], work,
+                          memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+
+    return true;
+}
+
+static struct work_t *deque_take(struct workpool_deque_t *deque)
+{
+    struct work_t *work = NULL;
+    int_least64_t bottom, top;
+
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top <= bottom) {
+        work = atomic_load_explicit(&deque->slots[bottom & deque->mask],
+                                    memory_order_relaxed);
+
+        /* The last one: thieves may want it too. */
+        if (top == bottom) {
+            if (!atomic_compare_exchange_strong_explicit(
+                    &deque->top, &top, top + 1,
+                    memory_order_seq_cst, memory_order_relaxed))
+                work = NULL;
+
+            atomic_store_explicit(&deque->bottom, bottom + 1,
+                                  memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&deque->bottom, bottom + 1,
+                              memory_order_relaxed);
+    }
+
+    return work;
+}
+
+/* Set *lost if another thread took the work first, when the deque may
+   not be empty. */
+static struct work_t *deque_steal(struct workpool_deque_t *deque,
+                                  bool *lost)
+{
+    struct work_t *work;
+    int_least64_t bottom, top;
+
+    top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom)
+        return NULL;
+
+    work = atomic_load_explicit(&deque->slots[top & deque->mask],
+                                memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+        *lost = true;
+        return NULL;
+    }
+
+    return work;
+}
+
+static void list_push(_Atomic(struct work_t *) *list, struct work_t *work,
+                      bool *was_empty)
+{
+    struct work_t *head = atomic_load_explicit(list, memory_order_relaxed);
+
+    do {
+        work->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(list, &head, work,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+
+    if (was_empty != NULL)
+        *was_empty = head == NULL;
+}
+
+/* Take a whole list, oldest first. */
+static struct work_t *list_take(_Atomic(struct work_t *) *list)
+{
+    struct work_t *work, *next, *reversed = NULL;
+
+    if (atomic_load_explicit(list, memory_order_relaxed) == NULL)
+        return NULL;
+
+    work = atomic_exchange_explicit(list, NULL, memory_order_acquire);
+    for (; work != NULL; work = next) {
+        next = work->next;
+        work->next = reversed;
+        reversed = work;
+    }
+
+    return reversed;
+}
+
+static void workpool_notify(workpool_t *pool)
+{
+    atomic_fetch_add(&pool->epoch, 1);
+
+    if (atomic_load(&pool->sleepers) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void workpool_completed(evloop_t *loop, struct evloop_io_t *io,
+                               uint32_t events)
+{
+    workpool_t *pool = io->data;
+    struct work_t *work, *next;
+    uint64_t count;
+
+    (void)loop;
+    (void)events;
+
+    /* Read first: work completed after the list is taken writes
+       again. */
+    if (read(io->fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        log_print(LOG_ERR, errno, "cannot read work completions");
+
+    for (work = list_take(&pool->completed); work != NULL; work = next) {
+        next = work->next;
+        work->done(work);
+    }
+}
+
+static void workpool_run(workpool_t *pool, struct work_t *work)
+{
+    work_fn *done = work->done;
+    uint64_t one = 1;
+    bool was_empty;
+
+    /* Without done, the work is no longer ours once it has run. */
+    work->run(work);
+
+    if (done == NULL)
+        return;
+
+    if (pool->loop == NULL) {
+        done(work);
+        return;
+    }
+
+    list_push(&pool->completed, work, &was_empty);
+    if (was_empty && write(pool->completion.fd, &one, sizeof(one)) < 0
+        && errno != EAGAIN)
+        log_print(LOG_ERR, errno, "cannot signal work completion");
+}
+
+/* Take work from the local list, and move what is left of it to the
+   deque, where it can be stolen. */
+static struct work_t *workpool_take_local(struct workpool_worker_t *worker)
+{
+    struct work_t *work = worker->local, *next;
+
+    if (work == NULL)
+        return NULL;
+
+    worker->local = work->next;
+    while (worker->local != NULL) {
+        /* Once in the deque it may be run, and changed, at once. */
+        next = worker->local->next;
+        if (!deque_push(&worker->deque, worker->local))
+            break;
+
+        worker->local = next;
+    }
+
+    return work;
+}
+
+static uint32_t workpool_random(struct workpool_worker_t *worker)
+{
+    uint32_t x = worker->random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return worker->random = x;
+}
+
+/* Find work: in the deque of the worker, in its inbox, then in those
+   of the others, starting with a random one. Set *lost if some may
+   have been missed. */
+static struct work_t *workpool_find(struct workpool_worker_t *worker,
+                                    bool *lost)
+{
+    workpool_t *pool = worker->pool;
+    struct workpool_worker_t *victim;
+    struct work_t *work;
+    int i, start;
+
+    *lost = false;
+
+    work = deque_take(&worker->deque);
+    if (work != NULL)
+        return work;
+
+    if (worker->local == NULL)
+        worker->local = list_take(&worker->inbox);
+
+    work = workpool_take_local(worker);
+    if (work != NULL)
+        return work;
+
+    start = (int)(workpool_random(worker) % (uint32_t)pool->nworkers);
+    for (i = 0; i < pool->nworkers; i++) {
+        victim = &pool->workers[(start + i) % pool->nworkers];
+        if (victim == worker)
+            continue;
+
+        work = deque_steal(&victim->deque, lost);
+        if (work != NULL)
+            return work;
+
+        worker->local = list_take(&victim->inbox);
+        work = workpool_take_local(worker);
+        if (work != NULL)
+            return work;
+    }
+
+    return NULL;
+}
+
+static void *workpool_worker(void *arg)
+{
+    struct workpool_worker_t *worker = arg;
+    workpool_t *pool = worker->pool;
+    struct work_t *work;
+    unsigned int epoch;
+    bool lost;
+
+    self = worker;
+
+    for (;;) {
+        work = workpool_find(worker, &lost);
+        if (work != NULL) {
+            workpool_run(pool, work);
+            continue;
+        }
+
+        if (lost)
+            continue;
+
+        /* Queued work is run before stopping. */
+        if (atomic_load(&pool->stopping))
+            break;
+
+        /* Look once more after announcing the wait, so that work
+           queued meanwhile either is found or changes the epoch. */
+        atomic_fetch_add(&pool->sleepers, 1);
+        epoch = atomic_load(&pool->epoch);
+
+        work = workpool_find(worker, &lost);
+        if (work == NULL && !lost) {
+            pthread_mutex_lock(&pool->lock);
+            while (atomic_load(&pool->epoch) == epoch
+                   && !atomic_load(&pool->stopping))
+                pthread_cond_wait(&pool->wake, &pool->lock);
+            pthread_mutex_unlock(&pool->lock);
+        }
+
+        atomic_fetch_sub(&pool->sleepers, 1);
+
+        if (work != NULL)
+            workpool_run(pool, work);
+    }
+
+    self = NULL;
+
+    return NULL;
+}
+
+static void workpool_stop(workpool_t *pool, int nstarted)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    atomic_store(&pool->stopping, true);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < nstarted; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+}
+
+static void workpool_release(workpool_t *pool)
+{
+    int i;
+
+    if (pool->loop != NULL) {
+        evloop_io_remove(pool->loop, &pool->completion);
+        close(pool->completion.fd);
+    }
+
+    for (i = 0; i < pool->nworkers; i++)
+        gas_free(pool->workers[i].deque.slots);
+
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    gas_free(pool->workers);
+    gas_free(pool);
+}
+
+workpool_t *workpool_create(int nthreads, int queue_size, evloop_t *loop)
+{
+    struct workpool_worker_t *worker;
+    workpool_t *pool;
+    size_t nslots;
+    long nprocs;
+    int i, fd, result = 0;
+
+    if (nthreads < 0) {
+        log_print(LOG_ERR, 0, "invalid number of worker threads %d",
+                  nthreads);
+        return NULL;
+    }
+
+    if (queue_size < 1 || queue_size > WORKPOOL_QUEUE_MAX) {
+        log_print(LOG_ERR, 0, "invalid worker queue size %d", queue_size);
+        return NULL;
+    }
+
+    if (nthreads == 0) {
+        nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = nprocs > 1 ? (int)nprocs : 1;
+    }
+
+    for (nslots = 1; nslots < (size_t)queue_size; nslots *= 2)
+        ;
+
+    pool = gas_aligned_alloc(CACHE_LINE_SIZE, sizeof(*pool));
+    memset(pool, 0, sizeof(*pool));
+    pool->nworkers = nthreads;
+    pool->loop = loop;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    pool->workers = gas_aligned_alloc(CACHE_LINE_SIZE,
+                                      nthreads * sizeof(*pool->workers));
+    memset(pool->workers, 0, nthreads * sizeof(*pool->workers));
+
+    for (i = 0; i < nthreads; i++) {
+        worker = &pool->workers[i];
+        worker->deque.slots = gas_malloc(nslots
+                                         * sizeof(*worker->deque.slots));
+        worker->deque.mask = (int_least64_t)nslots - 1;
+        worker->random = 2654435761u * (uint32_t)(i + 1);
+        worker->pool = pool;
+    }
+
+    if (loop != NULL) {
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            log_print(LOG_ERR, errno, "cannot create worker pool");
+            pool->loop = NULL;
+            workpool_release(pool);
+            return NULL;
+        }
+
+        if (evloop_io_add(loop, &pool->completion, fd, EPOLLIN,
+                          workpool_completed, pool) < 0) {
+            close(fd);
+            pool->loop = NULL;
+            workpool_release(pool);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        result = gas_thread_create(&pool->workers[i].thread,
+                                   workpool_worker, &pool->workers[i]);
+        if (result != 0)
+            break;
+    }
+
+    if (result != 0) {
+        log_print(LOG_ERR, result, "cannot start worker threads");
+        workpool_stop(pool, i);
+        workpool_release(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void workpool_free(workpool_t *pool)
+{
+    if (pool == NULL)
+        return;
+
+    workpool_stop(pool, pool->nworkers);
+
+    if (pool->loop != NULL)
+        workpool_completed(pool->loop, &pool->completion, EPOLLIN);
+
+    workpool_release(pool);
+}
+
+void workpool_submit(workpool_t *pool, struct work_t *work)
+{
+    struct workpool_worker_t *worker = self;
+    unsigned int i;
+
+    if (worker != NULL && worker->pool == pool) {
+        if (!deque_push(&worker->deque, work)) {
+            workpool_run(pool, work);
+            return;
+        }
+    } else {
+        i = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed);
+        list_push(&pool->workers[i % (unsigned int)pool->nworkers].inbox,
+                  work, NULL);
+    }
+
+    workpool_notify(pool);
+}
+
+int workpool_size(const workpool_t *pool)
+{
+    return pool->nworkers;
+}